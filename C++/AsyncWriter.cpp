@@ -0,0 +1,512 @@
+#include "AsyncWriter.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define GIGABROT_POSIX_IO 1
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define GIGABROT_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+uint64_t nanoseconds_since(chrono::steady_clock::time_point begin)
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+}
+
+#ifdef GIGABROT_IO_URING
+/**
+ * Minimal io_uring submission/completion ring for positioned writes, driven through the raw
+ * syscalls so that liburing is not needed
+ */
+class Uring
+{
+ public:
+
+  explicit Uring(unsigned int entries)
+  {
+    io_uring_params params{};
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0)
+    {
+      return; // kernel without io_uring, or blocked by a sandbox
+    }
+
+    sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+    {
+      sqSize = cqSize = max(sqSize, cqSize);
+    }
+
+    sq = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+              IORING_OFF_SQ_RING);
+    cq = single ? sq : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            fd, IORING_OFF_CQ_RING);
+    sqeSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqeSize, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+    {
+      release();
+      return;
+    }
+
+    auto *sqBytes = static_cast<unsigned char *>(sq);
+    sqHead = reinterpret_cast<unsigned int *>(sqBytes + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned int *>(sqBytes + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned int *>(sqBytes + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned int *>(sqBytes + params.sq_off.array);
+    sqEntries = params.sq_entries;
+
+    auto *cqBytes = static_cast<unsigned char *>(cq);
+    cqHead = reinterpret_cast<unsigned int *>(cqBytes + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned int *>(cqBytes + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned int *>(cqBytes + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cqBytes + params.cq_off.cqes);
+  }
+
+  ~Uring()
+  {
+    release();
+  }
+
+  bool ready() const
+  {
+    return fd >= 0;
+  }
+
+  /**
+   * Queue a positioned write, submitted by the next enter()
+   * @return FALSE if the submission ring is full
+   */
+  bool queue_write(int file, const void *data, unsigned int size, uint64_t offset, uint64_t tag)
+  {
+    unsigned int tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+    {
+      return false;
+    }
+    unsigned int index = tail & sqMask;
+    io_uring_sqe &sqe = sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = file;
+    sqe.addr = reinterpret_cast<uint64_t>(data);
+    sqe.len = size;
+    sqe.off = offset;
+    sqe.user_data = tag;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    pending++;
+    return true;
+  }
+
+  /**
+   * Submit queued writes and wait for at least waitCount completions
+   * @return FALSE on failure
+   */
+  bool enter(unsigned int waitCount)
+  {
+    int result = static_cast<int>(syscall(__NR_io_uring_enter, fd, pending, waitCount,
+                                          IORING_ENTER_GETEVENTS, nullptr, 0));
+    if (result < 0)
+    {
+      return false;
+    }
+    pending -= min(pending, static_cast<unsigned int>(result));
+    return true;
+  }
+
+  /**
+   * @param tag - user data of the completed write
+   * @param result - bytes written or -errno
+   * @return FALSE if no completion is waiting
+   */
+  bool reap(uint64_t &tag, int &result)
+  {
+    unsigned int head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+    {
+      return false;
+    }
+    const io_uring_cqe &cqe = cqes[head & cqMask];
+    tag = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+ private:
+
+  void release()
+  {
+    if (sqes != nullptr && sqes != MAP_FAILED)
+    {
+      munmap(sqes, sqeSize);
+    }
+    if (cq != nullptr && cq != MAP_FAILED && !single)
+    {
+      munmap(cq, cqSize);
+    }
+    if (sq != nullptr && sq != MAP_FAILED)
+    {
+      munmap(sq, sqSize);
+    }
+    sq = cq = nullptr;
+    sqes = nullptr;
+    if (fd >= 0)
+    {
+      ::close(fd);
+    }
+    fd = -1;
+  }
+
+  int fd = -1;
+
+  bool single = false;
+
+  void *sq = nullptr;
+
+  void *cq = nullptr;
+
+  io_uring_sqe *sqes = nullptr;
+
+  size_t sqSize = 0;
+
+  size_t cqSize = 0;
+
+  size_t sqeSize = 0;
+
+  unsigned int *sqHead = nullptr;
+
+  unsigned int *sqTail = nullptr;
+
+  unsigned int sqMask = 0;
+
+  unsigned int *sqArray = nullptr;
+
+  unsigned int sqEntries = 0;
+
+  unsigned int *cqHead = nullptr;
+
+  unsigned int *cqTail = nullptr;
+
+  unsigned int cqMask = 0;
+
+  io_uring_cqe *cqes = nullptr;
+
+  unsigned int pending = 0;
+};
+#endif
+
+} // namespace
+
+AsyncWriter::AsyncWriter(string fileName, size_t bufferSize, unsigned int bufferCount,
+                         size_t nodeCount) :
+fileName(std::move(fileName)), freeBuffers(max<size_t>(nodeCount, 1) + 1), remoteBuffers(0),
+submitted(true), fd(-1), isOpen(false), ring(false), stalls(0), stallNanoseconds(0), queued(0), maxQueued(0), writes(0), bytes(0),
+writeNanoseconds(0)
+{
+  this->bufferSize = (max<size_t>(bufferSize, 1) + alignment - 1) / alignment * alignment;
+  bufferCount = max(1U, bufferCount);
+
+  buffers.resize(bufferCount);
+  storage.reserve(bufferCount);
+  // left untouched here so the pages land on the node of the worker that first fills them
+  for (auto &buffer : buffers)
+  {
+    storage.emplace_back(static_cast<unsigned char *>(aligned_alloc(alignment, this->bufferSize)),
+                         free);
+    if (!storage.back())
+    {
+      throw bad_alloc();
+    }
+    buffer = Buffer{storage.back().get(), this->bufferSize, 0, 0, freeBuffers.size() - 1};
+    freeBuffers.back().push_back(&buffer);
+  }
+}
+
+AsyncWriter::~AsyncWriter()
+{
+  close();
+}
+
+bool AsyncWriter::open(uint64_t fileSize)
+{
+#ifdef GIGABROT_POSIX_IO
+  fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    return false;
+  }
+#ifdef __linux__
+  // reserve the extents up front so the file system does not allocate on every write; not
+  // every file system supports it, in which case the writes simply extend the file
+  if (fallocate(fd, 0, 0, static_cast<off_t>(fileSize)) != 0)
+  {
+    (void) ftruncate(fd, static_cast<off_t>(fileSize));
+  }
+#else
+  (void) ftruncate(fd, static_cast<off_t>(fileSize));
+#endif
+#else
+  stream.open(fileName, ios::binary);
+  if (!stream.is_open())
+  {
+    return false;
+  }
+#endif
+
+  isOpen = true;
+  writer = thread(&AsyncWriter::run, this);
+  return true;
+}
+
+AsyncWriter::Buffer *AsyncWriter::acquire()
+{
+  size_t node = ThreadPool::current_node() % (freeBuffers.size() - 1);
+  unique_lock guard(freeLock);
+  Buffer *buffer = take_free(node);
+  if (buffer != nullptr)
+  {
+    return buffer;
+  }
+
+  // every buffer is still waiting for the disk
+  bool tracing = Tracer::enabled();
+  uint64_t traceBegin = tracing ? Tracer::now() : 0;
+  auto begin = chrono::steady_clock::now();
+  freeSignal.wait(guard, [this, node, &buffer]()
+                  {
+                    buffer = take_free(node);
+                    return buffer != nullptr;
+                  });
+  stalls++;
+  stallNanoseconds += nanoseconds_since(begin);
+  if (tracing)
+  {
+    Tracer::record("buffer wait", "writer", traceBegin, Tracer::now());
+  }
+  return buffer;
+}
+
+AsyncWriter::Buffer *AsyncWriter::take_free(size_t node)
+{
+  vector<Buffer *> *list = &freeBuffers[node];
+  if (list->empty())
+  {
+    list = &freeBuffers.back(); // first filled by this worker, so its pages land on its node
+  }
+  for (size_t other = 0; list->empty() && other + 1 < freeBuffers.size(); other++)
+  {
+    list = &freeBuffers[other];
+  }
+  if (list->empty())
+  {
+    return nullptr;
+  }
+  Buffer *buffer = list->back();
+  list->pop_back();
+  if (buffer->node == freeBuffers.size() - 1)
+  {
+    buffer->node = node;
+  } else if (buffer->node != node) {
+    remoteBuffers++;
+  }
+  return buffer;
+}
+
+void AsyncWriter::submit(Buffer *buffer)
+{
+  uint64_t depth = ++queued;
+  uint64_t high = maxQueued.load(memory_order_relaxed);
+  while (depth > high && !maxQueued.compare_exchange_weak(high, depth, memory_order_relaxed))
+  {}
+  submitted.push(buffer);
+}
+
+void AsyncWriter::write(const void *data, size_t size, uint64_t offset)
+{
+  if (size > bufferSize)
+  {
+    throw invalid_argument("write larger than the writer's buffers");
+  }
+  Buffer *buffer = acquire();
+  memcpy(buffer->data, data, size);
+  buffer->offset = offset;
+  buffer->size = size;
+  submit(buffer);
+}
+
+void AsyncWriter::close()
+{
+  if (!isOpen)
+  {
+    return;
+  }
+  submitted.unblock(); // writer drains what is queued, then returns
+  writer.join();
+#ifdef GIGABROT_POSIX_IO
+  ::close(fd);
+  fd = -1;
+#else
+  stream.close();
+#endif
+  isOpen = false;
+}
+
+size_t AsyncWriter::get_buffer_size() const
+{
+  return bufferSize;
+}
+
+uint64_t AsyncWriter::get_stalls() const
+{
+  return stalls;
+}
+
+double AsyncWriter::get_stall_seconds() const
+{
+  return static_cast<double>(stallNanoseconds) / 1e9;
+}
+
+void AsyncWriter::recycle(Buffer *buffer)
+{
+  writes++;
+  bytes += buffer->size;
+  queued--;
+  {
+    scoped_lock guard(freeLock);
+    freeBuffers[buffer->node].push_back(buffer);
+  }
+  freeSignal.notify_one();
+}
+
+void AsyncWriter::write_fully(const Buffer *buffer, size_t done)
+{
+  while (done < buffer->size)
+  {
+#ifdef GIGABROT_POSIX_IO
+    ssize_t written = pwrite(fd, buffer->data + done, buffer->size - done,
+                             static_cast<off_t>(buffer->offset + done));
+    if (written <= 0)
+    {
+      cout << "Could not write to " << fileName << "\n";
+      return;
+    }
+    done += static_cast<size_t>(written);
+#else
+    stream.seekp(static_cast<streamoff>(buffer->offset + done));
+    stream.write(reinterpret_cast<const char *>(buffer->data + done),
+                 static_cast<streamsize>(buffer->size - done));
+    done = buffer->size;
+#endif
+  }
+}
+
+void AsyncWriter::run()
+{
+  Tracer::name_thread("writer");
+  Buffer *buffer = nullptr;
+
+#ifdef GIGABROT_IO_URING
+  Uring uring(static_cast<unsigned int>(buffers.size()));
+  ring = uring.ready();
+  if (ring)
+  {
+    vector<Buffer *> inFlight;
+    inFlight.reserve(buffers.size());
+    while (true)
+    {
+      // block for work only when nothing is in flight, then batch whatever else is queued
+      if (inFlight.empty())
+      {
+        if (!submitted.pop(buffer))
+        {
+          return;
+        }
+      } else if (!submitted.try_pop(buffer)) {
+        buffer = nullptr;
+      }
+      while (buffer != nullptr)
+      {
+        // one ring entry per pool buffer, so the ring cannot be full here
+        uring.queue_write(fd, buffer->data, static_cast<unsigned int>(buffer->size),
+                          buffer->offset, reinterpret_cast<uint64_t>(buffer));
+        inFlight.push_back(buffer);
+        if (!submitted.try_pop(buffer))
+        {
+          buffer = nullptr;
+        }
+      }
+
+      Tracer::Span write("write", "writer", static_cast<int64_t>(inFlight.size()));
+      auto begin = chrono::steady_clock::now();
+      if (!uring.enter(1))
+      {
+        break;
+      }
+      uint64_t tag;
+      int result;
+      while (uring.reap(tag, result))
+      {
+        auto *done = reinterpret_cast<Buffer *>(tag);
+        write_fully(done, (result > 0) ? static_cast<size_t>(result) : 0); // short write
+        inFlight.erase(find(inFlight.begin(), inFlight.end(), done));
+        recycle(done);
+      }
+      writeNanoseconds += nanoseconds_since(begin);
+    }
+
+    // the ring failed: rewrite whatever it still held and carry on synchronously
+    ring = false;
+    for (Buffer *pending : inFlight)
+    {
+      write_fully(pending, 0);
+      recycle(pending);
+    }
+  }
+#endif
+
+  while (submitted.pop(buffer))
+  {
+    Tracer::Span write("write", "writer", 1);
+    auto begin = chrono::steady_clock::now();
+    write_fully(buffer, 0);
+    recycle(buffer);
+    writeNanoseconds += nanoseconds_since(begin);
+  }
+}
+
+ostream &operator<<(ostream &os, const AsyncWriter &writer)
+{
+  os << "Writer: " << writer.writes << " writes, " << writer.bytes / (1024 * 1024) << " MiB in "
+     << static_cast<double>(writer.writeNanoseconds) / 1e9 << " sec"
+     << (writer.ring ? " (io_uring)" : "") << ", queue high-water " << writer.maxQueued << "/"
+     << writer.buffers.size() << "\n";
+  os << "Writer back-pressure: " << writer.get_stalls() << " stalls, "
+     << writer.get_stall_seconds() << " sec waiting for buffers";
+  if (writer.freeBuffers.size() > 2)
+  {
+    os << ", " << writer.remoteBuffers << " buffers filled off their NUMA node";
+  }
+  os << "\n";
+  return os;
+}
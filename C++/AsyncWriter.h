@@ -0,0 +1,201 @@
+#ifndef C____ASYNCWRITER_H_
+#define C____ASYNCWRITER_H_
+
+#include "Tracer.h"
+#include "UnboundedQueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Output stage that takes disk writes off the render threads. A small pool of recycled, aligned
+ * buffers is filled by the compute side and handed to a dedicated writer thread, which issues
+ * one large positioned write per buffer (through io_uring where the kernel provides it).
+ * Written buffers go back to the free list of the NUMA node their pages were first touched on,
+ * so workers keep filling memory local to them. Compute threads only wait when every buffer is
+ * still queued for the disk; that wait is the writer's back-pressure and is reported with the
+ * other metrics
+ */
+class AsyncWriter
+{
+ public:
+
+  /**
+   * Buffer and write alignment
+   */
+  static const std::size_t alignment = 4096;
+
+  struct Buffer
+  {
+    unsigned char *data;
+
+    std::size_t capacity;
+
+    /**
+     * file offset to write at
+     */
+    std::uint64_t offset;
+
+    /**
+     * bytes to write
+     */
+    std::size_t size;
+
+    /**
+     * NUMA node of the worker that first filled the buffer, where its pages are
+     */
+    std::size_t node;
+  };
+
+  /**
+   * Default parametrized constructor
+   * @param fileName - full path of the output file
+   * @param bufferSize - bytes per buffer, rounded up to alignment
+   * @param bufferCount - buffers in the pool
+   * @param nodeCount - NUMA nodes of the workers filling the buffers; a worker gets a buffer
+   * whose pages are on its own node when there is one, see ThreadPool::current_node()
+   */
+  AsyncWriter(std::string fileName, std::size_t bufferSize, unsigned int bufferCount = 4,
+              std::size_t nodeCount = 1);
+
+  /**
+   * Closes the file if still open
+   */
+  ~AsyncWriter();
+
+  /**
+   * Create the file, preallocate it and start the writer thread
+   * @param fileSize - final size of the file
+   * @return TRUE if the file could be opened
+   */
+  bool open(std::uint64_t fileSize);
+
+  /**
+   * Get an empty buffer, blocks while all buffers are in flight
+   * @return buffer to fill
+   */
+  Buffer *acquire();
+
+  /**
+   * Hand a filled buffer to the writer thread; offset and size must be set
+   * @param buffer
+   */
+  void submit(Buffer *buffer);
+
+  /**
+   * Copy bytes into a buffer and submit them, for small pieces like the header
+   * @param data
+   * @param size - at most the buffer size
+   * @param offset
+   */
+  void write(const void *data, std::size_t size, std::uint64_t offset);
+
+  /**
+   * Wait for every submitted buffer to reach the file, then close it
+   */
+  void close();
+
+  std::size_t get_buffer_size() const;
+
+  /**
+   * @return number of acquire() calls that had to wait for the writer
+   */
+  std::uint64_t get_stalls() const;
+
+  /**
+   * @return total time compute threads spent waiting in acquire()
+   */
+  double get_stall_seconds() const;
+
+  friend std::ostream &operator<<(std::ostream &os, const AsyncWriter &writer);
+
+ private:
+
+  /**
+   * Writer thread body
+   */
+  void run();
+
+  /**
+   * Write the whole buffer with positioned writes, retrying short writes
+   * @param buffer
+   * @param done - bytes already written
+   */
+  void write_fully(const Buffer *buffer, std::size_t done);
+
+  /**
+   * Return a written buffer to the pool
+   * @param buffer
+   */
+  void recycle(Buffer *buffer);
+
+  /**
+   * Take a free buffer: one on the node, else one never filled, else one of another node;
+   * freeLock must be held
+   * @param node
+   * @return nullptr if every buffer is in flight
+   */
+  Buffer *take_free(std::size_t node);
+
+  std::string fileName;
+
+  std::size_t bufferSize;
+
+  std::vector<Buffer> buffers;
+
+  std::vector<std::unique_ptr<unsigned char, void (*)(void *)>> storage;
+
+  std::mutex freeLock;
+
+  std::condition_variable freeSignal;
+
+  /**
+   * free buffers per NUMA node, the buffers never filled in the last list
+   */
+  std::vector<std::vector<Buffer *>> freeBuffers;
+
+  /**
+   * buffers a worker got from another node's list
+   */
+  std::uint64_t remoteBuffers;
+
+  UnboundedQueue<Buffer *> submitted;
+
+  std::thread writer;
+
+  int fd;
+
+  std::ofstream stream;
+
+  bool isOpen;
+
+  /**
+   * used for io_uring when available
+   */
+  bool ring;
+
+  // metrics
+  std::atomic<std::uint64_t> stalls;
+
+  std::atomic<std::uint64_t> stallNanoseconds;
+
+  std::atomic<std::uint64_t> queued;
+
+  std::atomic<std::uint64_t> maxQueued;
+
+  std::uint64_t writes;
+
+  std::uint64_t bytes;
+
+  std::uint64_t writeNanoseconds;
+};
+
+#endif //C____ASYNCWRITER_H_
@@ -0,0 +1,68 @@
+#include "BLATable.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+BLATable::BLATable(const ReferenceOrbit &orbit, double dcMax, double stripeDensity,
+                   double epsilon) : steps(0), skipped(0), iterations(0)
+{
+  size_t size = orbit.size();
+
+  // same stripe function as Mandelbrot::get_t()
+  stripePrefix.resize(size, 0.0);
+  for (size_t n = 1; n < size; n++)
+  {
+    stripePrefix[n] = stripePrefix[n - 1] + 0.5 + 0.5 * sin(stripeDensity * arg(orbit[n]));
+  }
+
+  // single steps m -> m + 1 for m = 1 ... size - 2: delta -> 2 Z(m) delta + dc
+  if (size < 3)
+  {
+    return;
+  }
+  vector<Step> single(size - 2);
+  for (size_t m = 1; m + 1 < size; m++)
+  {
+    complex<double> A = 2.0 * orbit[m];
+    double radius = epsilon * abs(A);
+    single[m - 1] = Step{A, 1.0, radius * radius, 1};
+  }
+  levels.push_back(std::move(single));
+
+  // merge pairs: x then y
+  while (levels.back().size() >= 2)
+  {
+    const vector<Step> &fine = levels.back();
+    vector<Step> coarse(fine.size() / 2);
+    for (size_t j = 0; j < coarse.size(); j++)
+    {
+      const Step &x = fine[2 * j];
+      const Step &y = fine[2 * j + 1];
+      double radiusX = sqrt(x.radius2);
+      double radiusY = max(0.0, (sqrt(y.radius2) - abs(x.B) * dcMax) / abs(x.A));
+      double radius = min(radiusX, radiusY);
+      coarse[j] = Step{y.A * x.A, y.A * x.B + y.B, radius * radius, 2 * x.length};
+    }
+    levels.push_back(std::move(coarse));
+  }
+}
+
+void BLATable::record(uint64_t stepsIn, uint64_t skippedIn, uint64_t iterationsIn) const
+{
+  steps.fetch_add(stepsIn, memory_order_relaxed);
+  skipped.fetch_add(skippedIn, memory_order_relaxed);
+  iterations.fetch_add(iterationsIn, memory_order_relaxed);
+}
+
+ostream &operator<<(ostream &os, const BLATable &table)
+{
+  uint64_t steps = table.steps.load(memory_order_relaxed);
+  uint64_t skipped = table.skipped.load(memory_order_relaxed);
+  uint64_t iterations = table.iterations.load(memory_order_relaxed);
+  os << "BLA: " << table.levels.size() << " levels, " << steps << " steps averaging "
+     << ((steps > 0) ? static_cast<double>(skipped) / steps : 0.0) << " iterations, "
+     << ((iterations > 0) ? 100.0 * skipped / iterations : 0.0) << "% of iterations skipped\n";
+  return os;
+}
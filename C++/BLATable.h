@@ -0,0 +1,122 @@
+#ifndef C____BLATABLE_H_
+#define C____BLATABLE_H_
+
+#include "ReferenceOrbit.h"
+
+#include <atomic>
+#include <complex>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+/**
+ * Bilinear approximations along a reference orbit, for skipping iterations of deep pixels.
+ * While the offset delta from the reference is small enough that its square vanishes next to
+ * 2 * Z(m) * delta, l iterations collapse into delta -> A * delta + B * dc. Level k holds steps
+ * of 2^k iterations starting at orbit indices 1 + j * 2^k, each merged from two steps of level
+ * k - 1, with the radius of delta within which the approximation holds for every dc of the view
+ */
+class BLATable
+{
+ public:
+
+  /**
+   * One bilinear step of length iterations
+   */
+  struct Step
+  {
+    std::complex<double> A;
+
+    std::complex<double> B;
+
+    /**
+     * squared validity radius of delta
+     */
+    double radius2;
+
+    int length;
+  };
+
+  /**
+   * Default parametrized constructor
+   * @param orbit - reference orbit; must outlive the table
+   * @param dcMax - largest offset of any pixel of the view from the orbit center
+   * @param stripeDensity - stripe density of the render, for the stripe terms of skipped steps
+   * @param epsilon - relative size of the dropped delta^2 term, bounds the error per step
+   */
+  BLATable(const ReferenceOrbit &orbit, double dcMax, double stripeDensity,
+           double epsilon = 1.0 / 16777216.0);
+
+  /**
+   * Longest step that may be taken from orbit index m
+   * @param m - current orbit index
+   * @param deltaNorm - norm (squared magnitude) of the current delta
+   * @return step, nullptr if none is valid
+   */
+  const Step *lookup(std::size_t m, double deltaNorm) const
+  {
+    if (m == 0 || levels.size() < 2)
+    {
+      return nullptr;
+    }
+    std::size_t offset = m - 1;
+    // a merged step is never valid further out than its first single step; single steps
+    // themselves save nothing over an iteration
+    if (offset >= levels[0].size() || deltaNorm >= levels[0][offset].radius2)
+    {
+      return nullptr;
+    }
+    std::size_t k = levels.size() - 1;
+    while (k > 0 && (offset & ((std::size_t{1} << k) - 1)) != 0)
+    {
+      k--;
+    }
+    for (; k > 0; k--)
+    {
+      std::size_t j = offset >> k;
+      if (j < levels[k].size() && deltaNorm < levels[k][j].radius2)
+      {
+        return &levels[k][j];
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Stripe terms of the reference orbit; close enough to those of a pixel while a step is valid
+   * @param from
+   * @param to
+   * @return sum of t(Z(n)) for from < n <= to
+   */
+  double stripe_sum(std::size_t from, std::size_t to) const
+  {
+    return stripePrefix[to] - stripePrefix[from];
+  }
+
+  /**
+   * Add a renderer's counts to the table's totals, thread safe
+   * @param steps - bilinear steps taken
+   * @param skipped - iterations covered by those steps
+   * @param iterations - all iterations of the pixels
+   */
+  void record(std::uint64_t steps, std::uint64_t skipped, std::uint64_t iterations) const;
+
+  friend std::ostream &operator<<(std::ostream &os, const BLATable &table);
+
+ private:
+
+  std::vector<std::vector<Step>> levels;
+
+  /**
+   * stripePrefix[n] = t(Z(1)) + ... + t(Z(n))
+   */
+  std::vector<double> stripePrefix;
+
+  mutable std::atomic<std::uint64_t> steps;
+
+  mutable std::atomic<std::uint64_t> skipped;
+
+  mutable std::atomic<std::uint64_t> iterations;
+};
+
+#endif //C____BLATABLE_H_
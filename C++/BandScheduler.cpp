@@ -0,0 +1,366 @@
+#include "BandScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * @return peak resident set of the process in bytes, 0 where it is unknown
+ */
+size_t peak_resident_bytes()
+{
+#ifdef __linux__
+  ifstream status("/proc/self/status");
+  string key;
+  while (status >> key)
+  {
+    if (key == "VmHWM:")
+    {
+      size_t kiB = 0;
+      status >> kiB;
+      return kiB * 1024;
+    }
+    status.ignore(256, '\n');
+  }
+#endif
+  return 0;
+}
+
+double mebibytes(double bytes)
+{
+  return bytes / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+BandScheduler::BandScheduler(const FrameRenderer &renderer, size_t memoryBudget) :
+renderer(renderer), memoryBudget(memoryBudget), liveBytes(0), peakBytes(0)
+{
+  width = renderer.get_width();
+  height = renderer.get_height();
+  targetBandSeconds = 0.05;
+  keepIterations = false;
+  inFlight = 1;
+  maxBandRows = 1;
+  rowGranule = 1;
+  writerBytes = 0;
+  secondsPerRow = 0.0;
+  minRows = 0;
+  maxRows = 0;
+  bands = 0;
+  firstPassSeconds = 0.0;
+  secondPassSeconds = 0.0;
+  freeSlots = 0;
+}
+
+void BandScheduler::set_target_band_seconds(double secondsIn)
+{
+  targetBandSeconds = secondsIn;
+}
+
+void BandScheduler::add_band_sink(BandSink sinkIn, bool withIterations)
+{
+  sinks.push_back(std::move(sinkIn));
+  keepIterations = keepIterations || withIterations;
+}
+
+void BandScheduler::plan(size_t threads, size_t budget)
+{
+  // a band may need a second set of buffers for the rows reflected from it
+  size_t rowBytes = static_cast<size_t>(width) * 3;
+  size_t fieldRowBytes = keepIterations ? static_cast<size_t>(width) * sizeof(int) : 0;
+  size_t perRow = 2 * (rowBytes + fieldRowBytes);
+
+  // two bands per worker keep every worker busy while finished bands wait for the writer;
+  // give up slack before giving up parallelism, and parallelism before going over budget
+  inFlight = 2 * threads;
+  // each writer buffer is rounded up to the write alignment
+  auto rowsFor = [&](size_t slots)
+  {
+    size_t rounding = 2 * slots * AsyncWriter::alignment;
+    return (budget > rounding) ? (budget - rounding) / (slots * perRow) : 0;
+  };
+  while (rowsFor(inFlight) < 1 && inFlight > 1)
+  {
+    inFlight--;
+  }
+  maxBandRows = static_cast<int>(min<size_t>(max<size_t>(rowsFor(inFlight), 1), height));
+
+  // bands of whole granules start and end their writes on the write alignment, the header being
+  // padded to it; given up when a granule would not fit a band or leave every worker two bands
+  size_t granule = AsyncWriter::alignment / gcd(rowBytes, AsyncWriter::alignment);
+  rowGranule = (granule <= static_cast<size_t>(maxBandRows) && 2 * threads * granule <= static_cast<size_t>(height))
+               ? static_cast<int>(granule) : 1;
+  maxBandRows = maxBandRows / rowGranule * rowGranule;
+  writerBytes = 2 * inFlight * ((maxBandRows * rowBytes + AsyncWriter::alignment - 1)
+      / AsyncWriter::alignment * AsyncWriter::alignment);
+}
+
+int BandScheduler::next_band_rows(int remaining, size_t threads)
+{
+  int rows;
+  {
+    scoped_lock guard(costLock);
+    rows = (secondsPerRow > 0.0) ? static_cast<int>(lround(targetBandSeconds / secondsPerRow))
+                                 : renderer.get_band_height();
+  }
+  // split the tail so the last bands finish together
+  rows = min(rows, max(1, remaining / static_cast<int>(threads)));
+  rows = max(1, min(rows, maxBandRows));
+  rows = max(rowGranule, rows / rowGranule * rowGranule);
+  return min(rows, remaining);
+}
+
+void BandScheduler::track(int64_t bytes)
+{
+  int64_t live = liveBytes += bytes;
+  int64_t peak = peakBytes.load(memory_order_relaxed);
+  while (live > peak && !peakBytes.compare_exchange_weak(peak, live, memory_order_relaxed))
+  {}
+}
+
+void BandScheduler::render_band(AsyncWriter &writer, int rowBegin, int rowEnd, size_t headerSize)
+{
+  FrameRenderer::BandRows rows = renderer.band_rows(rowBegin, rowEnd);
+  if (rows.first < 0)
+  {
+    return; // written along with the mirror rows
+  }
+  int count = rows.last - rows.first + 1;
+  int mirrorCount = (rows.mirrorLast >= 0) ? rows.mirrorLast - rows.mirrorFirst + 1 : 0;
+  size_t rowBytes = static_cast<size_t>(width) * 3;
+
+  // field tiles, only kept when someone consumes them
+  vector<int> iterations;
+  vector<int> mirrorIterations;
+  int64_t fieldBytes = 0;
+  if (keepIterations)
+  {
+    iterations.resize(static_cast<size_t>(count) * width);
+    mirrorIterations.resize(static_cast<size_t>(mirrorCount) * width);
+    fieldBytes = static_cast<int64_t>((iterations.size() + mirrorIterations.size()) * sizeof(int));
+    track(fieldBytes);
+  }
+
+  AsyncWriter::Buffer *band = writer.acquire();
+  AsyncWriter::Buffer *mirrorBand = (mirrorCount > 0) ? writer.acquire() : nullptr;
+
+  auto begin = chrono::steady_clock::now();
+  bool equalized = renderer.get_equalizer() != nullptr;
+  renderer.render_band(rows, band->data, keepIterations ? iterations.data() : nullptr,
+                       (mirrorBand != nullptr) ? mirrorBand->data : nullptr,
+                       keepIterations ? mirrorIterations.data() : nullptr);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  {
+    scoped_lock guard(costLock);
+    double cost = seconds / count;
+    secondsPerRow = (secondsPerRow > 0.0) ? 0.5 * (secondsPerRow + cost) : cost;
+    minRows = (minRows == 0) ? count : min(minRows, count);
+    maxRows = max(maxRows, count);
+    bands++;
+  }
+
+  // with an equalizer the sinks get the second pass instead
+  for (size_t sink = 0; sink < sinks.size() && !equalized; sink++)
+  {
+    sinks[sink](rows.first, count, band->data, keepIterations ? iterations.data() : nullptr);
+    if (mirrorBand != nullptr)
+    {
+      sinks[sink](rows.mirrorFirst, mirrorCount, mirrorBand->data,
+                  keepIterations ? mirrorIterations.data() : nullptr);
+    }
+  }
+  track(-fieldBytes);
+
+  band->offset = headerSize + rows.first * rowBytes;
+  band->size = count * rowBytes;
+  writer.submit(band);
+  if (mirrorBand != nullptr)
+  {
+    mirrorBand->offset = headerSize + rows.mirrorFirst * rowBytes;
+    mirrorBand->size = mirrorCount * rowBytes;
+    writer.submit(mirrorBand);
+  }
+}
+
+void BandScheduler::color_band(AsyncWriter &writer, int rowBegin, int rowEnd, size_t headerSize)
+{
+  int count = rowEnd - rowBegin;
+  size_t rowBytes = static_cast<size_t>(width) * 3;
+  AsyncWriter::Buffer *band = writer.acquire();
+  {
+    PerfCounters::Scope stage(renderer.get_perf_counters(), PerfCounters::Stage::Color,
+                              static_cast<uint64_t>(count) * width);
+    Tracer::Span span("color band", "render", rowBegin);
+    renderer.get_equalizer()->color_rows(rowBegin, count, band->data);
+  }
+  for (auto &sink : sinks)
+  {
+    sink(rowBegin, count, band->data, nullptr);
+  }
+  band->offset = headerSize + rowBegin * rowBytes;
+  band->size = count * rowBytes;
+  writer.submit(band);
+}
+
+void BandScheduler::dispatch(ThreadPool &pool, ThreadPool::process work)
+{
+  {
+    Tracer::Span wait("in-flight wait", "scheduler");
+    unique_lock guard(slotLock);
+    slotFree.wait(guard, [&]() {return freeSlots > 0;});
+    freeSlots--;
+  }
+  pool.enqueue_work([this, work = std::move(work)]() mutable
+                    {
+                      try
+                      {
+                        work();
+                      } catch (...)
+                      {
+                        scoped_lock guard(slotLock);
+                        error = error ? error : current_exception();
+                      }
+                      {
+                        scoped_lock guard(slotLock);
+                        freeSlots++;
+                      }
+                      slotFree.notify_one();
+                    });
+}
+
+void BandScheduler::drain()
+{
+  unique_lock guard(slotLock);
+  slotFree.wait(guard, [&]() {return freeSlots == inFlight;});
+}
+
+bool BandScheduler::run(ThreadPool &pool, const PPM &pgm)
+{
+  // samples held in memory come out of the budget before the bands are sized
+  EqualizedColoring *equalizer = renderer.get_equalizer();
+  size_t bandBudget = memoryBudget;
+  if (equalizer != nullptr)
+  {
+    if (equalizer->field_bytes() > memoryBudget / 2
+        && !equalizer->spill(pgm.get_file_name() + ".samples"))
+    {
+      return false;
+    }
+    if (!equalizer->spilled())
+    {
+      bandBudget -= equalizer->field_bytes();
+    }
+  }
+  size_t threads = pool.get_thread_count();
+  plan(threads, bandBudget);
+
+  string header = pgm.header_string(AsyncWriter::alignment);
+  size_t rowBytes = static_cast<size_t>(width) * 3;
+  AsyncWriter writer(pgm.get_file_name(), maxBandRows * rowBytes,
+                     static_cast<unsigned int>(2 * inFlight), pool.get_topology().node_count());
+  if (!writer.open(header.size() + rowBytes * height))
+  {
+    return false;
+  }
+  writer.write(header.data(), header.size(), 0);
+
+  if (equalizer != nullptr)
+  {
+    equalizer->begin();
+    if (!equalizer->spilled())
+    {
+      track(static_cast<int64_t>(equalizer->field_bytes()));
+    }
+  }
+
+  freeSlots = inFlight;
+  error = nullptr;
+  auto begin = chrono::steady_clock::now();
+  for (int rowBegin = 0; rowBegin < height;)
+  {
+    int rowEnd = rowBegin + next_band_rows(height - rowBegin, threads);
+    dispatch(pool, [this, &writer, rowBegin, rowEnd, &header]()
+                   {
+                     render_band(writer, rowBegin, rowEnd, header.size());
+                   });
+    rowBegin = rowEnd;
+  }
+  drain();
+  auto end = chrono::steady_clock::now();
+  firstPassSeconds = chrono::duration<double>(end - begin).count();
+
+  // the second pass overwrites every band; rows cost the same, so bands are as tall as allowed
+  if (equalizer != nullptr && !error)
+  {
+    equalizer->finalize();
+    for (int rowBegin = 0; rowBegin < height; rowBegin += maxBandRows)
+    {
+      int rowEnd = min(height, rowBegin + maxBandRows);
+      dispatch(pool, [this, &writer, rowBegin, rowEnd, &header]()
+                     {
+                       color_band(writer, rowBegin, rowEnd, header.size());
+                     });
+    }
+    drain();
+    secondPassSeconds = chrono::duration<double>(chrono::steady_clock::now() - end).count();
+    if (!equalizer->spilled())
+    {
+      track(-static_cast<int64_t>(equalizer->field_bytes()));
+    }
+  }
+  writer.close();
+  cout << writer;
+
+  if (error)
+  {
+    rethrow_exception(error);
+  }
+  return true;
+}
+
+size_t BandScheduler::get_peak_bytes() const
+{
+  return writerBytes + static_cast<size_t>(peakBytes.load());
+}
+
+ostream &operator<<(ostream &os, const BandScheduler &scheduler)
+{
+  double peak = static_cast<double>(scheduler.get_peak_bytes());
+  os << "Bands: " << scheduler.bands << " of " << scheduler.minRows << "-" << scheduler.maxRows
+     << " rows (limit " << scheduler.maxBandRows << "), " << scheduler.inFlight << " in flight";
+  if (scheduler.rowGranule > 1)
+  {
+    os << ", aligned to " << scheduler.rowGranule << "-row granules";
+  }
+  os << "\n";
+  os << "Memory: peak " << mebibytes(peak) << " MiB of " << mebibytes(scheduler.memoryBudget)
+     << " MiB budget (writer buffers " << mebibytes(scheduler.writerBytes) << " MiB, fields "
+     << mebibytes(scheduler.peakBytes) << " MiB)";
+  if (peak > static_cast<double>(scheduler.memoryBudget))
+  {
+    os << " - budget too small for one row per band";
+  }
+  os << "\n";
+  if (scheduler.renderer.get_equalizer() != nullptr)
+  {
+    os << "Passes: iteration " << scheduler.firstPassSeconds << " sec, equalized coloring "
+       << scheduler.secondPassSeconds << " sec ("
+       << 100.0 * scheduler.secondPassSeconds / max(scheduler.firstPassSeconds, 1e-9) << "%)\n";
+  }
+  size_t resident = peak_resident_bytes();
+  if (resident > 0)
+  {
+    os << "Peak resident set: " << mebibytes(resident) << " MiB\n";
+  }
+  return os;
+}
@@ -0,0 +1,190 @@
+#ifndef C____BANDSCHEDULER_H_
+#define C____BANDSCHEDULER_H_
+
+#include "AsyncWriter.h"
+#include "FrameRenderer.h"
+#include "PPM.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+/**
+ * Streams an image of any size to disk through the pool within a memory budget. The budget
+ * decides how many bands may be in flight and how tall a band may get (writer buffers plus the
+ * per-band iteration field); within that limit band height follows the measured cost per row,
+ * so cheap regions go out in big bands and expensive ones in small, well balanced bands.
+ * A renderer with an equalizer takes a second pass over the file: the first writes linearly
+ * colored bands, the second recolors them from the samples, which are spilled next to the image
+ * when they would take more than half the budget
+ */
+class BandScheduler
+{
+ public:
+
+  /**
+   * Receives every finished band (and every reflected band) on the worker thread that rendered
+   * it, before its buffers are recycled; bands arrive in any order. With an equalizer, sinks get
+   * the bands of the second pass, without iterations
+   * firstRow - image row of the first band row
+   * rows - number of rows
+   * rgb - pixel data
+   * iterations - iteration counts
+   */
+  using BandSink = std::function<void(int firstRow, int rows, const unsigned char *rgb,
+                                      const int *iterations)>;
+
+  /**
+   * Default parametrized constructor
+   * @param renderer - image size and render parameters
+   * @param memoryBudget - bytes the render may hold at once
+   */
+  BandScheduler(const FrameRenderer &renderer, std::size_t memoryBudget);
+
+  /**
+   * @param secondsIn - compute time a band should take once the cost per row is known
+   */
+  void set_target_band_seconds(double secondsIn);
+
+  /**
+   * Hand each band's pixels to a sink as it leaves the pipeline
+   * @param sinkIn
+   * @param withIterations - also keep the band's iteration field for the sink; iterations is
+   * nullptr otherwise
+   */
+  void add_band_sink(BandSink sinkIn, bool withIterations);
+
+  /**
+   * Render the image and write it to the PPM's file
+   * @param pool
+   * @param pgm - file name and header
+   * @return FALSE if the file could not be opened
+   */
+  bool run(ThreadPool &pool, const PPM &pgm);
+
+  /**
+   * @return most memory held at once by the last run(): writer buffers, field tiles and the
+   * equalizer's samples when they are kept in memory
+   */
+  std::size_t get_peak_bytes() const;
+
+  friend std::ostream &operator<<(std::ostream &os, const BandScheduler &scheduler);
+
+ private:
+
+  /**
+   * Size in-flight band count and maximum band height to the budget
+   * @param threads
+   * @param budget - bytes left for the bands, the budget less the samples held in memory
+   */
+  void plan(std::size_t threads, std::size_t budget);
+
+  /**
+   * @param remaining - rows not dispatched yet
+   * @param threads
+   * @return height of the next band
+   */
+  int next_band_rows(int remaining, std::size_t threads);
+
+  /**
+   * Render one band into writer buffers and submit them
+   * @param writer
+   * @param rowBegin
+   * @param rowEnd
+   * @param headerSize - offset of the pixel data
+   */
+  void render_band(AsyncWriter &writer, int rowBegin, int rowEnd, std::size_t headerSize);
+
+  /**
+   * Color one band from the equalizer's samples into writer buffers and submit them
+   * @param writer
+   * @param rowBegin
+   * @param rowEnd
+   * @param headerSize - offset of the pixel data
+   */
+  void color_band(AsyncWriter &writer, int rowBegin, int rowEnd, std::size_t headerSize);
+
+  /**
+   * Run work on the pool once an in-flight slot is free; the first exception is kept for run()
+   * @param pool
+   * @param work
+   */
+  void dispatch(ThreadPool &pool, ThreadPool::process work);
+
+  /**
+   * Wait until every dispatched band is done
+   */
+  void drain();
+
+  /**
+   * Count field tile memory coming (positive) or going (negative)
+   * @param bytes
+   */
+  void track(std::int64_t bytes);
+
+  const FrameRenderer &renderer;
+
+  int width;
+
+  int height;
+
+  std::size_t memoryBudget;
+
+  double targetBandSeconds;
+
+  std::vector<BandSink> sinks;
+
+  /**
+   * iteration field tiles are needed by a sink
+   */
+  bool keepIterations;
+
+  // plan
+  std::size_t inFlight;
+
+  int maxBandRows;
+
+  /**
+   * band heights are multiples of it, so that band writes are aligned; 1 if they are not
+   */
+  int rowGranule;
+
+  std::size_t writerBytes;
+
+  // adaptation
+  std::mutex costLock;
+
+  double secondsPerRow;
+
+  int minRows;
+
+  int maxRows;
+
+  std::size_t bands;
+
+  double firstPassSeconds;
+
+  double secondPassSeconds;
+
+  // in-flight slots
+  std::mutex slotLock;
+
+  std::condition_variable slotFree;
+
+  std::size_t freeSlots;
+
+  std::exception_ptr error;
+
+  // memory
+  std::atomic<std::int64_t> liveBytes;
+
+  std::atomic<std::int64_t> peakBytes;
+};
+
+#endif //C____BANDSCHEDULER_H_
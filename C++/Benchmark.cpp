@@ -0,0 +1,613 @@
+#include "ExecutionBackend.h"
+#include "PerfCounters.h"
+#include "View.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+using namespace std;
+
+/**
+ * End-to-end benchmark matrix across the C and C++ renderers: runs every implementation as a
+ * separate process for each view, image size, iteration limit and thread count, measures the wall
+ * time of the whole run including the file write, and writes one CSV row per run. With a
+ * baseline CSV from an earlier run, a run slower than the baseline by more than the threshold is
+ * marked as regressed and the driver exits with 1. With --perf, the hardware counters of each
+ * run's process tree add IPC and per-pixel ratios to the row, see PerfCounters.
+ * Usage: Benchmark [options] out.csv, see usage() for the options. The C renderers should be
+ * built in Release, the numbers of a debug build say nothing
+ */
+
+namespace
+{
+
+/**
+ * Region rendered by every implementation
+ */
+struct BenchmarkView
+{
+  string name;
+
+  complex<double> center;
+
+  /**
+   * width of the view along the real axis, the height follows the image
+   */
+  double span;
+};
+
+/**
+ * One cell of the matrix
+ */
+struct Run
+{
+  BenchmarkView view;
+
+  int size;
+
+  int iterMax;
+
+  int threads;
+};
+
+/**
+ * Renderer under test, run as a separate process
+ */
+struct Implementation
+{
+  string name;
+
+  /**
+   * takes a thread count; single-threaded implementations run once per view, size and limit
+   */
+  bool threaded;
+
+  /**
+   * command line for a run, writing the image to the given file
+   */
+  function<string(const Run &run, const string &image)> command;
+
+  /**
+   * file the image ends up in, removed after the run
+   */
+  function<string(const string &image)> output;
+};
+
+/**
+ * Settings from the command line
+ */
+struct Options
+{
+  vector<int> sizes{1024, 2048, 4096, 8192, 16384};
+
+  vector<int> iterMaxes{1000};
+
+  vector<string> views{"full", "seahorse", "elephant"};
+
+  vector<int> threads;
+
+  vector<string> implementations{"c-original", "c-parallel", "cpp-serial", "cpp-parallel"};
+
+  string cDirectory = "../../C/cmake-build-release";
+
+  string cpp = "./C__";
+
+  int repeat = 1;
+
+  string baseline;
+
+  /**
+   * allowed slowdown against the baseline, as a fraction of the baseline time
+   */
+  double threshold = 0.1;
+
+  /**
+   * read the hardware counters of every run
+   */
+  bool perf = false;
+
+  string csv;
+};
+
+/**
+ * Measured run, one CSV row
+ */
+struct Result
+{
+  string implementation;
+
+  Run run;
+
+  double seconds = 0.0;
+
+  unsigned long long iterations = 0;
+
+  double efficiency = 1.0;
+
+  /**
+   * hardware counters, when counted
+   */
+  optional<PerfCounters::Values> counts;
+
+  array<bool, PerfCounters::events> counted{};
+
+  string status;
+};
+
+const vector<BenchmarkView> &known_views()
+{
+  static const vector<BenchmarkView> views{
+      {"full", {-0.7, 0.0}, 3.0},
+      {"seahorse", {-0.7453, 0.1127}, 0.01},
+      {"elephant", {0.2925, 0.0149}, 0.01},
+  };
+  return views;
+}
+
+void usage(const char *program)
+{
+  cout << "Usage: " << program << " [--sizes n,...] [--iters n,...] [--views name,...] "
+                                  "[--threads n,...] [--implementations name,...] [--c-dir dir] "
+                                  "[--cpp path] [--repeat n] [--baseline old.csv] "
+                                  "[--threshold fraction] [--perf] out.csv\n"
+       << "views: full, seahorse, elephant\n"
+       << "implementations: c-original, c-parallel, cpp-serial, cpp-parallel, backend-serial, "
+          "backend-omp-static, backend-omp-dynamic, backend-omp-guided, backend-pool, "
+          "backend-std-par\n";
+}
+
+vector<string> split(const string &list, char separator)
+{
+  vector<string> items;
+  stringstream stream(list);
+  string item;
+  while (getline(stream, item, separator))
+  {
+    items.push_back(item);
+  }
+  return items;
+}
+
+vector<int> split_numbers(const string &list)
+{
+  vector<int> numbers;
+  for (const string &item : split(list, ','))
+  {
+    numbers.push_back(stoi(item));
+  }
+  return numbers;
+}
+
+/**
+ * 1, 2, 4, ... up to and including the hardware thread count
+ */
+vector<int> default_threads()
+{
+  int hardware = max(1, static_cast<int>(thread::hardware_concurrency()));
+  vector<int> threads;
+  for (int count = 1; count < hardware; count *= 2)
+  {
+    threads.push_back(count);
+  }
+  threads.push_back(hardware);
+  return threads;
+}
+
+bool parse(int argc, char *argv[], Options &options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    string argument = argv[i];
+    if (argument.rfind("--", 0) != 0)
+    {
+      options.csv = argument;
+      continue;
+    }
+    if (argument == "--perf")
+    {
+      options.perf = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+    {
+      return false;
+    }
+    string value = argv[++i];
+    if (argument == "--sizes")
+    {
+      options.sizes = split_numbers(value);
+    } else if (argument == "--iters")
+    {
+      options.iterMaxes = split_numbers(value);
+    } else if (argument == "--views")
+    {
+      options.views = split(value, ',');
+    } else if (argument == "--threads")
+    {
+      options.threads = split_numbers(value);
+    } else if (argument == "--implementations")
+    {
+      options.implementations = split(value, ',');
+    } else if (argument == "--c-dir")
+    {
+      options.cDirectory = value;
+    } else if (argument == "--cpp")
+    {
+      options.cpp = value;
+    } else if (argument == "--repeat")
+    {
+      options.repeat = max(1, stoi(value));
+    } else if (argument == "--baseline")
+    {
+      options.baseline = value;
+    } else if (argument == "--threshold")
+    {
+      options.threshold = stod(value);
+    } else
+    {
+      return false;
+    }
+  }
+  if (options.threads.empty())
+  {
+    options.threads = default_threads();
+  }
+  return !options.csv.empty();
+}
+
+string plane_arguments(const Run &run)
+{
+  View view = View::from_center(run.view.center, run.view.span, run.size, run.size);
+  ostringstream arguments;
+  arguments.precision(17);
+  arguments << view.cx_min() << " " << view.cx_max() << " " << view.cy_min() << " "
+            << view.cy_max();
+  return arguments.str();
+}
+
+string view_arguments(const Run &run)
+{
+  ostringstream arguments;
+  arguments.precision(17);
+  arguments << real(run.view.center) << " " << imag(run.view.center) << " " << run.view.span;
+  return arguments.str();
+}
+
+vector<Implementation> known_implementations(const Options &options)
+{
+  // the C renderers take the plane bounds and write to the path given, the C++ ones take the
+  // view center and write below PPM's output directory
+  auto cOutput = [](const string &image) { return image; };
+  auto cppOutput = [](const string &image) { return "..\\..\\output\\" + image; };
+  string cDirectory = options.cDirectory;
+  string cpp = options.cpp;
+  vector<Implementation> implementations{
+      {"c-original", false,
+       [cDirectory](const Run &run, const string &image)
+       {
+         return cDirectory + "/originalStriped " + to_string(run.size) + " " +
+                to_string(run.size) + " " + to_string(run.iterMax) + " " + plane_arguments(run) +
+                " " + image;
+       }, cOutput},
+      {"c-parallel", true,
+       [cDirectory](const Run &run, const string &image)
+       {
+         return cDirectory + "/parallelStriped " + to_string(run.size) + " " +
+                to_string(run.size) + " " + to_string(run.iterMax) + " " + plane_arguments(run) +
+                " " + image;
+       }, cOutput},
+      {"cpp-serial", false,
+       [cpp](const Run &run, const string &image)
+       {
+         return cpp + " serial " + to_string(run.size) + " " + to_string(run.size) + " " + image +
+                " " + view_arguments(run) + " " + to_string(run.iterMax);
+       }, cppOutput},
+      {"cpp-parallel", true,
+       [cpp](const Run &run, const string &image)
+       {
+         return cpp + " parallel --threads " + to_string(run.threads) + " " +
+                to_string(run.size) + " " + to_string(run.size) + " " + image + " 512 " +
+                view_arguments(run) + " " + to_string(run.iterMax);
+       }, cppOutput},
+  };
+
+  // the same renderer on every execution backend, see ExecutionBackend
+  for (ExecutionBackend::Kind kind : {ExecutionBackend::Kind::Serial,
+                                      ExecutionBackend::Kind::OpenMPStatic,
+                                      ExecutionBackend::Kind::OpenMPDynamic,
+                                      ExecutionBackend::Kind::OpenMPGuided,
+                                      ExecutionBackend::Kind::Pool,
+                                      ExecutionBackend::Kind::ParallelAlgorithms})
+  {
+    string backend = ExecutionBackend::name(kind);
+    implementations.push_back(
+        {"backend-" + backend, kind != ExecutionBackend::Kind::Serial,
+         [cpp, backend](const Run &run, const string &image)
+         {
+           return cpp + " backend --threads " + to_string(run.threads) + " " + backend + " " +
+                  to_string(run.size) + " " + to_string(run.size) + " " + image + " " +
+                  view_arguments(run) + " " + to_string(run.iterMax);
+         }, cppOutput});
+  }
+  return implementations;
+}
+
+/**
+ * OpenMP thread count of the child processes
+ */
+void set_omp_threads(int threads)
+{
+#ifdef _WIN32
+  _putenv_s("OMP_NUM_THREADS", to_string(threads).c_str());
+#else
+  setenv("OMP_NUM_THREADS", to_string(threads).c_str(), 1);
+#endif
+}
+
+/**
+ * Run a command to completion, timing it and picking the iteration count from its output
+ * @param command
+ * @param seconds - wall time
+ * @param iterations - from the "Iterations: n" line, 0 if there is none
+ * @return FALSE if the command could not be started or failed
+ */
+bool run_command(const string &command, double &seconds, unsigned long long &iterations)
+{
+  auto begin = chrono::steady_clock::now();
+  FILE *pipe = popen((command + " 2>&1").c_str(), "r");
+  if (pipe == nullptr)
+  {
+    return false;
+  }
+  char line[512];
+  const string prefix = "Iterations: ";
+  while (fgets(line, sizeof(line), pipe) != nullptr)
+  {
+    string text(line);
+    if (text.rfind(prefix, 0) == 0)
+    {
+      iterations = stoull(text.substr(prefix.size()));
+    }
+  }
+  int status = pclose(pipe);
+  auto end = chrono::steady_clock::now();
+  seconds = chrono::duration<double>(end - begin).count();
+  return status == 0;
+}
+
+string result_key(const string &implementation, const string &view, int width, int height,
+                  int iterMax, int threads)
+{
+  return implementation + "," + view + "," + to_string(width) + "," + to_string(height) + "," +
+         to_string(iterMax) + "," + to_string(threads);
+}
+
+/**
+ * Seconds per run of an earlier CSV, keyed by result_key()
+ */
+map<string, double> read_baseline(const string &path)
+{
+  map<string, double> seconds;
+  ifstream file(path);
+  string line;
+  getline(file, line); // header
+  while (getline(file, line))
+  {
+    vector<string> fields = split(line, ',');
+    if (fields.size() < 7 || fields.back() == "failed")
+    {
+      continue;
+    }
+    seconds[result_key(fields[0], fields[1], stoi(fields[2]), stoi(fields[3]), stoi(fields[4]),
+                       stoi(fields[5]))] = stod(fields[6]);
+  }
+  return seconds;
+}
+
+ostream &operator<<(ostream &out, const Result &result)
+{
+  double pixels = static_cast<double>(result.run.size) * result.run.size;
+  out << result.implementation << "," << result.run.view.name << "," << result.run.size << ","
+      << result.run.size << "," << result.run.iterMax << "," << result.run.threads << ","
+      << result.seconds << "," << pixels / result.seconds << ","
+      << static_cast<double>(result.iterations) / result.seconds << ",";
+  if (result.efficiency >= 0.0)
+  {
+    out << result.efficiency;
+  }
+  double ratios[PerfCounters::events + 1] = {};
+  if (result.counts)
+  {
+    const PerfCounters::Values &counts = *result.counts;
+    ratios[0] = (counts[PerfCounters::Cycles] == 0) ? 0.0
+                : static_cast<double>(counts[PerfCounters::Instructions])
+                  / counts[PerfCounters::Cycles];
+    for (size_t event = 0; event < PerfCounters::events; event++)
+    {
+      ratios[event + 1] = static_cast<double>(counts[event]) / pixels;
+    }
+  }
+  for (size_t ratio = 0; ratio <= PerfCounters::events; ratio++)
+  {
+    out << ",";
+    if (result.counts && (ratio == 0 || result.counted[ratio - 1]))
+    {
+      out << ratios[ratio];
+    }
+  }
+  out << "," << result.status;
+  return out;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  Options options;
+  if (!parse(argc, argv, options))
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  vector<BenchmarkView> views;
+  for (const string &name : options.views)
+  {
+    auto known = find_if(known_views().begin(), known_views().end(),
+                         [&name](const BenchmarkView &view) { return view.name == name; });
+    if (known == known_views().end())
+    {
+      cout << "Unknown view " << name << "\n";
+      return 1;
+    }
+    views.push_back(*known);
+  }
+  vector<Implementation> implementations;
+  for (const string &name : options.implementations)
+  {
+    vector<Implementation> known = known_implementations(options);
+    auto implementation = find_if(known.begin(), known.end(),
+                                  [&name](const Implementation &candidate)
+                                  { return candidate.name == name; });
+    if (implementation == known.end())
+    {
+      cout << "Unknown implementation " << name << "\n";
+      return 1;
+    }
+    implementations.push_back(*implementation);
+  }
+  map<string, double> baseline;
+  if (!options.baseline.empty())
+  {
+    baseline = read_baseline(options.baseline);
+  }
+
+  ofstream csv(options.csv);
+  if (!csv)
+  {
+    cout << "Could not open ofstream for " << options.csv << "\n";
+    return 1;
+  }
+  const string header = "implementation,view,width,height,iterMax,threads,seconds,"
+                        "pixelsPerSecond,iterationsPerSecond,efficiency,ipc,cyclesPerPixel,"
+                        "instructionsPerPixel,branchMissesPerPixel,l1MissesPerPixel,"
+                        "llcMissesPerPixel,fpOpsPerPixel,status";
+  if (options.perf)
+  {
+    PerfCounters::Events probe(true);
+    if (!probe.available())
+    {
+      cout << "Performance counters unavailable: " << probe.get_error() << "\n";
+      options.perf = false;
+    }
+  }
+  csv << header << "\n";
+  cout << header << "\n";
+
+  int failed = 0;
+  int regressed = 0;
+  for (const BenchmarkView &view : views)
+  {
+    for (int size : options.sizes)
+    {
+      for (int iterMax : options.iterMaxes)
+      {
+        for (const Implementation &implementation : implementations)
+        {
+          // the efficiency T1 / (N * TN) is against the single-thread run of the same cell
+          double single = -1.0;
+          vector<int> threadCounts = implementation.threaded ? options.threads : vector<int>{1};
+          for (int threads : threadCounts)
+          {
+            Result result;
+            result.implementation = implementation.name;
+            result.run = {view, size, iterMax, threads};
+            result.status = "ok";
+
+            // fastest of the repeated runs, the others only saw more noise
+            string image = "benchmark_" + implementation.name + ".ppm";
+            set_omp_threads(threads);
+            for (int repetition = 0; repetition < options.repeat; repetition++)
+            {
+              double seconds = 0.0;
+              unsigned long long iterations = 0;
+              // inherited by the child processes and summed up as they exit
+              unique_ptr<PerfCounters::Events> events;
+              if (options.perf)
+              {
+                events = make_unique<PerfCounters::Events>(true);
+              }
+              bool succeeded = run_command(implementation.command(result.run, image), seconds,
+                                           iterations);
+              remove(implementation.output(image).c_str());
+              if (!succeeded)
+              {
+                result.status = "failed";
+              }
+              if (repetition == 0 || seconds < result.seconds)
+              {
+                result.seconds = seconds;
+                result.iterations = iterations;
+                if (events)
+                {
+                  result.counts = events->read();
+                  for (size_t event = 0; event < PerfCounters::events; event++)
+                  {
+                    result.counted[event] = events->counted(static_cast<PerfCounters::Event>(event));
+                  }
+                }
+              }
+            }
+
+            if (threads == 1)
+            {
+              single = result.seconds;
+            }
+            result.efficiency = (single > 0.0) ? single / (threads * result.seconds) : -1.0;
+
+            auto previous = baseline.find(result_key(implementation.name, view.name, size, size,
+                                                     iterMax, threads));
+            if (result.status == "ok" && previous != baseline.end() &&
+                result.seconds > previous->second * (1.0 + options.threshold))
+            {
+              result.status = "regressed";
+            }
+            failed += (result.status == "failed") ? 1 : 0;
+            regressed += (result.status == "regressed") ? 1 : 0;
+
+            csv << result << "\n";
+            csv.flush();
+            cout << result << "\n";
+          }
+        }
+      }
+    }
+  }
+
+  cout << failed << " failed, " << regressed << " regressed";
+  if (!baseline.empty())
+  {
+    cout << " by more than " << 100.0 * options.threshold << "% against " << options.baseline;
+  }
+  cout << "\n";
+  return (failed == 0 && regressed == 0) ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#ifndef C____CANCELLATIONTOKEN_H_
+#define C____CANCELLATIONTOKEN_H_
+
+#include <atomic>
+#include <memory>
+
+/**
+ * Shared flag asking the tasks holding it to stop. Copies share the flag; the pool drops a
+ * cancelled task before it starts, and long kernels poll it so a started task ends early
+ */
+class CancellationToken
+{
+ public:
+
+  CancellationToken() : state(std::make_shared<std::atomic<bool>>(false))
+  {}
+
+  /**
+   * Cancel every task holding the token; cannot be undone
+   */
+  void cancel() const
+  {
+    state->store(true, std::memory_order_relaxed);
+  }
+
+  bool cancelled() const
+  {
+    return state->load(std::memory_order_relaxed);
+  }
+
+ private:
+
+  std::shared_ptr<std::atomic<bool>> state;
+};
+
+#endif //C____CANCELLATIONTOKEN_H_
@@ -0,0 +1,269 @@
+#include "CostModel.h"
+#include "TaskGroup.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * Sampled rows of the prepass in one task
+ */
+const int blocksPerTask = 8;
+
+/**
+ * @param kept - view of a measured render
+ * @param view - view about to be rendered
+ * @return TRUE if the views overlap enough for the kept row costs to predict the new ones
+ */
+bool nearby(const View &kept, const View &view)
+{
+  double scale = view.spanRe / kept.spanRe;
+  return scale > 0.5 && scale < 2.0
+         && abs(real(view.center) - real(kept.center)) <= 0.25 * kept.spanRe
+         && abs(imag(view.center) - imag(kept.center)) <= 0.25 * kept.spanIm;
+}
+
+} // namespace
+
+CostModel::CostModel(size_t viewsIn)
+{
+  views = viewsIn;
+  plans = 0;
+  measuredPlans = 0;
+  prepasses = 0;
+  prepassSeconds = 0.0;
+  recorded = 0;
+}
+
+vector<CostModel::Band> CostModel::plan(const FrameRenderer &renderer, ThreadPool &pool,
+                                        size_t bandCount)
+{
+  int height = renderer.get_height();
+  FrameRenderer::BandRows rows = renderer.band_rows(0, height);
+  vector<double> costs(static_cast<size_t>(height), 0.0);
+  if (!measured_costs(renderer, rows, costs))
+  {
+    prepass_costs(renderer, pool, rows, costs);
+  }
+
+  // guided sizes: each band takes a share of the cost still left to cut, so the first bands are
+  // large and the last ones small enough to even out the workers at the end
+  double remaining = accumulate(costs.begin(), costs.end(), 0.0);
+  double smallest = remaining / static_cast<double>(4 * max<size_t>(1, bandCount));
+  double workers = static_cast<double>(max<size_t>(1, pool.get_thread_count()));
+  double target = max(smallest, remaining / (2.0 * workers));
+  vector<Band> bands;
+  Band band{0, 0, 0.0};
+  for (int pY = 0; pY < height; pY++)
+  {
+    band.cost += costs[pY];
+    band.rowEnd = pY + 1;
+    if (band.cost >= target - 0.5 * costs[pY])
+    {
+      bands.push_back(band);
+      remaining -= band.cost;
+      target = max(smallest, remaining / (2.0 * workers));
+      band = {pY + 1, pY + 1, 0.0};
+    }
+  }
+  if (band.rowEnd > band.rowBegin)
+  {
+    if (!bands.empty() && band.cost == 0.0)
+    {
+      bands.back().rowEnd = band.rowEnd; // only reflected rows left
+    } else {
+      bands.push_back(band);
+    }
+  }
+  stable_sort(bands.begin(), bands.end(),
+              [](const Band &a, const Band &b) {return a.cost > b.cost;});
+
+  scoped_lock guard(lock);
+  plans++;
+  return bands;
+}
+
+bool CostModel::measured_costs(const FrameRenderer &renderer, const FrameRenderer::BandRows &rows,
+                               vector<double> &costs)
+{
+  View view = renderer.get_view();
+  int height = renderer.get_height();
+
+  scoped_lock guard(lock);
+  for (const Profile &profile : profiles)
+  {
+    if (profile.width != renderer.get_width() || profile.height != height
+        || profile.formula != renderer.get_formula() || profile.degree != renderer.get_degree()
+        || profile.juliaC != renderer.get_julia_c() || profile.iterMax > 2 * renderer.get_iterMax()
+        || 2 * profile.iterMax < renderer.get_iterMax() || !nearby(profile.view, view))
+    {
+      continue;
+    }
+
+    double known = 0.0;
+    int knownRows = 0;
+    for (double row : profile.rows)
+    {
+      if (row >= 0.0)
+      {
+        known += row;
+        knownRows++;
+      }
+    }
+    double mean = (knownRows > 0) ? known / knownRows : 1.0;
+
+    // rows are matched by their imaginary part; the kept view's reflected rows by their mirror
+    double pixHeight = view.spanIm / height;
+    double keptPixHeight = profile.view.spanIm / profile.height;
+    auto kept = [&profile, keptPixHeight](double y)
+    {
+      double row = floor((profile.view.cy_max() - y) / keptPixHeight + 0.5);
+      return (row >= 0.0 && row < profile.height) ? profile.rows[static_cast<size_t>(row)] : -1.0;
+    };
+    for (int pY = 0; pY < height; pY++)
+    {
+      if (pY < rows.first || pY > rows.last)
+      {
+        continue; // reflected
+      }
+      double y = view.cy_max() - pY * pixHeight;
+      double cost = kept(y);
+      cost = (cost >= 0.0) ? cost : kept(-y);
+      costs[pY] = (cost >= 0.0) ? cost : mean;
+    }
+    measuredPlans++;
+    return true;
+  }
+  return false;
+}
+
+void CostModel::prepass_costs(const FrameRenderer &renderer, ThreadPool &pool,
+                              const FrameRenderer::BandRows &rows, vector<double> &costs)
+{
+  int width = renderer.get_width();
+  int height = renderer.get_height();
+  int blocks = (height + sampleStep - 1) / sampleStep;
+  vector<double> blockCosts(static_cast<size_t>(blocks), 0.0);
+  // summed over the tasks, as wait() may also run unrelated queued work
+  atomic<int64_t> nanoseconds{0};
+
+  TaskGroup group(pool);
+  for (int firstBlock = 0; firstBlock < blocks; firstBlock += blocksPerTask)
+  {
+    int lastBlock = min(blocks, firstBlock + blocksPerTask);
+    group.run([&renderer, &rows, &blockCosts, &nanoseconds, firstBlock, lastBlock, width,
+               height]()
+              {
+                auto begin = chrono::steady_clock::now();
+                Mandelbrot gigabrot(width, height);
+                renderer.setup(gigabrot);
+                for (int block = firstBlock; block < lastBlock; block++)
+                {
+                  int blockBegin = block * sampleStep;
+                  int blockEnd = min(height, blockBegin + sampleStep) - 1;
+                  if (blockEnd < rows.first || blockBegin > rows.last)
+                  {
+                    continue; // every row of the block is reflected
+                  }
+                  // the middle row of the block, or the nearest one that is iterated
+                  int pY = clamp(blockBegin + sampleStep / 2, max(blockBegin, rows.first),
+                                 min(blockEnd, rows.last));
+                  uint64_t before = gigabrot.get_iterations_run();
+                  int samples = 0;
+                  for (int pX = min(sampleStep / 2, width - 1); pX < width; pX += sampleStep)
+                  {
+                    gigabrot.current_pixel(pX, pY);
+                    gigabrot.get_c();
+                    gigabrot.iterate();
+                    gigabrot.reset();
+                    samples++;
+                  }
+                  double iterations = static_cast<double>(gigabrot.get_iterations_run() - before);
+                  blockCosts[block] = (iterations / max(1, samples) + pixelCost) * width;
+                }
+                nanoseconds += chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - begin).count();
+              });
+  }
+  group.wait();
+
+  for (int pY = max(0, rows.first); pY <= rows.last; pY++)
+  {
+    costs[pY] = blockCosts[pY / sampleStep];
+  }
+
+  scoped_lock guard(lock);
+  prepasses++;
+  prepassSeconds += static_cast<double>(nanoseconds.load()) * 1e-9;
+}
+
+shared_ptr<CostModel::Timing> CostModel::time(const FrameRenderer &renderer, vector<Band> bands)
+{
+  return make_shared<Timing>(*this, renderer, std::move(bands));
+}
+
+void CostModel::record(const Timing &timing)
+{
+  Profile profile{timing.view, timing.width, timing.height, timing.iterMax, timing.formula,
+                  timing.degree, timing.juliaC, vector<double>(timing.height, -1.0)};
+
+  // a band's time is spread evenly over its iterated rows; bands are thin where rows are
+  // expensive, so the profile is finest where it matters
+  for (size_t band = 0; band < timing.bands.size(); band++)
+  {
+    int first = max(timing.bands[band].rowBegin, timing.rows.first);
+    int last = min(timing.bands[band].rowEnd - 1, timing.rows.last);
+    for (int pY = first; pY <= last; pY++)
+    {
+      profile.rows[pY] = timing.seconds[band] / (last - first + 1);
+    }
+  }
+
+  scoped_lock guard(lock);
+  profiles.push_front(std::move(profile));
+  if (profiles.size() > views)
+  {
+    profiles.pop_back();
+  }
+  recorded++;
+}
+
+CostModel::Timing::Timing(CostModel &modelIn, const FrameRenderer &renderer,
+                          vector<Band> bandsIn) : model(modelIn)
+{
+  view = renderer.get_view();
+  width = renderer.get_width();
+  height = renderer.get_height();
+  iterMax = renderer.get_iterMax();
+  formula = renderer.get_formula();
+  degree = renderer.get_degree();
+  juliaC = renderer.get_julia_c();
+  rows = renderer.band_rows(0, height);
+  bands = std::move(bandsIn);
+  seconds.assign(bands.size(), 0.0);
+  remaining = bands.size();
+}
+
+void CostModel::Timing::finish(size_t band, double secondsIn)
+{
+  seconds[band] = secondsIn;
+  if (remaining.fetch_sub(1, memory_order_acq_rel) == 1)
+  {
+    model.record(*this);
+  }
+}
+
+ostream &operator<<(ostream &os, const CostModel &model)
+{
+  scoped_lock guard(model.lock);
+  os << "Cost model: " << model.plans << " renders planned, " << model.measuredPlans
+     << " from measured views, " << model.prepasses << " prepasses in " << model.prepassSeconds
+     << " sec, " << model.recorded << " renders measured\n";
+  return os;
+}
@@ -0,0 +1,195 @@
+#ifndef C____COSTMODEL_H_
+#define C____COSTMODEL_H_
+
+#include "FrameRenderer.h"
+#include "ThreadPool.h"
+#include "View.h"
+
+#include <atomic>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Splits a render into row bands of about equal estimated cost instead of equal height, so that
+ * a band crossing the boundary of the set does not keep one worker busy long after the others ran
+ * out of work. Row costs come from the measured band times of an earlier render of a nearby view
+ * when there is one, otherwise from iterating every 4th pixel of every 4th row (a 1/16 prepass).
+ * Bands are handed out most expensive first, so the cheap ones fill in the tail
+ */
+class CostModel
+{
+ public:
+
+  /**
+   * Default parametrized constructor
+   * @param viewsIn - measured views kept for later renders
+   */
+  explicit CostModel(std::size_t viewsIn = 16);
+
+  /**
+   * Rows [rowBegin, rowEnd) of an image and their estimated cost
+   */
+  struct Band
+  {
+    int rowBegin;
+
+    int rowEnd;
+
+    double cost;
+  };
+
+  /**
+   * Split a renderer's image into bands, most expensive first. Each band costs about half the
+   * cost still left to cut divided by the pool's workers, so band sizes shrink towards the end of
+   * the queue. Reflected rows cost nothing, as they are written along with their mirror rows
+   * @param renderer
+   * @param pool - runs the prepass, if one is needed
+   * @param bandCount - bands of equal cost the image would be cut into; no band costs less than a
+   * quarter of one of those
+   * @return bands covering every row once
+   */
+  std::vector<Band> plan(const FrameRenderer &renderer, ThreadPool &pool, std::size_t bandCount);
+
+  /**
+   * Band times of one render, kept as the row costs of its view once every band has reported
+   */
+  class Timing
+  {
+   public:
+
+    Timing(CostModel &modelIn, const FrameRenderer &renderer, std::vector<Band> bandsIn);
+
+    /**
+     * Called by each band when it is done; thread safe
+     * @param band - index into the plan
+     * @param secondsIn - time the band took
+     */
+    void finish(std::size_t band, double secondsIn);
+
+   private:
+
+    CostModel &model;
+
+    View view;
+
+    int width;
+
+    int height;
+
+    int iterMax;
+
+    Mandelbrot::Formula formula;
+
+    int degree;
+
+    std::complex<double> juliaC;
+
+    FrameRenderer::BandRows rows;
+
+    std::vector<Band> bands;
+
+    std::vector<double> seconds;
+
+    std::atomic<std::size_t> remaining;
+
+    friend class CostModel;
+  };
+
+  /**
+   * @param renderer
+   * @param bands - from plan()
+   * @return shared by the band tasks; bands that were cancelled or threw never report, and
+   * their render is then not kept
+   */
+  std::shared_ptr<Timing> time(const FrameRenderer &renderer, std::vector<Band> bands);
+
+  /**
+   * Cost of a pixel besides its iterations, in iterations; covers the setup and coloring
+   */
+  inline static const double pixelCost = 30.0;
+
+  /**
+   * Pixels and rows between samples of the prepass
+   */
+  inline static const int sampleStep = 4;
+
+  friend std::ostream &operator<<(std::ostream &os, const CostModel &model);
+
+ private:
+
+  /**
+   * Row costs of a finished render
+   */
+  struct Profile
+  {
+    View view;
+
+    int width;
+
+    int height;
+
+    int iterMax;
+
+    Mandelbrot::Formula formula;
+
+    int degree;
+
+    std::complex<double> juliaC;
+
+    /**
+     * seconds per row, -1 for reflected rows
+     */
+    std::vector<double> rows;
+  };
+
+  /**
+   * @param renderer
+   * @param rows - iterated rows of the image
+   * @param costs - filled with one cost per row
+   * @return FALSE if no kept view is close enough
+   */
+  bool measured_costs(const FrameRenderer &renderer, const FrameRenderer::BandRows &rows,
+                      std::vector<double> &costs);
+
+  /**
+   * @param renderer
+   * @param pool
+   * @param rows - iterated rows of the image
+   * @param costs - filled with one cost per row
+   */
+  void prepass_costs(const FrameRenderer &renderer, ThreadPool &pool,
+                     const FrameRenderer::BandRows &rows, std::vector<double> &costs);
+
+  /**
+   * Keep the row costs of a render whose bands all reported
+   * @param timing
+   */
+  void record(const Timing &timing);
+
+  std::size_t views;
+
+  mutable std::mutex lock;
+
+  /**
+   * newest first
+   */
+  std::deque<Profile> profiles;
+
+  std::uint64_t plans;
+
+  std::uint64_t measuredPlans;
+
+  std::uint64_t prepasses;
+
+  double prepassSeconds;
+
+  std::uint64_t recorded;
+};
+
+#endif //C____COSTMODEL_H_
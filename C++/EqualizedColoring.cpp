@@ -0,0 +1,232 @@
+#include "EqualizedColoring.h"
+#include "InsideColor.h"
+#include "LineColor.h"
+#include "Striping.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * @param value - positive
+ * @param offset - octaves below 1 that still get a bin
+ * @return log-scaled bin of a value
+ */
+size_t octave_bin(double value, double offset)
+{
+  double bin = (log2(max(value, 1e-300)) + offset) * EqualizedColoring::binsPerOctave;
+  return static_cast<size_t>(clamp(bin, 0.0, static_cast<double>(
+      EqualizedColoring::binsPerOctave * EqualizedColoring::octaves - 1)));
+}
+
+// smooth iteration counts start at 1, distances in pixels go well below
+const double iterationOffset = 0.0;
+
+const double distanceOffset = 32.0;
+
+} // namespace
+
+EqualizedColoring::Histograms::Histograms() : average(averageBins, 0),
+iteration(binsPerOctave * octaves, 0), distance(binsPerOctave * octaves, 0)
+{}
+
+void EqualizedColoring::Histograms::add(double averageIn, double smoothIter, double distanceIn)
+{
+  average[min(averageBins - 1, static_cast<size_t>(max(0.0, averageIn) * averageBins))]++;
+  iteration[octave_bin(smoothIter, iterationOffset)]++;
+  distance[octave_bin(distanceIn, distanceOffset)]++;
+}
+
+EqualizedColoring::EqualizedColoring(int width, int height) : width(width), height(height)
+{
+  averageCounts = make_unique<atomic<uint64_t>[]>(averageBins);
+  iterationCounts = make_unique<atomic<uint64_t>[]>(binsPerOctave * octaves);
+  distanceCounts = make_unique<atomic<uint64_t>[]>(binsPerOctave * octaves);
+  striped = 0;
+}
+
+EqualizedColoring::~EqualizedColoring()
+{
+  if (spillFile.is_open())
+  {
+    spillFile.close();
+    remove(spillPath.c_str());
+  }
+}
+
+void EqualizedColoring::begin()
+{
+  for (size_t bin = 0; bin < averageBins; bin++)
+  {
+    averageCounts[bin] = 0;
+  }
+  for (size_t bin = 0; bin < binsPerOctave * octaves; bin++)
+  {
+    iterationCounts[bin] = 0;
+    distanceCounts[bin] = 0;
+  }
+  if (!spilled())
+  {
+    field.resize(static_cast<size_t>(width) * height);
+  }
+}
+
+bool EqualizedColoring::spill(const string &path)
+{
+  spillFile.open(path, ios::in | ios::out | ios::trunc | ios::binary);
+  if (!spillFile)
+  {
+    return false;
+  }
+  spillPath = path;
+  vector<Sample>().swap(field);
+  return true;
+}
+
+size_t EqualizedColoring::field_bytes() const
+{
+  return static_cast<size_t>(width) * height * sizeof(Sample);
+}
+
+bool EqualizedColoring::spilled() const
+{
+  return spillFile.is_open();
+}
+
+void EqualizedColoring::store(int firstRow, int rows, const Sample *samples)
+{
+  size_t first = static_cast<size_t>(firstRow) * width;
+  size_t count = static_cast<size_t>(rows) * width;
+  if (!spilled())
+  {
+    copy(samples, samples + count, field.begin() + static_cast<ptrdiff_t>(first));
+    return;
+  }
+  scoped_lock guard(spillLock);
+  spillFile.seekp(static_cast<streamoff>(first * sizeof(Sample)));
+  spillFile.write(reinterpret_cast<const char *>(samples),
+                  static_cast<streamsize>(count * sizeof(Sample)));
+}
+
+void EqualizedColoring::merge(const Histograms &local)
+{
+  auto add = [](atomic<uint64_t> *totals, const vector<uint32_t> &counts)
+  {
+    for (size_t bin = 0; bin < counts.size(); bin++)
+    {
+      if (counts[bin] != 0)
+      {
+        totals[bin].fetch_add(counts[bin], memory_order_relaxed);
+      }
+    }
+  };
+  add(averageCounts.get(), local.average);
+  add(iterationCounts.get(), local.iteration);
+  add(distanceCounts.get(), local.distance);
+}
+
+void EqualizedColoring::finalize()
+{
+  averageCdf.assign(averageBins, 0.0);
+  striped = 0;
+  for (size_t bin = 0; bin < averageBins; bin++)
+  {
+    striped += averageCounts[bin].load(memory_order_relaxed);
+    averageCdf[bin] = static_cast<double>(striped);
+  }
+  for (double &share : averageCdf)
+  {
+    share = (striped > 0) ? share / static_cast<double>(striped) : 0.0;
+  }
+}
+
+unsigned char EqualizedColoring::color(const Sample &sample) const
+{
+  if (sample.average < 0.0F)
+  {
+    InsideColor color;
+    return color.calculate_bw();
+  } else if (sample.average == 0.0F) {
+    LineColor color;
+    return color.calculate_bw();
+  }
+  // position within the bin, so that equal averages keep equal shades and nearby ones stay
+  // ordered
+  double position = min(static_cast<double>(sample.average), 1.0) * averageBins;
+  size_t bin = min(averageBins - 1, static_cast<size_t>(position));
+  double below = (bin > 0) ? averageCdf[bin - 1] : 0.0;
+  double equalized = below + (averageCdf[bin] - below) * (position - static_cast<double>(bin));
+  Striping color(equalized, static_cast<double>(sample.reflection));
+  return color.calculate_bw();
+}
+
+void EqualizedColoring::color_rows(int firstRow, int rows, unsigned char *rgb)
+{
+  size_t count = static_cast<size_t>(rows) * width;
+  vector<Sample> loaded;
+  const Sample *samples;
+  if (spilled())
+  {
+    loaded.resize(count);
+    scoped_lock guard(spillLock);
+    spillFile.seekg(static_cast<streamoff>(static_cast<size_t>(firstRow) * width * sizeof(Sample)));
+    spillFile.read(reinterpret_cast<char *>(loaded.data()),
+                   static_cast<streamsize>(count * sizeof(Sample)));
+    samples = loaded.data();
+  } else {
+    samples = field.data() + static_cast<size_t>(firstRow) * width;
+  }
+  for (size_t pixel = 0; pixel < count; pixel++)
+  {
+    rgb[3 * pixel + 2] = rgb[3 * pixel + 1] = rgb[3 * pixel] = color(samples[pixel]);
+  }
+}
+
+double EqualizedColoring::percentile_bin(const vector<uint64_t> &counts, double fraction)
+{
+  uint64_t total = 0;
+  for (uint64_t count : counts)
+  {
+    total += count;
+  }
+  uint64_t seen = 0;
+  for (size_t bin = 0; bin < counts.size(); bin++)
+  {
+    seen += counts[bin];
+    if (static_cast<double>(seen) >= fraction * static_cast<double>(total) && seen > 0)
+    {
+      return static_cast<double>(bin);
+    }
+  }
+  return 0.0;
+}
+
+ostream &operator<<(ostream &os, const EqualizedColoring &coloring)
+{
+  size_t bins = EqualizedColoring::binsPerOctave * EqualizedColoring::octaves;
+  vector<uint64_t> iterations(bins);
+  vector<uint64_t> distances(bins);
+  for (size_t bin = 0; bin < bins; bin++)
+  {
+    iterations[bin] = coloring.iterationCounts[bin].load(memory_order_relaxed);
+    distances[bin] = coloring.distanceCounts[bin].load(memory_order_relaxed);
+  }
+  auto value = [](double bin, double offset)
+  {
+    return exp2(bin / EqualizedColoring::binsPerOctave - offset);
+  };
+  os << "Equalized coloring: " << coloring.striped << " striped pixels, samples "
+     << (coloring.spilled() ? "spilled to " + coloring.spillPath : string("in memory")) << "\n";
+  os << "Smooth iterations: median " << value(coloring.percentile_bin(iterations, 0.5),
+                                              iterationOffset)
+     << ", 99th percentile " << value(coloring.percentile_bin(iterations, 0.99), iterationOffset)
+     << "; distance estimate: median " << value(coloring.percentile_bin(distances, 0.5),
+                                                distanceOffset)
+     << " pixels\n";
+  return os;
+}
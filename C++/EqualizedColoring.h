@@ -0,0 +1,170 @@
+#ifndef C____EQUALIZEDCOLORING_H_
+#define C____EQUALIZEDCOLORING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Two-pass coloring that maps the stripe average through its own distribution over the image
+ * (histogram equalization) instead of linearly, so views whose averages crowd together still use
+ * the whole shade range. The first pass stores a small field sample per pixel and fills
+ * histograms of the stripe average, smooth iteration count and distance estimate; the second
+ * pass colors rows from the samples. Samples stay in memory or are spilled to a file
+ */
+class EqualizedColoring
+{
+ public:
+
+  /**
+   * What the second pass needs of a pixel
+   */
+  struct Sample
+  {
+    /**
+     * stripe average as left by Mandelbrot::average(): -1 inside the set, 0 on the border
+     */
+    float average;
+
+    /**
+     * Neumorphic shading factor
+     */
+    float reflection;
+  };
+
+  inline static const std::size_t averageBins = 4096;
+
+  /**
+   * per octave of the smooth iteration count, and of the distance estimate in pixels
+   */
+  inline static const std::size_t binsPerOctave = 16;
+
+  inline static const std::size_t octaves = 64;
+
+  /**
+   * Histograms of a band (or thread), merged into the totals once the band is done
+   */
+  struct Histograms
+  {
+    Histograms();
+
+    /**
+     * Count an escaped pixel outside the border
+     * @param average - stripe average
+     * @param smoothIter - smooth iteration count
+     * @param distance - distance estimate in pixels
+     */
+    void add(double average, double smoothIter, double distance);
+
+    std::vector<std::uint32_t> average;
+
+    std::vector<std::uint32_t> iteration;
+
+    std::vector<std::uint32_t> distance;
+  };
+
+  /**
+   * Default parametrized constructor
+   * @param width - image width
+   * @param height - image height
+   */
+  EqualizedColoring(int width, int height);
+
+  ~EqualizedColoring();
+
+  /**
+   * Start the first pass: clear the histograms and hold the samples in memory, unless they are
+   * spilled
+   */
+  void begin();
+
+  /**
+   * Keep the samples in a file instead of memory; call before begin()
+   * @param path - removed again when the coloring is destroyed
+   * @return FALSE if the file could not be opened
+   */
+  bool spill(const std::string &path);
+
+  /**
+   * @return bytes of samples of the image, held in memory or spilled
+   */
+  std::size_t field_bytes() const;
+
+  bool spilled() const;
+
+  /**
+   * Store the samples of consecutive rows, thread safe
+   * @param firstRow
+   * @param rows
+   * @param samples - rows * width samples
+   */
+  void store(int firstRow, int rows, const Sample *samples);
+
+  /**
+   * Add a band's histograms to the totals, thread safe and lock free
+   * @param local
+   */
+  void merge(const Histograms &local);
+
+  /**
+   * End the first pass: build the mapping from the merged histograms
+   */
+  void finalize();
+
+  /**
+   * Second pass for consecutive rows, thread safe once finalize() has been called
+   * @param firstRow
+   * @param rows
+   * @param rgb - rows * width pixels
+   */
+  void color_rows(int firstRow, int rows, unsigned char *rgb);
+
+  /**
+   * @param sample
+   * @return shade of a pixel
+   */
+  unsigned char color(const Sample &sample) const;
+
+  friend std::ostream &operator<<(std::ostream &os, const EqualizedColoring &coloring);
+
+ private:
+
+  /**
+   * @param counts - histogram
+   * @param fraction
+   * @return lower edge of the bin holding that fraction of the counts
+   */
+  static double percentile_bin(const std::vector<std::uint64_t> &counts, double fraction);
+
+  int width;
+
+  int height;
+
+  std::vector<Sample> field;
+
+  std::fstream spillFile;
+
+  std::string spillPath;
+
+  std::mutex spillLock;
+
+  std::unique_ptr<std::atomic<std::uint64_t>[]> averageCounts;
+
+  std::unique_ptr<std::atomic<std::uint64_t>[]> iterationCounts;
+
+  std::unique_ptr<std::atomic<std::uint64_t>[]> distanceCounts;
+
+  /**
+   * share of stripe pixels at or below each bin's upper edge
+   */
+  std::vector<double> averageCdf;
+
+  std::uint64_t striped;
+};
+
+#endif //C____EQUALIZEDCOLORING_H_
@@ -0,0 +1,239 @@
+#include "ExecutionBackend.h"
+#include "TaskGroup.h"
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef GIGABROT_PARALLEL_ALGORITHMS
+#include <execution>
+#include <memory>
+#include <tbb/global_control.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * First exception of the items of a loop; OpenMP and the parallel algorithms terminate on an
+ * exception leaving an item and a task group drops its remaining tasks, so every item of every
+ * backend runs under a catch
+ */
+class FirstError
+{
+ public:
+
+  void run(const function<void(size_t)> &work, size_t item)
+  {
+    try
+    {
+      work(item);
+    } catch (...)
+    {
+      scoped_lock guard(lock);
+      if (!error)
+      {
+        error = current_exception();
+      }
+    }
+  }
+
+  void rethrow()
+  {
+    if (error)
+    {
+      rethrow_exception(error);
+    }
+  }
+
+ private:
+
+  mutex lock;
+
+  exception_ptr error;
+};
+
+/**
+ * @param count
+ * @param work
+ * @param error - every item runs, like on the parallel backends
+ */
+void run_serial(size_t count, const function<void(size_t)> &work, FirstError &error)
+{
+  for (size_t item = 0; item < count; item++)
+  {
+    error.run(work, item);
+  }
+}
+
+#ifdef _OPENMP
+/**
+ * @param kind - one of the OpenMP kinds
+ * @param threads - 0 for OpenMP's default
+ * @param count
+ * @param work
+ * @param error
+ */
+void run_openmp(ExecutionBackend::Kind kind, size_t threads, size_t count,
+                const function<void(size_t)> &work, FirstError &error)
+{
+  auto items = static_cast<long long>(count);
+  int team = (threads > 0) ? static_cast<int>(threads) : omp_get_max_threads();
+  if (kind == ExecutionBackend::Kind::OpenMPStatic)
+  {
+#pragma omp parallel for schedule(static) num_threads(team)
+    for (long long item = 0; item < items; item++)
+    {
+      error.run(work, static_cast<size_t>(item));
+    }
+  } else if (kind == ExecutionBackend::Kind::OpenMPDynamic) {
+#pragma omp parallel for schedule(dynamic) num_threads(team)
+    for (long long item = 0; item < items; item++)
+    {
+      error.run(work, static_cast<size_t>(item));
+    }
+  } else {
+#pragma omp parallel for schedule(guided) num_threads(team)
+    for (long long item = 0; item < items; item++)
+    {
+      error.run(work, static_cast<size_t>(item));
+    }
+  }
+}
+#endif
+
+} // namespace
+
+ExecutionBackend::ExecutionBackend(Kind kindIn, ThreadPool *poolIn, size_t threadsIn)
+{
+  if (kindIn == Kind::Pool && poolIn == nullptr)
+  {
+    throw invalid_argument("the pool backend needs a thread pool");
+  }
+  kind = kindIn;
+  pool = poolIn;
+  threads = threadsIn;
+}
+
+void ExecutionBackend::for_each(size_t count, const function<void(size_t)> &work) const
+{
+  FirstError error;
+  switch (kind)
+  {
+    case Kind::Serial:
+      run_serial(count, work, error);
+      break;
+    case Kind::OpenMPStatic:
+    case Kind::OpenMPDynamic:
+    case Kind::OpenMPGuided:
+#ifdef _OPENMP
+      run_openmp(kind, threads, count, work, error);
+      break;
+#else
+      run_serial(count, work, error);
+      break;
+#endif
+    case Kind::Pool:
+    {
+      // caught per item, as a group drops its tasks that have not started on an exception
+      TaskGroup group(*pool);
+      for (size_t item = 0; item < count; item++)
+      {
+        group.run([&error, &work, item]() {error.run(work, item);});
+      }
+      group.wait();
+      break;
+    }
+    case Kind::ParallelAlgorithms:
+    {
+#ifdef GIGABROT_PARALLEL_ALGORITHMS
+      unique_ptr<tbb::global_control> limit;
+      if (threads > 0)
+      {
+        limit = make_unique<tbb::global_control>(tbb::global_control::max_allowed_parallelism,
+                                                 threads);
+      }
+      vector<size_t> indices(count);
+      iota(indices.begin(), indices.end(), 0);
+      std::for_each(execution::par, indices.begin(), indices.end(),
+                    [&error, &work](size_t item) {error.run(work, item);});
+      break;
+#else
+      run_serial(count, work, error);
+      break;
+#endif
+    }
+  }
+  error.rethrow();
+}
+
+ExecutionBackend::Kind ExecutionBackend::get_kind() const
+{
+  return kind;
+}
+
+const char *ExecutionBackend::name(Kind kind)
+{
+  switch (kind)
+  {
+    case Kind::Serial:
+      return "serial";
+    case Kind::OpenMPStatic:
+      return "omp-static";
+    case Kind::OpenMPDynamic:
+      return "omp-dynamic";
+    case Kind::OpenMPGuided:
+      return "omp-guided";
+    case Kind::Pool:
+      return "pool";
+    case Kind::ParallelAlgorithms:
+      return "std-par";
+  }
+  return "unknown";
+}
+
+bool ExecutionBackend::parse(const string &nameIn, Kind &kind)
+{
+  for (Kind candidate : {Kind::Serial, Kind::OpenMPStatic, Kind::OpenMPDynamic,
+                         Kind::OpenMPGuided, Kind::Pool, Kind::ParallelAlgorithms})
+  {
+    if (nameIn == name(candidate))
+    {
+      kind = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ExecutionBackend::available(Kind kind)
+{
+  switch (kind)
+  {
+    case Kind::OpenMPStatic:
+    case Kind::OpenMPDynamic:
+    case Kind::OpenMPGuided:
+#ifdef _OPENMP
+      return true;
+#else
+      return false;
+#endif
+    case Kind::ParallelAlgorithms:
+#ifdef GIGABROT_PARALLEL_ALGORITHMS
+      return true;
+#else
+      return false;
+#endif
+    default:
+      return true;
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef C____EXECUTIONBACKEND_H_
+#define C____EXECUTIONBACKEND_H_
+
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+/**
+ * Runs the independent items of a loop, such as the bands of an image, on one of several
+ * parallel runtimes chosen at run time, so the same renderer can be compared across them or moved
+ * off one that scales poorly on a machine. OpenMP backends need a build with OpenMP, the C++17
+ * parallel algorithms one a build with TBB (GIGABROT_PARALLEL_ALGORITHMS); without them the loop
+ * runs serially, see available()
+ */
+class ExecutionBackend
+{
+ public:
+
+  enum class Kind
+  {
+    Serial,             // on the calling thread, in order
+    OpenMPStatic,       // omp parallel for schedule(static)
+    OpenMPDynamic,      // omp parallel for schedule(dynamic)
+    OpenMPGuided,       // omp parallel for schedule(guided)
+    Pool,               // tasks of a TaskGroup on a ThreadPool
+    ParallelAlgorithms  // std::for_each(std::execution::par, ...)
+  };
+
+  /**
+   * Default parametrized constructor
+   * @param kindIn
+   * @param poolIn - runs the Pool backend, must outlive the backend; unused by the others
+   * @param threadsIn - threads of the OpenMP and parallel algorithms backends, 0 for their
+   * default
+   */
+  explicit ExecutionBackend(Kind kindIn, ThreadPool *poolIn = nullptr, std::size_t threadsIn = 0);
+
+  /**
+   * Call work(0) ... work(count - 1), returning once all calls are done. Calls may run
+   * concurrently and in any order; the first exception a call threw is rethrown after the rest
+   * are done
+   * @param count
+   * @param work
+   */
+  void for_each(std::size_t count, const std::function<void(std::size_t)> &work) const;
+
+  Kind get_kind() const;
+
+  /**
+   * @param kind
+   * @return name as taken by parse()
+   */
+  static const char *name(Kind kind);
+
+  /**
+   * @param nameIn - serial, omp-static, omp-dynamic, omp-guided, pool or std-par
+   * @param kind - set if the name is known
+   * @return FALSE for an unknown name
+   */
+  static bool parse(const std::string &nameIn, Kind &kind);
+
+  /**
+   * @param kind
+   * @return FALSE if the backend was not built in and runs serially
+   */
+  static bool available(Kind kind);
+
+ private:
+
+  Kind kind;
+
+  ThreadPool *pool;
+
+  std::size_t threads;
+};
+
+#endif //C____EXECUTIONBACKEND_H_
@@ -0,0 +1,117 @@
+#ifndef C____FORMULA_H_
+#define C____FORMULA_H_
+
+#include <cmath>
+#include <complex>
+
+/**
+ * Iterated formulas, one struct per formula so that Mandelbrot::iterate() is instantiated as a
+ * kernel of its own for each: integer powers unroll into multiplies and the derivative
+ * recurrence is written next to the formula it belongs to. Every formula provides
+ *   degree - of the polynomial, for the smooth iteration count
+ *   start(z, dC, pixel) - initial z and derivative for a pixel
+ *   step(z, dC, c) - one iteration of z and of its derivative
+ */
+namespace formula
+{
+
+/**
+ * @tparam N - power, at least 1
+ * @param z
+ * @return z^N by repeated squaring
+ */
+template<int N>
+inline std::complex<double> power(const std::complex<double> &z)
+{
+  static_assert(N >= 1, "power must be positive");
+  if constexpr (N == 1)
+  {
+    return z;
+  } else if constexpr (N % 2 == 0) {
+    std::complex<double> half = power<N / 2>(z);
+    return half * half;
+  } else {
+    return power<N - 1>(z) * z;
+  }
+}
+
+/**
+ * z^D + c over the parameter plane, dC = dz/dc
+ * @tparam D - degree, 2 is the Mandelbrot set
+ */
+template<int D>
+struct Multibrot
+{
+  static constexpr int degree = D;
+
+  static void start(std::complex<double> &z, std::complex<double> &dC, const std::complex<double> &)
+  {
+    z = 0.0;
+    dC = 0.0;
+  }
+
+  static void step(std::complex<double> &z, std::complex<double> &dC, const std::complex<double> &c)
+  {
+    if constexpr (D == 2)
+    {
+      // mandelbrot set formula
+      dC = 2.0 * dC * z + 1.0;
+      z = z * z + c;
+    } else {
+      std::complex<double> zPower = power<D - 1>(z);
+      dC = static_cast<double>(D) * zPower * dC + 1.0;
+      z = zPower * z + c;
+    }
+  }
+};
+
+/**
+ * z^D + c over the dynamic plane for a fixed c, z(0) is the pixel and dC = dz/dz(0)
+ * @tparam D - degree
+ */
+template<int D>
+struct Julia
+{
+  static constexpr int degree = D;
+
+  static void start(std::complex<double> &z, std::complex<double> &dC,
+                    const std::complex<double> &pixel)
+  {
+    z = pixel;
+    dC = 1.0;
+  }
+
+  static void step(std::complex<double> &z, std::complex<double> &dC, const std::complex<double> &c)
+  {
+    std::complex<double> zPower = power<D - 1>(z);
+    dC = static_cast<double>(D) * zPower * dC;
+    z = zPower * z + c;
+  }
+};
+
+/**
+ * (|Re z| + i|Im z|)^2 + c. The fold is a reflection, so the derivative is reflected along with
+ * z; its magnitude, which is all the distance estimate uses, stays exact
+ */
+struct BurningShip
+{
+  static constexpr int degree = 2;
+
+  static void start(std::complex<double> &z, std::complex<double> &dC, const std::complex<double> &)
+  {
+    z = 0.0;
+    dC = 0.0;
+  }
+
+  static void step(std::complex<double> &z, std::complex<double> &dC, const std::complex<double> &c)
+  {
+    dC = {std::signbit(real(z)) ? -real(dC) : real(dC), std::signbit(imag(z)) ? -imag(dC) : imag(dC)};
+    z = {std::abs(real(z)), std::abs(imag(z))};
+    dC = 2.0 * dC * z + 1.0;
+    z = z * z + c;
+  }
+};
+
+} // namespace formula
+
+#endif //C____FORMULA_H_
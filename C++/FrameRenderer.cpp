@@ -0,0 +1,754 @@
+#include "FrameRenderer.h"
+#include "CostModel.h"
+#include "TaskGroup.h"
+
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * Size a frame buffer; a freshly allocated one is handed back to the kernel after resize() has
+ * zeroed it, so its pages are first touched by the band tasks that write them and land on those
+ * workers' NUMA nodes rather than all on the caller's
+ * @param buffer
+ * @param count - elements
+ */
+template<typename T>
+void size_for_bands(vector<T> &buffer, size_t count)
+{
+  bool fresh = buffer.capacity() < count;
+  buffer.resize(count);
+#ifdef __linux__
+  if (!fresh)
+  {
+    return; // reused from an earlier frame, already placed
+  }
+  uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t begin = (reinterpret_cast<uintptr_t>(buffer.data()) + page - 1) & ~(page - 1);
+  uintptr_t end = reinterpret_cast<uintptr_t>(buffer.data() + count) & ~(page - 1);
+  if (end > begin)
+  {
+    // private anonymous pages read back as zeros, which is what resize() left there
+    madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+  }
+#else
+  (void) fresh;
+#endif
+}
+
+} // namespace
+
+FrameRenderer::FrameRenderer(int width, int height) : width(width), height(height)
+{
+  view = View::from_plane(-2.2, 0.8, -1.5, 1.5);
+  iterMax = 1000;
+  stripeDensity = 7.0;
+  iSkip = 1;
+  thin = 3;
+  orbit = nullptr;
+  offset = 0.0;
+  bla = nullptr;
+  formula = Mandelbrot::Formula::Mandelbrot;
+  degree = 2;
+  juliaC = 0.0;
+  exteriorFill = ExteriorFill::Off;
+  fillBlock = 4;
+  equalizer = nullptr;
+  iteratedPixels = 0;
+  exteriorPixels = 0;
+  estimatedPixels = 0;
+  iterationCount = 0;
+  perfCounters = nullptr;
+  costModel = nullptr;
+  interiorHint = nullptr;
+  bandHeight = 16;
+  symmetry = true;
+}
+
+void FrameRenderer::set_view(const View &viewIn)
+{
+  view = viewIn;
+}
+
+View FrameRenderer::get_view() const
+{
+  return view;
+}
+
+void FrameRenderer::set_iterMax(int iterMaxIn)
+{
+  iterMax = iterMaxIn;
+}
+
+int FrameRenderer::get_iterMax() const
+{
+  return iterMax;
+}
+
+void FrameRenderer::set_stripe_density(double stripeDensityIn)
+{
+  stripeDensity = stripeDensityIn;
+}
+
+double FrameRenderer::get_stripe_density() const
+{
+  return stripeDensity;
+}
+
+void FrameRenderer::set_iSkip(int iSkipIn)
+{
+  iSkip = iSkipIn;
+}
+
+void FrameRenderer::set_border(int thinIn)
+{
+  thin = thinIn;
+}
+
+void FrameRenderer::set_reference(const ReferenceOrbit *orbitIn, complex<double> offsetIn)
+{
+  orbit = orbitIn;
+  offset = offsetIn;
+}
+
+void FrameRenderer::set_bla(const BLATable *blaIn)
+{
+  bla = blaIn;
+}
+
+double FrameRenderer::max_reference_offset() const
+{
+  return abs(offset) + 0.5 * hypot(view.spanRe, view.spanIm);
+}
+
+void FrameRenderer::set_formula(Mandelbrot::Formula formulaIn, int degreeIn)
+{
+  if (degreeIn < 2 || degreeIn > Mandelbrot::maxDegree)
+  {
+    throw invalid_argument("formula degree must be 2 ... " + to_string(Mandelbrot::maxDegree));
+  }
+  formula = formulaIn;
+  degree = degreeIn;
+}
+
+Mandelbrot::Formula FrameRenderer::get_formula() const
+{
+  return formula;
+}
+
+int FrameRenderer::get_degree() const
+{
+  return degree;
+}
+
+void FrameRenderer::set_julia_c(complex<double> juliaCIn)
+{
+  juliaC = juliaCIn;
+}
+
+complex<double> FrameRenderer::get_julia_c() const
+{
+  return juliaC;
+}
+
+void FrameRenderer::set_exterior_fill(ExteriorFill fillIn, int blockIn)
+{
+  exteriorFill = fillIn;
+  fillBlock = max(1, blockIn);
+}
+
+FrameRenderer::FillCounts FrameRenderer::get_fill_counts() const
+{
+  return FillCounts{iteratedPixels.load(memory_order_relaxed),
+                    exteriorPixels.load(memory_order_relaxed),
+                    estimatedPixels.load(memory_order_relaxed)};
+}
+
+uint64_t FrameRenderer::get_iteration_count() const
+{
+  return iterationCount.load(memory_order_relaxed);
+}
+
+void FrameRenderer::set_cost_model(CostModel *costModelIn)
+{
+  costModel = costModelIn;
+}
+
+CostModel *FrameRenderer::get_cost_model() const
+{
+  return costModel;
+}
+
+void FrameRenderer::set_perf_counters(PerfCounters *countersIn)
+{
+  perfCounters = countersIn;
+}
+
+PerfCounters *FrameRenderer::get_perf_counters() const
+{
+  return perfCounters;
+}
+
+void FrameRenderer::set_interior_hint(const vector<unsigned char> *hintIn)
+{
+  interiorHint = hintIn;
+}
+
+void FrameRenderer::set_symmetry(bool symmetryIn)
+{
+  symmetry = symmetryIn;
+}
+
+void FrameRenderer::set_band_height(int bandHeightIn)
+{
+  bandHeight = max(1, bandHeightIn);
+}
+
+void FrameRenderer::set_equalizer(EqualizedColoring *equalizerIn)
+{
+  equalizer = equalizerIn;
+}
+
+EqualizedColoring *FrameRenderer::get_equalizer() const
+{
+  return equalizer;
+}
+
+void FrameRenderer::set_task_options(const ThreadPool::TaskOptions &optionsIn)
+{
+  taskOptions = optionsIn;
+}
+
+int FrameRenderer::get_band_height() const
+{
+  return bandHeight;
+}
+
+int FrameRenderer::get_width() const
+{
+  return width;
+}
+
+int FrameRenderer::get_height() const
+{
+  return height;
+}
+
+void FrameRenderer::setup(Mandelbrot &gigabrot) const
+{
+  // reference orbits are orbits of the Mandelbrot formula
+  const ReferenceOrbit *reference = (formula == Mandelbrot::Formula::Mandelbrot) ? orbit : nullptr;
+  if (reference != nullptr)
+  {
+    // plane relative to the orbit center
+    gigabrot.set_plane(real(offset) - 0.5 * view.spanRe, real(offset) + 0.5 * view.spanRe,
+                       imag(offset) - 0.5 * view.spanIm, imag(offset) + 0.5 * view.spanIm);
+  } else {
+    gigabrot.set_plane(view.cx_min(), view.cx_max(), view.cy_min(), view.cy_max());
+  }
+  gigabrot.set_reference(reference);
+  gigabrot.set_bla((reference != nullptr) ? bla : nullptr);
+  gigabrot.set_formula(formula, degree);
+  gigabrot.set_julia_c(juliaC);
+  gigabrot.set_iterMax(iterMax);
+  gigabrot.set_stripe_density(stripeDensity);
+  gigabrot.set_iSkip(iSkip);
+  gigabrot.set_border(thin);
+  gigabrot.set_symmetry(symmetry);
+  gigabrot.set_cancellation(taskOptions.token ? &*taskOptions.token : nullptr);
+}
+
+double FrameRenderer::render_pixel(Mandelbrot &gigabrot, int pX, int pY, bool knownExterior,
+                                   unsigned char *rgb, int *iterations, unsigned char *mirrorRgb,
+                                   int *mirrorIterations, BandSamples *samples, size_t pixel,
+                                   ptrdiff_t mirrorPixel) const
+{
+  if (knownExterior)
+  {
+    gigabrot.set_periodicity(false);
+  } else if (interiorHint != nullptr) {
+    gigabrot.set_periodicity((*interiorHint)[static_cast<size_t>(pY) * width + pX] != 0);
+  }
+  gigabrot.set_known_exterior(knownExterior);
+  gigabrot.current_pixel(pX, pY);
+  {
+    PerfCounters::Scope kernel(perfCounters, PerfCounters::Stage::Iterate, 1);
+    gigabrot.get_c();
+    gigabrot.iterate();
+  }
+  {
+    PerfCounters::Scope kernel(perfCounters, PerfCounters::Stage::Colorize,
+                               (mirrorRgb != nullptr) ? 2 : 1);
+    rgb[2] = rgb[1] = rgb[0] = gigabrot.colorize_bw();
+    if (mirrorRgb != nullptr)
+    {
+      mirrorRgb[2] = mirrorRgb[1] = mirrorRgb[0] = gigabrot.colorize_bw_conjugate();
+    }
+  }
+  if (iterations != nullptr)
+  {
+    *iterations = gigabrot.get_iter();
+  }
+  if (mirrorIterations != nullptr)
+  {
+    *mirrorIterations = gigabrot.get_iter();
+  }
+  if (samples != nullptr)
+  {
+    // inside and border pixels keep their fixed colors and stay out of the histograms
+    double average = gigabrot.get_average();
+    bool striped = average > 0.0;
+    double smoothIter = striped ? gigabrot.get_smooth_iter() : 0.0;
+    double distance = striped ? gigabrot.get_distance() * width / view.spanRe : 0.0;
+    samples->samples[pixel] = {static_cast<float>(average),
+                               striped ? static_cast<float>(gigabrot.get_reflection(false)) : 0.F};
+    if (striped)
+    {
+      samples->histograms.add(average, smoothIter, distance);
+    }
+    if (mirrorPixel >= 0)
+    {
+      double mirrorAverage = striped ? 1.0 - average : average;
+      samples->mirrorSamples[mirrorPixel] = {
+          static_cast<float>(mirrorAverage),
+          striped ? static_cast<float>(gigabrot.get_reflection(true)) : 0.F};
+      if (striped)
+      {
+        samples->histograms.add(mirrorAverage, smoothIter, distance);
+      }
+    }
+  }
+  double radius = gigabrot.get_exterior_radius() * width / view.spanRe;
+  gigabrot.reset();
+  return radius;
+}
+
+void FrameRenderer::render_row(Mandelbrot &gigabrot, int pY, unsigned char *rgb, int *iterations,
+                               unsigned char *mirrorRgb, int *mirrorIterations,
+                               BandSamples *samples, size_t pixel, ptrdiff_t mirrorPixel) const
+{
+  for (int pX = 0; pX < width; pX++)
+  {
+    size_t subPixel = 3 * static_cast<size_t>(pX);
+    render_pixel(gigabrot, pX, pY, false, rgb + subPixel,
+                 (iterations != nullptr) ? iterations + pX : nullptr,
+                 (mirrorRgb != nullptr) ? mirrorRgb + subPixel : nullptr,
+                 (mirrorIterations != nullptr) ? mirrorIterations + pX : nullptr, samples,
+                 pixel + pX, (mirrorRgb != nullptr) ? mirrorPixel + pX : -1);
+  }
+  iteratedPixels.fetch_add(static_cast<uint64_t>(width), memory_order_relaxed);
+}
+
+void FrameRenderer::render_rows(int rowBegin, int rowEnd, unsigned char *rgb, int *iterations)
+const
+{
+  Mandelbrot gigabrot(width, height);
+  setup(gigabrot);
+  PerfCounters::Scope stage(perfCounters, PerfCounters::Stage::Band,
+                            static_cast<uint64_t>(rowEnd - rowBegin) * width);
+  Tracer::Span span("band", "render", rowBegin);
+
+  for (int pY = rowBegin; pY < rowEnd && !gigabrot.cancelled(); pY++)
+  {
+    size_t pixel = static_cast<size_t>(pY - rowBegin) * width;
+    render_row(gigabrot, pY, rgb + 3 * pixel, (iterations != nullptr) ? iterations + pixel : nullptr,
+               nullptr, nullptr, nullptr, 0, -1);
+  }
+  gigabrot.flush_bla_counts();
+  iterationCount.fetch_add(gigabrot.get_iterations_run(), memory_order_relaxed);
+}
+
+FrameRenderer::BandRows FrameRenderer::band_rows(int rowBegin, int rowEnd) const
+{
+  Mandelbrot gigabrot(width, height);
+  setup(gigabrot);
+
+  // iterated rows of a band are contiguous, and so are the rows reflected from them
+  BandRows rows{-1, -1, height, -1};
+  for (int pY = rowBegin; pY < rowEnd; pY++)
+  {
+    if (gigabrot.reflected_row(pY))
+    {
+      continue; // written along with its mirror row
+    }
+    rows.first = (rows.first < 0) ? pY : rows.first;
+    rows.last = pY;
+    int mirror = gigabrot.mirror_row(pY);
+    if (mirror >= 0)
+    {
+      rows.mirrorFirst = min(rows.mirrorFirst, mirror);
+      rows.mirrorLast = max(rows.mirrorLast, mirror);
+    }
+  }
+  return rows;
+}
+
+void FrameRenderer::render_band(const BandRows &rows, unsigned char *rgb, int *iterations,
+                                unsigned char *mirrorRgb, int *mirrorIterations) const
+{
+  Mandelbrot gigabrot(width, height);
+  setup(gigabrot);
+
+  BandSamples bandSamples;
+  BandSamples *samples = nullptr;
+  int count = rows.last - rows.first + 1;
+  int mirrorCount = (rows.mirrorLast >= 0 && mirrorRgb != nullptr)
+                    ? rows.mirrorLast - rows.mirrorFirst + 1 : 0;
+  if (equalizer != nullptr && rows.first >= 0)
+  {
+    bandSamples.samples.resize(static_cast<size_t>(count) * width);
+    bandSamples.mirrorSamples.resize(static_cast<size_t>(mirrorCount) * width);
+    samples = &bandSamples;
+  }
+  PerfCounters::Scope stage(perfCounters, PerfCounters::Stage::Band,
+                            (rows.first >= 0) ? static_cast<uint64_t>(count + mirrorCount) * width
+                                              : 0);
+  Tracer::Span span("band", "render", rows.first);
+
+  if (exteriorFill != ExteriorFill::Off && rows.first >= 0)
+  {
+    render_band_filled(gigabrot, rows, rgb, iterations, mirrorRgb, mirrorIterations, samples);
+  } else {
+    render_band_rows(gigabrot, rows, rgb, iterations, mirrorRgb, mirrorIterations, samples);
+  }
+  gigabrot.flush_bla_counts();
+  iterationCount.fetch_add(gigabrot.get_iterations_run(), memory_order_relaxed);
+
+  if (samples != nullptr)
+  {
+    equalizer->store(rows.first, count, samples->samples.data());
+    if (mirrorCount > 0)
+    {
+      equalizer->store(rows.mirrorFirst, mirrorCount, samples->mirrorSamples.data());
+    }
+    equalizer->merge(samples->histograms);
+  }
+}
+
+void FrameRenderer::render_band_rows(Mandelbrot &gigabrot, const BandRows &rows,
+                                     unsigned char *rgb, int *iterations,
+                                     unsigned char *mirrorRgb, int *mirrorIterations,
+                                     BandSamples *samples) const
+{
+  for (int pY = rows.first; pY >= 0 && pY <= rows.last && !gigabrot.cancelled(); pY++)
+  {
+    size_t pixel = static_cast<size_t>(pY - rows.first) * width;
+    int mirror = gigabrot.mirror_row(pY);
+    size_t mirrorPixel = static_cast<size_t>(mirror - rows.mirrorFirst) * width;
+    bool reflect = mirror >= 0 && mirrorRgb != nullptr;
+    render_row(gigabrot, pY, rgb + 3 * pixel, (iterations != nullptr) ? iterations + pixel : nullptr,
+               reflect ? mirrorRgb + 3 * mirrorPixel : nullptr,
+               (reflect && mirrorIterations != nullptr) ? mirrorIterations + mirrorPixel : nullptr,
+               samples, pixel, static_cast<ptrdiff_t>(mirrorPixel));
+  }
+}
+
+namespace
+{
+
+/**
+ * @param first
+ * @param last
+ * @param step
+ * @return first, first + step, ... and last
+ */
+vector<int> grid_lines(int first, int last, int step)
+{
+  vector<int> lines;
+  for (int line = first; line < last; line += step)
+  {
+    lines.push_back(line);
+  }
+  lines.push_back(last);
+  return lines;
+}
+
+} // namespace
+
+void FrameRenderer::render_band_filled(Mandelbrot &gigabrot, const BandRows &rows,
+                                       unsigned char *rgb, int *iterations,
+                                       unsigned char *mirrorRgb, int *mirrorIterations,
+                                       BandSamples *samples) const
+{
+  int count = rows.last - rows.first + 1;
+  vector<unsigned char> done(static_cast<size_t>(count) * width, 0);
+  vector<double> radius(done.size(), 0.0);
+
+  // where a pixel of the band, and its reflection, go
+  auto index = [&](int pX, int pY) {return static_cast<size_t>(pY - rows.first) * width + pX;};
+  auto mirror_index = [&](int pX, int pY)
+  {
+    int mirror = (mirrorRgb != nullptr) ? gigabrot.mirror_row(pY) : -1;
+    return (mirror >= 0) ? static_cast<ptrdiff_t>(mirror - rows.mirrorFirst) * width + pX : -1;
+  };
+  auto render = [&](int pX, int pY, bool knownExterior)
+  {
+    size_t pixel = index(pX, pY);
+    ptrdiff_t mirrorPixel = mirror_index(pX, pY);
+    radius[pixel] = render_pixel(gigabrot, pX, pY, knownExterior, rgb + 3 * pixel,
+                                 (iterations != nullptr) ? iterations + pixel : nullptr,
+                                 (mirrorPixel >= 0) ? mirrorRgb + 3 * mirrorPixel : nullptr,
+                                 (mirrorPixel >= 0 && mirrorIterations != nullptr)
+                                 ? mirrorIterations + mirrorPixel : nullptr, samples, pixel,
+                                 mirrorPixel);
+    done[pixel] = 1;
+  };
+
+  // block corners first
+  vector<int> gridRows = grid_lines(rows.first, rows.last, fillBlock);
+  vector<int> gridColumns = grid_lines(0, width - 1, fillBlock);
+  for (int pY : gridRows)
+  {
+    for (int pX : gridColumns)
+    {
+      render(pX, pY, false);
+    }
+  }
+  uint64_t iterated = gridRows.size() * gridColumns.size();
+  uint64_t exterior = 0;
+  uint64_t estimated = 0;
+
+  for (size_t i = 0; i + 1 < gridRows.size(); i++)
+  {
+    int y0 = gridRows[i];
+    int y1 = gridRows[i + 1];
+    for (size_t j = 0; j + 1 < gridColumns.size(); j++)
+    {
+      int x0 = gridColumns[j];
+      int x1 = gridColumns[j + 1];
+      double r00 = radius[index(x0, y0)];
+      double r01 = radius[index(x1, y0)];
+      double r10 = radius[index(x0, y1)];
+      double r11 = radius[index(x1, y1)];
+
+      // one corner's disk (in pixels) covers the whole block: no set point, so no border either
+      bool knownExterior = min({r00, r01, r10, r11}) > 0.0
+          && max({r00, r01, r10, r11}) >= hypot(x1 - x0, y1 - y0);
+      bool estimate = knownExterior && exteriorFill == ExteriorFill::Estimate && samples == nullptr
+          && (mirrorRgb == nullptr
+              || (mirror_index(x0, y0) >= 0) == (mirror_index(x0, y1) >= 0));
+
+      for (int pY = y0; pY <= y1; pY++)
+      {
+        for (int pX = x0; pX <= x1; pX++)
+        {
+          size_t pixel = index(pX, pY);
+          if (done[pixel])
+          {
+            continue;
+          }
+          ptrdiff_t mirrorPixel = mirror_index(pX, pY);
+          if (!estimate || (mirrorPixel >= 0) != (mirror_index(x0, y0) >= 0))
+          {
+            render(pX, pY, knownExterior);
+            (knownExterior ? exterior : iterated)++;
+            continue;
+          }
+
+          // bilinear from the corners
+          double u = static_cast<double>(pX - x0) / (x1 - x0);
+          double v = (y1 > y0) ? static_cast<double>(pY - y0) / (y1 - y0) : 0.0;
+          auto blend = [&](double c00, double c01, double c10, double c11)
+          {
+            return (1.0 - v) * ((1.0 - u) * c00 + u * c01) + v * ((1.0 - u) * c10 + u * c11);
+          };
+          auto sample = [&](const unsigned char *image, auto at)
+          {
+            return static_cast<unsigned char>(lround(blend(image[3 * at(x0, y0)],
+                                                           image[3 * at(x1, y0)],
+                                                           image[3 * at(x0, y1)],
+                                                           image[3 * at(x1, y1)])));
+          };
+          rgb[3 * pixel + 2] = rgb[3 * pixel + 1] = rgb[3 * pixel] = sample(rgb, index);
+          if (iterations != nullptr)
+          {
+            iterations[pixel] = static_cast<int>(lround(blend(
+                iterations[index(x0, y0)], iterations[index(x1, y0)],
+                iterations[index(x0, y1)], iterations[index(x1, y1)])));
+          }
+          if (mirrorPixel >= 0)
+          {
+            mirrorRgb[3 * mirrorPixel + 2] = mirrorRgb[3 * mirrorPixel + 1] =
+                mirrorRgb[3 * mirrorPixel] = sample(mirrorRgb, mirror_index);
+            if (mirrorIterations != nullptr)
+            {
+              mirrorIterations[mirrorPixel] = iterations[pixel];
+            }
+          }
+          done[pixel] = 1;
+          estimated++;
+        }
+      }
+    }
+  }
+
+  // a single-column image has no blocks
+  for (int pY = rows.first; pY <= rows.last; pY++)
+  {
+    for (int pX = 0; pX < width; pX++)
+    {
+      if (!done[index(pX, pY)])
+      {
+        render(pX, pY, false);
+        iterated++;
+      }
+    }
+  }
+
+  iteratedPixels.fetch_add(iterated, memory_order_relaxed);
+  exteriorPixels.fetch_add(exterior, memory_order_relaxed);
+  estimatedPixels.fetch_add(estimated, memory_order_relaxed);
+}
+
+void FrameRenderer::render_frame_band(int rowBegin, int rowEnd, vector<unsigned char> &rgb,
+                                      vector<int> &iterations) const
+{
+  BandRows rows = band_rows(rowBegin, rowEnd);
+  if (rows.first < 0)
+  {
+    return; // reflected by other bands
+  }
+  size_t pixel = static_cast<size_t>(rows.first) * width;
+  size_t mirrorPixel = static_cast<size_t>(max(0, rows.mirrorFirst)) * width;
+  render_band(rows, &rgb[3 * pixel], &iterations[pixel], &rgb[3 * mirrorPixel],
+              &iterations[mirrorPixel]);
+}
+
+void FrameRenderer::render(ThreadPool &pool, vector<unsigned char> &rgb, vector<int> &iterations)
+const
+{
+  vector<future<void>> bands = render_async(pool, rgb, iterations);
+  for (auto &band : bands)
+  {
+    band.wait();
+  }
+  if (taskOptions.token && taskOptions.token->cancelled())
+  {
+    return; // dropped bands have no result
+  }
+  for (auto &band : bands)
+  {
+    band.get(); // rethrows anything a band threw
+  }
+  if (equalizer != nullptr)
+  {
+    color_equalized(pool, rgb);
+  }
+}
+
+void FrameRenderer::render(const ExecutionBackend &backend, vector<unsigned char> &rgb,
+                           vector<int> &iterations) const
+{
+  size_for_bands(rgb, static_cast<size_t>(width) * height * 3);
+  size_for_bands(iterations, static_cast<size_t>(width) * height);
+  if (equalizer != nullptr)
+  {
+    equalizer->begin();
+  }
+
+  size_t bands = static_cast<size_t>((height + bandHeight - 1) / bandHeight);
+  backend.for_each(bands, [this, &rgb, &iterations](size_t band)
+                   {
+                     int rowBegin = static_cast<int>(band) * bandHeight;
+                     render_frame_band(rowBegin, min(height, rowBegin + bandHeight), rgb,
+                                       iterations);
+                   });
+  if ((taskOptions.token && taskOptions.token->cancelled()) || equalizer == nullptr)
+  {
+    return;
+  }
+
+  equalizer->finalize();
+  backend.for_each(bands, [this, &rgb](size_t band)
+                   {
+                     int rowBegin = static_cast<int>(band) * bandHeight;
+                     int rows = min(height - rowBegin, bandHeight);
+                     PerfCounters::Scope stage(perfCounters, PerfCounters::Stage::Color,
+                                               static_cast<uint64_t>(rows) * width);
+                     Tracer::Span span("color band", "render", rowBegin);
+                     equalizer->color_rows(rowBegin, rows,
+                                           &rgb[3 * static_cast<size_t>(rowBegin) * width]);
+                   });
+}
+
+void FrameRenderer::color_equalized(ThreadPool &pool, vector<unsigned char> &rgb) const
+{
+  equalizer->finalize();
+  TaskGroup bands(pool, taskOptions);
+  for (int rowBegin = 0; rowBegin < height; rowBegin += bandHeight)
+  {
+    int rows = min(height - rowBegin, bandHeight);
+    unsigned char *band = &rgb[3 * static_cast<size_t>(rowBegin) * width];
+    bands.run([this, rowBegin, rows, band]()
+              {
+                PerfCounters::Scope stage(perfCounters, PerfCounters::Stage::Color,
+                                          static_cast<uint64_t>(rows) * width);
+                Tracer::Span span("color band", "render", rowBegin);
+                equalizer->color_rows(rowBegin, rows, band);
+              });
+  }
+  bands.wait(); // rethrows anything a band threw; cancelled bands are simply dropped
+}
+
+vector<future<void>> FrameRenderer::render_async(ThreadPool &pool, vector<unsigned char> &rgb,
+                                                 vector<int> &iterations) const
+{
+  size_for_bands(rgb, static_cast<size_t>(width) * height * 3);
+  size_for_bands(iterations, static_cast<size_t>(width) * height);
+  if (equalizer != nullptr)
+  {
+    equalizer->begin();
+  }
+
+  vector<CostModel::Band> plan;
+  shared_ptr<CostModel::Timing> timing;
+  if (costModel != nullptr)
+  {
+    plan = costModel->plan(*this, pool, static_cast<size_t>((height + bandHeight - 1) / bandHeight));
+    timing = costModel->time(*this, plan);
+  } else {
+    for (int rowBegin = 0; rowBegin < height; rowBegin += bandHeight)
+    {
+      plan.push_back({rowBegin, min(height, rowBegin + bandHeight), 0.0});
+    }
+  }
+
+  // queued as one batch, so a short render does not pay a lock and a wakeup per band
+  vector<future<void>> bands;
+  vector<ThreadPool::process> work;
+  for (size_t index = 0; index < plan.size(); index++)
+  {
+    int rowBegin = plan[index].rowBegin;
+    int rowEnd = plan[index].rowEnd;
+    auto [band, done] = ThreadPool::package_task([this, rowBegin, rowEnd, &rgb, &iterations,
+                                                  timing, index]()
+                                                 {
+                                                   auto begin = chrono::steady_clock::now();
+                                                   render_frame_band(rowBegin, rowEnd, rgb,
+                                                                     iterations);
+                                                   // a cancelled band stopped early
+                                                   if (timing && !(taskOptions.token
+                                                       && taskOptions.token->cancelled()))
+                                                   {
+                                                     chrono::duration<double> seconds =
+                                                         chrono::steady_clock::now() - begin;
+                                                     timing->finish(index, seconds.count());
+                                                   }
+                                                 });
+    work.push_back(std::move(band));
+    bands.push_back(std::move(done));
+  }
+  pool.enqueue_bulk_with(taskOptions, std::move(work));
+  return bands;
+}
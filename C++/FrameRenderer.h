@@ -0,0 +1,403 @@
+#ifndef C____FRAMERENDERER_H_
+#define C____FRAMERENDERER_H_
+
+#include "BLATable.h"
+#include "EqualizedColoring.h"
+#include "ExecutionBackend.h"
+#include "Mandelbrot.h"
+#include "PerfCounters.h"
+#include "ReferenceOrbit.h"
+#include "ThreadPool.h"
+#include "View.h"
+
+#include <atomic>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+class CostModel;
+
+/**
+ * Renders a whole image, or any band of its rows, with one Mandelbrot per band so that bands
+ * can be computed concurrently on a ThreadPool
+ */
+class FrameRenderer
+{
+ public:
+
+  /**
+   * Default parametrized constructor
+   * @param width - image width
+   * @param height - image height
+   */
+  FrameRenderer(int width, int height);
+
+  void set_view(const View &viewIn);
+
+  View get_view() const;
+
+  void set_iterMax(int iterMaxIn);
+
+  int get_iterMax() const;
+
+  void set_stripe_density(double stripeDensityIn);
+
+  double get_stripe_density() const;
+
+  void set_iSkip(int iSkipIn);
+
+  void set_border(int thinIn);
+
+  /**
+   * Render through perturbation against a shared reference orbit
+   * @param orbitIn - nullptr for direct iteration
+   * @param offsetIn - view center minus orbit center, kept separately so that it does not round
+   * away at deep zooms
+   */
+  void set_reference(const ReferenceOrbit *orbitIn, std::complex<double> offsetIn);
+
+  /**
+   * Skip iterations of perturbed pixels, see Mandelbrot::set_bla()
+   * @param blaIn - built for this view and the reference orbit, nullptr for none
+   */
+  void set_bla(const BLATable *blaIn);
+
+  /**
+   * @return largest offset of a pixel from the reference orbit center, for building a BLATable
+   */
+  double max_reference_offset() const;
+
+  /**
+   * @param formulaIn - see Mandelbrot::set_formula(); reference orbits and BLA tables are only
+   * used by the Mandelbrot formula
+   * @param degreeIn
+   */
+  void set_formula(Mandelbrot::Formula formulaIn, int degreeIn = 2);
+
+  Mandelbrot::Formula get_formula() const;
+
+  int get_degree() const;
+
+  void set_julia_c(std::complex<double> juliaCIn);
+
+  std::complex<double> get_julia_c() const;
+
+  /**
+   * How pixels inside a disk that a neighbor's distance estimate proves free of the set are
+   * rendered. Bands are then rendered as blocks: the corners are iterated first, and a block
+   * wholly inside one corner's disk is known exterior
+   */
+  enum class ExteriorFill
+  {
+    Off,     // iterate every pixel in full
+    Exact,   // iterate known exterior pixels without the interior tests
+    Estimate // interpolate known exterior pixels from the block corners
+  };
+
+  /**
+   * @param fillIn
+   * @param blockIn - block size in pixels
+   */
+  void set_exterior_fill(ExteriorFill fillIn, int blockIn = 4);
+
+  /**
+   * Pixels rendered each way since the renderer was made
+   */
+  struct FillCounts
+  {
+    std::uint64_t iterated;
+
+    std::uint64_t exterior;
+
+    std::uint64_t estimated;
+  };
+
+  FillCounts get_fill_counts() const;
+
+  /**
+   * @return iterations run since the renderer was made, see Mandelbrot::get_iterations_run()
+   */
+  std::uint64_t get_iteration_count() const;
+
+  /**
+   * Color by histogram equalization: bands store their samples and histograms in the coloring
+   * as they finish, and render() colors the image from them once every band is done. Exterior
+   * estimation iterates the pixels instead, as they would have no samples
+   * @param equalizerIn - must outlive the renders, nullptr for linear coloring
+   */
+  void set_equalizer(EqualizedColoring *equalizerIn);
+
+  EqualizedColoring *get_equalizer() const;
+
+  /**
+   * Priority and cancellation of the bands render() queues. Bands poll the token between rows
+   * and their pixels every Mandelbrot::cancelCheckInterval iterations, so a cancelled render
+   * stops within about a row's worth of work
+   * @param optionsIn
+   */
+  void set_task_options(const ThreadPool::TaskOptions &optionsIn);
+
+  /**
+   * Count hardware events around the iterate and colorize kernels of every pixel, around every
+   * band and around the coloring of equalized bands
+   * @param countersIn - must outlive the renders, nullptr for no counting
+   */
+  void set_perf_counters(PerfCounters *countersIn);
+
+  PerfCounters *get_perf_counters() const;
+
+  /**
+   * Per-pixel flags of pixels expected to be inside the set; these get periodicity checking
+   * @param hintIn - width * height flags, nullptr for none
+   */
+  void set_interior_hint(const std::vector<unsigned char> *hintIn);
+
+  /**
+   * Reflect rows from their mirror when the view straddles the real axis, see render()
+   * @param symmetryIn
+   */
+  void set_symmetry(bool symmetryIn);
+
+  /**
+   * Cut render() into bands of about equal estimated cost, most expensive first, instead of
+   * bands of equal height; the bands' times are kept in the model for later nearby views
+   * @param costModelIn - must outlive the renders, nullptr for bands of equal height
+   */
+  void set_cost_model(CostModel *costModelIn);
+
+  CostModel *get_cost_model() const;
+
+  /**
+   * @param bandHeightIn - rows per task in render(), on average with a cost model
+   */
+  void set_band_height(int bandHeightIn);
+
+  int get_band_height() const;
+
+  int get_width() const;
+
+  int get_height() const;
+
+  /**
+   * Render rows [rowBegin, rowEnd) on the calling thread
+   * @param rowBegin
+   * @param rowEnd
+   * @param rgb - pixel data of the band, starting at rowBegin
+   * @param iterations - iteration counts of the band, starting at rowBegin; may be nullptr
+   */
+  void render_rows(int rowBegin, int rowEnd, unsigned char *rgb, int *iterations) const;
+
+  /**
+   * Rows of a band that are iterated, and the rows reflected from them; either range is empty
+   * when its last row is -1. Both ranges are contiguous
+   */
+  struct BandRows
+  {
+    int first;
+
+    int last;
+
+    int mirrorFirst;
+
+    int mirrorLast;
+  };
+
+  /**
+   * @param rowBegin
+   * @param rowEnd
+   * @return rows of [rowBegin, rowEnd) to iterate, and where their reflections go
+   */
+  BandRows band_rows(int rowBegin, int rowEnd) const;
+
+  /**
+   * Render the iterated rows of a band on the calling thread, and their reflections
+   * @param rows - from band_rows()
+   * @param rgb - pixel data of rows first ... last
+   * @param iterations - iteration counts of rows first ... last, may be nullptr
+   * @param mirrorRgb - pixel data of rows mirrorFirst ... mirrorLast, may be nullptr if there
+   * are none
+   * @param mirrorIterations - may be nullptr
+   */
+  void render_band(const BandRows &rows, unsigned char *rgb, int *iterations,
+                   unsigned char *mirrorRgb, int *mirrorIterations) const;
+
+  /**
+   * Render the whole image as bands on the pool, returns once every band is done. With symmetry
+   * on, only the larger half of a view straddling the real axis is iterated and the other half is
+   * reflected from it. With an equalizer, the image is then colored from the samples. Once the
+   * task options' token is cancelled, returns as soon as the running bands have stopped, leaving
+   * the image unfinished
+   * @param pool
+   * @param rgb - resized to the full image
+   * @param iterations - resized to one count per pixel
+   */
+  void render(ThreadPool &pool, std::vector<unsigned char> &rgb, std::vector<int> &iterations)
+  const;
+
+  /**
+   * render() on any execution backend, for comparing them: bands of equal height go through
+   * ExecutionBackend::for_each(), and so does the coloring of an equalizer. The cost model is
+   * not used
+   * @param backend
+   * @param rgb - resized to the full image
+   * @param iterations - resized to one count per pixel
+   */
+  void render(const ExecutionBackend &backend, std::vector<unsigned char> &rgb,
+              std::vector<int> &iterations) const;
+
+  /**
+   * Queue the bands of render() on the pool without waiting for them. The renderer, any
+   * reference orbit and both buffers must outlive the returned futures. With an equalizer the
+   * image is colored linearly until color_equalized() runs
+   * @param pool
+   * @param rgb - resized to the full image
+   * @param iterations - resized to one count per pixel
+   * @return one future per band, rethrowing anything the band threw; bands dropped by
+   * cancellation throw std::future_error
+   */
+  std::vector<std::future<void>> render_async(ThreadPool &pool, std::vector<unsigned char> &rgb,
+                                              std::vector<int> &iterations) const;
+
+  /**
+   * Second pass of equalized coloring, once every band of the first pass is done
+   * @param pool
+   * @param rgb - full image
+   */
+  void color_equalized(ThreadPool &pool, std::vector<unsigned char> &rgb) const;
+
+  /**
+   * Apply the render parameters to a fresh Mandelbrot, for callers that pick their own pixels
+   * @param gigabrot
+   */
+  void setup(Mandelbrot &gigabrot) const;
+
+ private:
+
+  /**
+   * First-pass output of equalized coloring for the rows of a band and their reflections
+   */
+  struct BandSamples
+  {
+    EqualizedColoring::Histograms histograms;
+
+    std::vector<EqualizedColoring::Sample> samples;
+
+    std::vector<EqualizedColoring::Sample> mirrorSamples;
+  };
+
+  /**
+   * Render one pixel, and optionally its mirror pixel from the same iterations
+   * @param gigabrot - set up by setup()
+   * @param pX
+   * @param pY
+   * @param knownExterior - pixel is proven outside the set
+   * @param rgb - the pixel's pixel data
+   * @param iterations - the pixel's iteration count, may be nullptr
+   * @param mirrorRgb - pixel data of the mirror pixel, nullptr for none
+   * @param mirrorIterations - iteration count of the mirror pixel, nullptr for none
+   * @param samples - first-pass output of the band, nullptr without an equalizer
+   * @param pixel - of the pixel within the band's samples
+   * @param mirrorPixel - of the mirror pixel within the band's mirror samples, -1 for none
+   * @return radius of the set-free disk around the pixel, in pixels
+   */
+  double render_pixel(Mandelbrot &gigabrot, int pX, int pY, bool knownExterior,
+                      unsigned char *rgb, int *iterations, unsigned char *mirrorRgb,
+                      int *mirrorIterations, BandSamples *samples, std::size_t pixel,
+                      std::ptrdiff_t mirrorPixel) const;
+
+  /**
+   * render_band() row by row
+   */
+  void render_band_rows(Mandelbrot &gigabrot, const BandRows &rows, unsigned char *rgb,
+                        int *iterations, unsigned char *mirrorRgb, int *mirrorIterations,
+                        BandSamples *samples) const;
+
+  /**
+   * render_band() with exterior filling, see set_exterior_fill()
+   */
+  void render_band_filled(Mandelbrot &gigabrot, const BandRows &rows, unsigned char *rgb,
+                          int *iterations, unsigned char *mirrorRgb, int *mirrorIterations,
+                          BandSamples *samples) const;
+
+  /**
+   * Render one row, and optionally its mirror row from the same iterations
+   * @param gigabrot - set up by setup()
+   * @param pY
+   * @param rgb - pixel data of row pY
+   * @param iterations - iteration counts of row pY, may be nullptr
+   * @param mirrorRgb - pixel data of the mirror row, nullptr for none
+   * @param mirrorIterations - iteration counts of the mirror row, nullptr for none
+   * @param samples - first-pass output of the band, nullptr without an equalizer
+   * @param pixel - of the row's first pixel within the band's samples
+   * @param mirrorPixel - of the mirror row's first pixel within the band's mirror samples
+   */
+  void render_row(Mandelbrot &gigabrot, int pY, unsigned char *rgb, int *iterations,
+                  unsigned char *mirrorRgb, int *mirrorIterations, BandSamples *samples,
+                  std::size_t pixel, std::ptrdiff_t mirrorPixel) const;
+
+  /**
+   * Render rows [rowBegin, rowEnd) into full image buffers, reflections included
+   * @param rowBegin
+   * @param rowEnd
+   * @param rgb - full image
+   * @param iterations - full image
+   */
+  void render_frame_band(int rowBegin, int rowEnd, std::vector<unsigned char> &rgb,
+                         std::vector<int> &iterations) const;
+
+  int width;
+
+  int height;
+
+  View view;
+
+  int iterMax;
+
+  double stripeDensity;
+
+  int iSkip;
+
+  int thin;
+
+  const ReferenceOrbit *orbit;
+
+  std::complex<double> offset;
+
+  const BLATable *bla;
+
+  const std::vector<unsigned char> *interiorHint;
+
+  int bandHeight;
+
+  bool symmetry;
+
+  Mandelbrot::Formula formula;
+
+  int degree;
+
+  std::complex<double> juliaC;
+
+  ExteriorFill exteriorFill;
+
+  int fillBlock;
+
+  EqualizedColoring *equalizer;
+
+  ThreadPool::TaskOptions taskOptions;
+
+  mutable std::atomic<std::uint64_t> iteratedPixels;
+
+  mutable std::atomic<std::uint64_t> exteriorPixels;
+
+  mutable std::atomic<std::uint64_t> estimatedPixels;
+
+  mutable std::atomic<std::uint64_t> iterationCount;
+
+  PerfCounters *perfCounters;
+
+  CostModel *costModel;
+};
+
+#endif //C____FRAMERENDERER_H_
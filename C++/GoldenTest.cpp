@@ -0,0 +1,358 @@
+#include "BLATable.h"
+#include "BandScheduler.h"
+#include "EqualizedColoring.h"
+#include "FrameRenderer.h"
+#include "PPM.h"
+#include "ReferenceOrbit.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Golden-image regression test: renders a fixed set of small views with the plain render path
+ * and with each fast path, and compares them to the stored golden images. A pixel mismatches
+ * when it is off by more than the check's tolerance; a check fails when too many pixels
+ * mismatch. Usage: GoldenTest goldenDir [--update], --update rewrites the golden images from the
+ * plain render path. Also checks that streaming an equalized image stays within its memory budget,
+ * and that submitting work to a warm pool does not allocate
+ */
+
+namespace
+{
+
+/**
+ * heap allocations by any thread, counted by the replaced operator new
+ */
+atomic<uint64_t> allocations{0};
+
+} // namespace
+
+void *operator new(size_t size)
+{
+  allocations.fetch_add(1, memory_order_relaxed);
+  if (void *block = malloc(size == 0 ? 1 : size))
+  {
+    return block;
+  }
+  throw bad_alloc();
+}
+
+void operator delete(void *block) noexcept
+{
+  free(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+  free(block);
+}
+
+namespace
+{
+
+const int width = 160;
+
+const int height = 120;
+
+/**
+ * View rendered for the test
+ */
+struct Case
+{
+  string name;
+
+  View view;
+
+  int iterMax;
+
+  /**
+   * render relative to a reference orbit at the view center
+   */
+  bool perturbed;
+};
+
+/**
+ * Render path compared to the golden image
+ */
+struct Check
+{
+  string name;
+
+  /**
+   * applied to the renderer after the view is set
+   */
+  function<void(FrameRenderer &renderer)> apply;
+
+  /**
+   * build a BLA table for perturbed views
+   */
+  bool bla;
+
+  /**
+   * largest difference of a matching pixel
+   */
+  int tolerance;
+
+  /**
+   * share of pixels that may mismatch, in percent
+   */
+  double maxMismatch;
+};
+
+vector<Case> cases()
+{
+  return {
+      {"full", View::from_plane(-2.2, 0.8, -1.5, 1.5), 1000, false},
+      {"seahorse", View::from_center({-0.7453, 0.1127}, 0.01, width, height), 2000, false},
+      {"antenna", View::from_center({-1.99999911758, 0.0}, 2e-11, width, height), 5000, true},
+      {"interior", View::from_center({-0.25, 0.0}, 1.2, width, height), 1000, false},
+  };
+}
+
+vector<Check> checks()
+{
+  auto none = [](FrameRenderer &) {};
+  return {
+      {"plain", none, false, 2, 0.1},
+      {"fill-exterior",
+       [](FrameRenderer &renderer) {renderer.set_exterior_fill(FrameRenderer::ExteriorFill::Exact);},
+       false, 2, 0.1},
+      {"estimate-exterior",
+       [](FrameRenderer &renderer)
+       {
+         renderer.set_exterior_fill(FrameRenderer::ExteriorFill::Estimate);
+       }, false, 32, 2.0},
+      {"no-symmetry", [](FrameRenderer &renderer) {renderer.set_symmetry(false);}, false, 2, 0.5},
+      {"bla", none, true, 4, 1.0},
+  };
+}
+
+vector<unsigned char> render(ThreadPool &pool, const Case &view, const Check &check)
+{
+  FrameRenderer renderer(width, height);
+  renderer.set_view(view.view);
+  renderer.set_iterMax(view.iterMax);
+  check.apply(renderer);
+
+  unique_ptr<ReferenceOrbit> orbit;
+  unique_ptr<BLATable> bla;
+  if (view.perturbed)
+  {
+    orbit = make_unique<ReferenceOrbit>(view.view.center, view.iterMax);
+    renderer.set_reference(orbit.get(), 0.0);
+    if (check.bla)
+    {
+      bla = make_unique<BLATable>(*orbit, renderer.max_reference_offset(),
+                                  renderer.get_stripe_density());
+      renderer.set_bla(bla.get());
+    }
+  }
+
+  vector<unsigned char> rgb;
+  vector<int> iterations;
+  renderer.render(pool, rgb, iterations);
+  return rgb;
+}
+
+bool read_ppm(const string &path, vector<unsigned char> &rgb)
+{
+  ifstream file(path, ios::binary);
+  string magic;
+  int fileWidth = 0;
+  int fileHeight = 0;
+  int maxValue = 0;
+  file >> magic >> fileWidth >> fileHeight >> maxValue;
+  file.get(); // single whitespace before the pixel data
+  if (!file || magic != "P6" || fileWidth != width || fileHeight != height || maxValue != 255)
+  {
+    return false;
+  }
+  rgb.resize(static_cast<size_t>(width) * height * 3);
+  file.read(reinterpret_cast<char *>(rgb.data()), static_cast<streamsize>(rgb.size()));
+  return static_cast<bool>(file);
+}
+
+bool write_ppm(const string &path, const vector<unsigned char> &rgb)
+{
+  ofstream file(path, ios::binary);
+  file << "P6\n" << width << " " << height << "\n255\n";
+  file.write(reinterpret_cast<const char *>(rgb.data()), static_cast<streamsize>(rgb.size()));
+  return static_cast<bool>(file);
+}
+
+/**
+ * Stream an equalized image through a BandScheduler at budgets from below to well above twice
+ * the size of its samples, which are spilled at the smallest; the peak must stay within budget
+ * @param pool
+ * @return number of budgets exceeded
+ */
+int check_budgets(ThreadPool &pool)
+{
+  const int budgetWidth = 800;
+  const int budgetHeight = 600;
+  int failures = 0;
+  for (double samples : {1.5, 2.5, 4.0, 16.0}) // budget in sizes of the samples
+  {
+    FrameRenderer renderer(budgetWidth, budgetHeight);
+    EqualizedColoring equalizer(budgetWidth, budgetHeight);
+    renderer.set_equalizer(&equalizer);
+    auto budget = static_cast<size_t>(samples * static_cast<double>(equalizer.field_bytes()));
+    BandScheduler scheduler(renderer, budget);
+    PPM pgm("golden_budget.ppm", budgetWidth, budgetHeight);
+    bool written = scheduler.run(pool, pgm);
+    remove(pgm.get_file_name().c_str());
+
+    bool passed = written && scheduler.get_peak_bytes() <= budget;
+    failures += passed ? 0 : 1;
+    cout << "budget/" << samples << "x samples" << (equalizer.spilled() ? " (spilled)" : "")
+         << ": peak " << scheduler.get_peak_bytes() << " of " << budget << " bytes"
+         << (passed ? "" : " - FAILED") << "\n";
+  }
+  return failures;
+}
+
+/**
+ * Submit small tasks to a pool one at a time and as a batch, once to warm its queues and the
+ * TaskArena, then again counting the heap allocations made by any thread meanwhile
+ * @param pool
+ * @return 1 if the warm submissions allocated
+ */
+int check_submit_allocations(ThreadPool &pool)
+{
+  const size_t tasks = 64;
+  atomic<size_t> done{0};
+  auto wait_for = [&pool, &done](size_t target)
+  {
+    while (done.load() < target)
+    {
+      if (!pool.run_pending_task())
+      {
+        this_thread::yield();
+      }
+    }
+  };
+
+  // every queue takes a full round at once, so no later round outgrows it
+  vector<ThreadPool::process> warm;
+  for (size_t i = 0; i < tasks * pool.get_thread_count(); i++)
+  {
+    warm.emplace_back([&done]() {done++;});
+  }
+  pool.enqueue_bulk(std::move(warm));
+  wait_for(tasks * pool.get_thread_count());
+  done = 0;
+
+  vector<ThreadPool::process> batch; // allocated outside the count, it is the caller's
+  batch.reserve(tasks);
+  uint64_t before = allocations.load();
+  for (size_t i = 0; i < tasks; i++)
+  {
+    pool.enqueue_work([&done]() {done++;});
+  }
+  wait_for(tasks);
+  for (size_t i = 0; i < tasks; i++)
+  {
+    batch.emplace_back([&done]() {done++;});
+  }
+  pool.enqueue_bulk(std::move(batch));
+  wait_for(2 * tasks);
+  uint64_t allocated = allocations.load() - before;
+
+  bool passed = allocated == 0;
+  cout << "submit/warm: " << allocated << " allocations for " << 2 * tasks << " tasks"
+       << (passed ? "" : " - FAILED") << "\n";
+  return passed ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    cout << "Usage: " << argv[0] << " goldenDir [--update]\n";
+    return 1;
+  }
+  string directory = argv[1];
+  bool update = argc > 2 && string(argv[2]) == "--update";
+
+  auto begin = chrono::steady_clock::now();
+  ThreadPool pool(max(1U, thread::hardware_concurrency()));
+  int failures = 0;
+
+  for (const Case &view : cases())
+  {
+    string path = directory + "/" + view.name + ".ppm";
+    if (update)
+    {
+      if (!write_ppm(path, render(pool, view, checks().front())))
+      {
+        cout << "Could not write " << path << "\n";
+        return 1;
+      }
+      cout << "Updated " << path << "\n";
+      continue;
+    }
+
+    vector<unsigned char> golden;
+    if (!read_ppm(path, golden))
+    {
+      cout << "Could not read " << path << "\n";
+      failures++;
+      continue;
+    }
+    for (const Check &check : checks())
+    {
+      if (check.bla && !view.perturbed)
+      {
+        continue;
+      }
+      vector<unsigned char> rgb = render(pool, view, check);
+      size_t mismatched = 0;
+      int largest = 0;
+      for (size_t pixel = 0; pixel < rgb.size() / 3; pixel++)
+      {
+        int difference = 0;
+        for (size_t channel = 3 * pixel; channel < 3 * pixel + 3; channel++)
+        {
+          difference = max(difference, abs(static_cast<int>(rgb[channel]) -
+                                           static_cast<int>(golden[channel])));
+        }
+        largest = max(largest, difference);
+        mismatched += (difference > check.tolerance) ? 1 : 0;
+      }
+      double mismatch = 300.0 * static_cast<double>(mismatched) / static_cast<double>(rgb.size());
+      bool passed = mismatch <= check.maxMismatch;
+      failures += passed ? 0 : 1;
+      cout << view.name << "/" << check.name << ": " << mismatch << "% off by more than "
+           << check.tolerance << " (limit " << check.maxMismatch << "%), largest difference "
+           << largest << (passed ? "" : " - FAILED") << "\n";
+    }
+  }
+
+  if (!update)
+  {
+    failures += check_budgets(pool);
+    failures += check_submit_allocations(pool);
+  }
+
+  auto end = chrono::steady_clock::now();
+  cout << failures << " failed in "
+       << static_cast<float>(chrono::duration_cast<chrono::milliseconds>(end - begin).count()) / 1000.F
+       << " sec\n";
+  return (failures == 0) ? 0 : 1;
+}
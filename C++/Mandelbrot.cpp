@@ -1,5 +1,8 @@
 #include "Mandelbrot.h"
 
+#include <stdexcept>
+#include <string>
+
 using namespace std;
 
 Mandelbrot::Mandelbrot(int width, int height) : width(width), height(height)
@@ -30,6 +33,25 @@ Mandelbrot::Mandelbrot(int width, int height) : width(width), height(height)
   iSkip = 1;
   thin = 3;
   shade = nullptr; // avoid calling "new" more than once per pixel
+  orbit = nullptr;
+  dc = 0.0;
+  bla = nullptr;
+  blaSteps = 0;
+  blaSkipped = 0;
+  blaIterations = 0;
+  iterationsRun = 0;
+  symmetry = false;
+  knownExterior = false;
+  cancellation = nullptr;
+  formula = Formula::Mandelbrot;
+  degree = 2;
+  lnDegree = M_LN2;
+  juliaC = 0.0;
+  periodicity = false;
+  periodEpsilon = 0.0;
+  zPeriod = 0.0;
+  periodStep = 0;
+  periodLimit = 8;
 }
 
 Mandelbrot::Mandelbrot(int pX, int pY, int width, int height) : pX(pX), pY(pY), width(width),
@@ -59,6 +81,25 @@ height(height)
   iSkip = 1;
   thin = 3;
   shade = nullptr; // avoid calling "new" more than once per pixel
+  orbit = nullptr;
+  dc = 0.0;
+  bla = nullptr;
+  blaSteps = 0;
+  blaSkipped = 0;
+  blaIterations = 0;
+  iterationsRun = 0;
+  symmetry = false;
+  knownExterior = false;
+  cancellation = nullptr;
+  formula = Formula::Mandelbrot;
+  degree = 2;
+  lnDegree = M_LN2;
+  juliaC = 0.0;
+  periodicity = false;
+  periodEpsilon = 0.0;
+  zPeriod = 0.0;
+  periodStep = 0;
+  periodLimit = 8;
 }
 
 Mandelbrot::~Mandelbrot()
@@ -101,40 +142,351 @@ void Mandelbrot::set_border(int thinIn)
   thin = thinIn;
 }
 
+void Mandelbrot::set_iterMax(int iterMaxIn)
+{
+  iterMax = iterMaxIn;
+}
+
+int Mandelbrot::get_iterMax() const
+{
+  return iterMax;
+}
+
+int Mandelbrot::get_iter() const
+{
+  return iter;
+}
+
+void Mandelbrot::set_reference(const ReferenceOrbit *orbitIn)
+{
+  orbit = orbitIn;
+}
+
+void Mandelbrot::set_bla(const BLATable *blaIn)
+{
+  bla = blaIn;
+}
+
+void Mandelbrot::flush_bla_counts()
+{
+  if (bla != nullptr)
+  {
+    bla->record(blaSteps, blaSkipped, blaIterations);
+  }
+  blaSteps = 0;
+  blaSkipped = 0;
+  blaIterations = 0;
+}
+
+uint64_t Mandelbrot::get_iterations_run() const
+{
+  return iterationsRun;
+}
+
+void Mandelbrot::set_formula(Formula formulaIn, int degreeIn)
+{
+  if (degreeIn < 2 || degreeIn > maxDegree)
+  {
+    throw invalid_argument("formula degree must be 2 ... " + to_string(maxDegree));
+  }
+  formula = formulaIn;
+  degree = (formula == Formula::Multibrot || formula == Formula::Julia) ? degreeIn : 2;
+  lnDegree = log(static_cast<double>(degree));
+}
+
+void Mandelbrot::set_julia_c(complex<double> juliaCIn)
+{
+  juliaC = juliaCIn;
+}
+
+bool Mandelbrot::conjugate_symmetric() const
+{
+  switch (formula)
+  {
+    case Formula::Julia:
+      return imag(juliaC) == 0.0;
+    case Formula::BurningShip:
+      return false;
+    default:
+      return true;
+  }
+}
+
+void Mandelbrot::set_known_exterior(bool knownExteriorIn)
+{
+  knownExterior = knownExteriorIn;
+}
+
+double Mandelbrot::get_exterior_radius() const
+{
+  return (iter < iterMax) ? 0.25 * de : 0.0;
+}
+
+double Mandelbrot::get_average() const
+{
+  // the shape check leaves a untouched, and the border is marked with FP_ZERO
+  if (iter == iterMax)
+  {
+    return -1.0;
+  }
+  return (a == FP_ZERO) ? 0.0 : a;
+}
+
+double Mandelbrot::get_reflection(bool conjugate) const
+{
+  return conjugate ? Neumorphic(conj(z), conj(dC)).calculate() : Neumorphic(z, dC).calculate();
+}
+
+double Mandelbrot::get_smooth_iter() const
+{
+  return static_cast<double>(iter + 1) + log(log(escapeRadius) / log(r)) / lnDegree;
+}
+
+double Mandelbrot::get_distance() const
+{
+  return de;
+}
+
+void Mandelbrot::set_cancellation(const CancellationToken *cancellationIn)
+{
+  cancellation = cancellationIn;
+}
+
+bool Mandelbrot::cancelled() const
+{
+  return cancellation != nullptr && cancellation->cancelled();
+}
+
+void Mandelbrot::set_periodicity(bool periodicityIn)
+{
+  periodicity = periodicityIn;
+}
+
+void Mandelbrot::set_symmetry(bool symmetryIn)
+{
+  symmetry = symmetryIn;
+}
+
+int Mandelbrot::mirror_row(int pyIn) const
+{
+  if (!symmetry || !conjugate_symmetric())
+  {
+    return -1;
+  }
+  // row pY sits at Im(c) = cyMax - pY * pixHeight, so its conjugate sits at row k - pY
+  double top = (orbit != nullptr) ? imag(orbit->get_center()) + cyMax : cyMax;
+  double k = 2.0 * top * static_cast<double>(height) / (cyMax - cyMin);
+  double rowK = round(k);
+  if (abs(k - rowK) > 1e-6 || rowK < 0.0 || rowK > 2.0 * height)
+  {
+    return -1; // real axis not on a pixel row, or nowhere near the image
+  }
+  int mirror = static_cast<int>(rowK) - pyIn;
+  if (mirror == pyIn || mirror < 0 || mirror >= height)
+  {
+    return -1;
+  }
+  return mirror;
+}
+
+bool Mandelbrot::reflected_row(int pyIn) const
+{
+  int mirror = mirror_row(pyIn);
+  if (mirror < 0)
+  {
+    return false;
+  }
+  int rowK = mirror + pyIn;
+  int above = min(height, (rowK + 1) / 2); // rows with Im(c) > 0
+  int below = max(0, height - (rowK / 2 + 1)); // rows with Im(c) < 0
+  // iterate the larger half, reflect the other
+  return (above >= below) ? (2 * pyIn > rowK) : (2 * pyIn < rowK);
+}
+
 void Mandelbrot::get_c()
 {
   pixWidth = (cxMax-cxMin) / static_cast<double>(width);
   pixHeight = (cyMax-cyMin) / static_cast<double>(height);
-  c = (cxMin + static_cast<double>(pX) * pixWidth) + ((cyMax - static_cast<double>(pY) * pixHeight) * 1i);
+  dc = (cxMin + static_cast<double>(pX) * pixWidth) + ((cyMax - static_cast<double>(pY) * pixHeight) * 1i);
+  c = (orbit != nullptr) ? orbit->get_center() + dc : dc;
+  periodEpsilon = 1e-3 * pixWidth;
 }
 
 void Mandelbrot::iterate()
 {
-  if (!this->shape_check())
+  if (knownExterior || formula != Formula::Mandelbrot || !this->shape_check())
   {
-    for (iter = 0; iter < iterMax; iter++)
+    switch (formula)
     {
-      // mandelbrot set formula
+      case Formula::Mandelbrot:
+        if (orbit != nullptr)
+        {
+          perturb();
+        } else {
+          iterate_formula<formula::Multibrot<2>>(c);
+        }
+        break;
+      case Formula::Multibrot:
+        iterate_degree<formula::Multibrot>(c);
+        break;
+      case Formula::Julia:
+        iterate_degree<formula::Julia>(juliaC);
+        break;
+      case Formula::BurningShip:
+        iterate_formula<formula::BurningShip>(c);
+        break;
+    }
+    iterationsRun += static_cast<uint64_t>(iter);
+
+    average();
+  } else {
+    iter = iterMax; // inside the main cardioid or period-2 bulb
+  }
+}
+
+template<typename F>
+void Mandelbrot::iterate_formula(const complex<double> &constant)
+{
+  F::start(z, dC, c);
+  int untilCheck = cancelCheckInterval;
+  for (iter = 0; iter < iterMax; iter++)
+  {
+    if (--untilCheck == 0)
+    {
+      untilCheck = cancelCheckInterval;
+      if (cancelled())
+      {
+        break;
+      }
+    }
+
+    F::step(z, dC, constant);
+
+    // compute average
+    if (iter > iSkip)
+    {
+      a += get_t();
+    }
+
+    r = abs(z);
+    if (r > escapeRadius)
+    {
+      break;
+    }
+
+    prevA = a;
+
+    if (periodicity && check_period())
+    {
+      iter = iterMax;
+      break;
+    }
+  }
+}
+
+template<template<int> class F>
+void Mandelbrot::iterate_degree(const complex<double> &constant)
+{
+  switch (degree)
+  {
+    case 2: iterate_formula<F<2>>(constant); break;
+    case 3: iterate_formula<F<3>>(constant); break;
+    case 4: iterate_formula<F<4>>(constant); break;
+    case 5: iterate_formula<F<5>>(constant); break;
+    case 6: iterate_formula<F<6>>(constant); break;
+    case 7: iterate_formula<F<7>>(constant); break;
+    case 8: iterate_formula<F<8>>(constant); break;
+    default: break;
+  }
+}
+
+void Mandelbrot::perturb()
+{
+  const ReferenceOrbit &ref = *orbit;
+  size_t m = 0;
+  complex<double> delta = 0.0;
+  int untilCheck = cancelCheckInterval;
+
+  for (iter = 0; iter < iterMax; iter++)
+  {
+    if (--untilCheck == 0)
+    {
+      untilCheck = cancelCheckInterval;
+      if (cancelled())
+      {
+        break;
+      }
+    }
+
+    const BLATable::Step *step = (bla != nullptr) ? bla->lookup(m, norm(delta)) : nullptr;
+    if (step != nullptr && iter + step->length < iterMax)
+    {
+      // step->length iterations at once; z stays so close to the reference that the stripe
+      // terms of iterations past iSkip are those of the reference, and dC follows the same map
+      int counted = max(0, iSkip + 1 - iter);
+      if (counted < step->length)
+      {
+        a += bla->stripe_sum(m + counted, m + step->length);
+      }
+      dC = step->A * dC + step->B;
+      delta = step->A * delta + step->B * dc;
+      m += step->length;
+      iter += step->length - 1;
+      z = ref[m] + delta;
+      blaSteps++;
+      blaSkipped += step->length;
+    } else {
+      // z = Z(m) + delta, so only the offset from the reference is iterated
       dC = 2.0 * dC * z + 1.0;
-      z = z * z + c;
+      delta = (2.0 * ref[m] + delta) * delta + dc;
+      m++;
+      z = ref[m] + delta;
 
       // compute average
       if (iter > iSkip)
       {
         a += get_t();
       }
+    }
 
-      r = abs(z);
-      if (r > escapeRadius)
-      {
-        break;
-      }
+    r = abs(z);
+    if (r > escapeRadius)
+    {
+      break;
+    }
+
+    prevA = a;
+
+    if (periodicity && check_period())
+    {
+      iter = iterMax;
+      break;
+    }
 
-      prevA = a;
+    // rebase onto the start of the orbit once the pixel is closer to zero than to the reference,
+    // or the reference has run out (glitch avoidance)
+    if (r < abs(delta) || m + 1 == ref.size())
+    {
+      delta = z;
+      m = 0;
     }
+  }
+  blaIterations += static_cast<uint64_t>(iter);
+}
 
-    average();
+bool Mandelbrot::check_period()
+{
+  if (abs(z - zPeriod) < periodEpsilon)
+  {
+    return true;
+  }
+  if (++periodStep == periodLimit)
+  {
+    zPeriod = z;
+    periodStep = 0;
+    periodLimit *= 2;
   }
+  return false;
 }
 
 unsigned char Mandelbrot::colorize_bw()
@@ -158,6 +510,21 @@ unsigned char Mandelbrot::colorize_bw()
   }
 }
 
+unsigned char Mandelbrot::colorize_bw_conjugate()
+{
+  if (in_set())
+  {
+    InsideColor color;
+    return color.calculate_bw();
+  } else if (a == FP_ZERO) {
+    LineColor color;
+    return color.calculate_bw();
+  } else {
+    Striping color(1.0 - a, conj(z), conj(dC));
+    return color.calculate_bw();
+  }
+}
+
 bool Mandelbrot::shape_check()
 {
     q = ((real(c) - 0.25) * (real(c) - 0.25)) + (imag(c) * imag(c));
@@ -179,7 +546,7 @@ double Mandelbrot::get_t()
 void Mandelbrot::interpolate()
 {
   // smooth iteration count
-  d = static_cast<double>(iter + 1) + log(log(escapeRadius) / log(r)) / M_LN2;
+  d = static_cast<double>(iter + 1) + log(log(escapeRadius) / log(r)) / lnDegree;
   d = d - static_cast<double>(static_cast<int>(d)); // only fractional part = interpolation
   // coefficient
 }
@@ -250,7 +617,12 @@ void Mandelbrot::reset()
   a = 0.0;
   prevA = 0.0;
   d = 0.0;
+  delete shade;
   shade = nullptr; // avoid calling "new" more than once per pixel
+  dc = 0.0;
+  zPeriod = 0.0;
+  periodStep = 0;
+  periodLimit = 8;
 }
 
 Mandelbrot::Mandelbrot(const Mandelbrot &oldMandelbrot) : Mandelbrot(oldMandelbrot.width,
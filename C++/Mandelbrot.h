@@ -5,6 +5,10 @@
 #include "InsideColor.h"
 #include "LineColor.h"
 #include "Striping.h"
+#include "ReferenceOrbit.h"
+#include "BLATable.h"
+#include "CancellationToken.h"
+#include "Formula.h"
 #include <cmath>
 #include <complex>
 #include <algorithm>
@@ -17,6 +21,22 @@ class Mandelbrot
 {
  public:
 
+  /**
+   * Formula iterated per pixel, see Formula.h
+   */
+  enum class Formula
+  {
+    Mandelbrot,
+    Multibrot,
+    Julia,
+    BurningShip
+  };
+
+  /**
+   * highest degree of Multibrot and Julia formulas
+   */
+  inline static const int maxDegree = 8;
+
   /**
    * Default parametrized constructor
    * @param width - image width
@@ -55,6 +75,128 @@ class Mandelbrot
 
   void set_border(int thinIn);
 
+  void set_iterMax(int iterMaxIn);
+
+  int get_iterMax() const;
+
+  /**
+   * @return iteration count of the last iterate(), iterMax if inside the set
+   */
+  int get_iter() const;
+
+  /**
+   * Iterate pixels as offsets from a shared reference orbit; the plane set by set_plane() is then
+   * taken relative to the orbit center. nullptr returns to direct iteration
+   * @param orbitIn
+   */
+  void set_reference(const ReferenceOrbit *orbitIn);
+
+  /**
+   * Choose the iterated formula. The cardioid/bulb test and perturbation only apply to the
+   * Mandelbrot formula, and rows are only reflected for formulas symmetric about the real axis
+   * @param formulaIn
+   * @param degreeIn - degree of Multibrot and Julia formulas, 2 ... maxDegree
+   */
+  void set_formula(Formula formulaIn, int degreeIn = 2);
+
+  /**
+   * @param juliaCIn - fixed c of the Julia formula
+   */
+  void set_julia_c(std::complex<double> juliaCIn);
+
+  /**
+   * Skip iterations of perturbed pixels through bilinear approximations of the reference orbit
+   * @param blaIn - table built for the current view and orbit, nullptr for none
+   */
+  void set_bla(const BLATable *blaIn);
+
+  /**
+   * Pass the bilinear steps taken since the last flush on to the table's totals
+   */
+  void flush_bla_counts();
+
+  /**
+   * @return iterations of every pixel iterated so far; pixels settled by the shape check add none
+   */
+  std::uint64_t get_iterations_run() const;
+
+  /**
+   * Enable periodicity checking, which ends interior orbits early once they settle into a cycle.
+   * Only pays off for pixels expected to be inside the set
+   * @param periodicityIn
+   */
+  void set_periodicity(bool periodicityIn);
+
+  /**
+   * Allow rows of a plane straddling the real axis to be reflected from their mirror row
+   * @param symmetryIn
+   */
+  void set_symmetry(bool symmetryIn);
+
+  /**
+   * Pixels already proven outside the set skip the cardioid/bulb test in iterate()
+   * @param knownExteriorIn
+   */
+  void set_known_exterior(bool knownExteriorIn);
+
+  /**
+   * Iterations between polls of the cancellation token
+   */
+  inline static const int cancelCheckInterval = 1024;
+
+  /**
+   * Stop iterating a pixel soon after the token is cancelled, leaving it unfinished
+   * @param cancellationIn - must outlive the iterations, nullptr for none
+   */
+  void set_cancellation(const CancellationToken *cancellationIn);
+
+  /**
+   * @return TRUE if the token is cancelled
+   */
+  bool cancelled() const;
+
+  /**
+   * Radius of a disk around c that holds no point of the set, from the distance estimate; a
+   * quarter of de, the lower bound of the true distance
+   * @return radius after iterate(), 0 for pixels inside the set
+   */
+  double get_exterior_radius() const;
+
+  /**
+   * @return stripe average after iterate(): -1 inside the set, 0 on the border
+   */
+  double get_average() const;
+
+  /**
+   * @param conjugate - for the mirrored pixel
+   * @return Neumorphic shading factor after iterate(), for pixels outside the set
+   */
+  double get_reflection(bool conjugate) const;
+
+  /**
+   * @return smooth (continuous) iteration count after iterate(), for pixels outside the set
+   */
+  double get_smooth_iter() const;
+
+  /**
+   * @return distance estimate after iterate(), for pixels outside the set
+   */
+  double get_distance() const;
+
+  /**
+   * Row whose pixels are the complex conjugates of row pyIn
+   * @param pyIn
+   * @return mirror row, -1 if symmetry is off or the row has no mirror within the image
+   */
+  int mirror_row(int pyIn) const;
+
+  /**
+   * @param pyIn
+   * @return TRUE if row pyIn lies in the smaller half and should be reflected from its mirror
+   * instead of iterated
+   */
+  bool reflected_row(int pyIn) const;
+
   /**
    * Determine where pixel lies in complex plane
    */
@@ -70,6 +212,13 @@ class Mandelbrot
    */
   unsigned char colorize_bw();
 
+  /**
+   * Color of the conjugate pixel, from the same iteration: its orbit is the conjugate orbit, so
+   * z and dC are conjugated for the normal map and the stripe average becomes 1 - a
+   * @return single output pixel value of the mirrored pixel
+   */
+  unsigned char colorize_bw_conjugate();
+
   /**
    * Shape checking algorithm - determines if point is within main cardioid or secondary bulb.
    * Removes about 91% of the set from being iterated.
@@ -105,6 +254,38 @@ class Mandelbrot
 
  private:
 
+  /**
+   * Perturbation variant of iterate() against the reference orbit
+   */
+  void perturb();
+
+  /**
+   * iterate() for one formula, instantiated per formula
+   * @tparam F - formula from Formula.h
+   * @param constant - c added each iteration
+   */
+  template<typename F>
+  void iterate_formula(const std::complex<double> &constant);
+
+  /**
+   * iterate_formula() for the degree chosen at run time
+   * @tparam F - formula template taking the degree
+   * @param constant
+   */
+  template<template<int> class F>
+  void iterate_degree(const std::complex<double> &constant);
+
+  /**
+   * @return TRUE if conjugate pixels have conjugate orbits
+   */
+  bool conjugate_symmetric() const;
+
+  /**
+   * Brent-style cycle detection
+   * @return TRUE if z has returned to a previously saved point
+   */
+  bool check_period();
+
   int iter;
 
   int iterMax;
@@ -175,6 +356,53 @@ class Mandelbrot
   int thin;
 
   Shading *shade;
+
+  // perturbation
+  const ReferenceOrbit *orbit;
+
+  /**
+   * offset of c from the reference orbit center
+   */
+  std::complex<double> dc;
+
+  const BLATable *bla;
+
+  std::uint64_t blaSteps;
+
+  std::uint64_t blaSkipped;
+
+  std::uint64_t blaIterations;
+
+  std::uint64_t iterationsRun;
+
+  bool symmetry;
+
+  bool knownExterior;
+
+  const CancellationToken *cancellation;
+
+  // formula
+  Formula formula;
+
+  int degree;
+
+  /**
+   * log(degree), for the smooth iteration count
+   */
+  double lnDegree;
+
+  std::complex<double> juliaC;
+
+  // periodicity
+  bool periodicity;
+
+  double periodEpsilon;
+
+  std::complex<double> zPeriod;
+
+  int periodStep;
+
+  int periodLimit;
 };
 
 #endif //C___MANDELBROT_H
\ No newline at end of file
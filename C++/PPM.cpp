@@ -47,11 +47,31 @@ bool PPM::init_stream()
 }
 
 void PPM::write_header()
+{
+  image << header_string();
+  dataStart = image.tellp();
+}
+
+string PPM::header_string(size_t alignment) const
 {
   string widthStr = to_string(this->width);
   string lengthStr = to_string(this->height);
-  header << magic << widthStr << " " << lengthStr << "\n" << comment << "\n" << pixMaxVal;
-  image << header.rdbuf();
+  stringstream header;
+  header << magic << widthStr << " " << lengthStr << "\n" << comment << "\n";
+  size_t length = header.str().size() + pixMaxVal.size();
+  if (alignment > 1 && length % alignment != 0)
+  {
+    // padding comment line: '#', spaces, '\n'
+    size_t pad = (alignment - (length + 2) % alignment) % alignment;
+    header << "#" << string(pad, ' ') << "\n";
+  }
+  header << pixMaxVal;
+  return header.str();
+}
+
+string PPM::get_file_name() const
+{
+  return fileName;
 }
 
 void PPM::set_width(int widthIn)
@@ -65,11 +65,35 @@ class PPM
     image.write((char const *) row.data(), row.size());
   }
 
+  /**
+   * Print row of pixels to its place in the PPM file, rows can then be written out of order
+   * @param pY - row index
+   * @param row - pixels of the row
+   */
+  void write_row(int pY, const std::vector<unsigned char> &row)
+  {
+    image.seekp(dataStart + static_cast<std::streamoff>(pY) * subPixel);
+    image.write((char const *) row.data(), row.size());
+  }
+
   /**
    * Print header data to PPM file
    */
   void write_header();
 
+  /**
+   * Header data as written by write_header()
+   * @param alignment - pad the header with a comment so that pixel data starts at a multiple of
+   * this many bytes
+   * @return header
+   */
+  std::string header_string(std::size_t alignment = 1) const;
+
+  /**
+   * @return output path, output directory included
+   */
+  std::string get_file_name() const;
+
   /**
    * Set width of PPM image
    * @param widthIn
@@ -111,16 +135,16 @@ class PPM
 
   std::string comment;
 
-  /**
-   * Contains full header info
-   */
-  std::stringstream header;
-
   std::string outputDirectory;
 
   std::string fileName;
 
   std::ofstream image;
+
+  /**
+   * Offset of the first row, just past the header
+   */
+  std::streamoff dataStart = 0;
 };
 
 #endif //C___PPM_H
\ No newline at end of file
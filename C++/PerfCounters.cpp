@@ -0,0 +1,478 @@
+#include "PerfCounters.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+const char *stageNames[PerfCounters::stages] = {"iterate", "colorize", "band", "color"};
+
+/**
+ * why a kernel scope counted nothing
+ */
+#if defined(__x86_64__) || defined(__i386__)
+const char *unreadReason = "the kernel does not allow rdpmc (see /sys/bus/event_source/devices/"
+                           "cpu/rdpmc) or the counters were multiplexed off the PMU";
+#else
+const char *unreadReason = "kernel scopes read the counters with rdpmc, which needs x86";
+#endif
+
+#ifdef __linux__
+/**
+ * Raw event of FP arithmetic retired on this CPU
+ * @param config - set to the raw event
+ * @return FALSE if the vendor is unknown
+ */
+bool fp_event(uint64_t &config)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax = 0;
+  unsigned int vendor[3] = {0, 0, 0};
+  if (__get_cpuid(0, &eax, &vendor[0], &vendor[2], &vendor[1]) == 0)
+  {
+    return false;
+  }
+  char name[13] = {0};
+  memcpy(name, vendor, 12);
+  if (strcmp(name, "GenuineIntel") == 0)
+  {
+    config = 0xFFC7; // FP_ARITH_INST_RETIRED, every width and precision
+    return true;
+  }
+  if (strcmp(name, "AuthenticAMD") == 0)
+  {
+    config = 0xFF03; // Retired SSE/AVX FLOPs
+    return true;
+  }
+#endif
+  return false;
+}
+
+/**
+ * @param event
+ * @param type - set to the perf event type
+ * @param config - set to the perf event config
+ * @return FALSE if the event has no encoding on this CPU
+ */
+bool event_config(PerfCounters::Event event, uint32_t &type, uint64_t &config)
+{
+  type = PERF_TYPE_HARDWARE;
+  switch (event)
+  {
+    case PerfCounters::Cycles:
+      config = PERF_COUNT_HW_CPU_CYCLES;
+      return true;
+    case PerfCounters::Instructions:
+      config = PERF_COUNT_HW_INSTRUCTIONS;
+      return true;
+    case PerfCounters::BranchMisses:
+      config = PERF_COUNT_HW_BRANCH_MISSES;
+      return true;
+    case PerfCounters::L1Misses:
+      type = PERF_TYPE_HW_CACHE;
+      config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+               | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      return true;
+    case PerfCounters::LLCMisses:
+      config = PERF_COUNT_HW_CACHE_MISSES;
+      return true;
+    case PerfCounters::FPOps:
+      type = PERF_TYPE_RAW;
+      return fp_event(config);
+  }
+  return false;
+}
+
+/**
+ * Count of a counter from its mapped page, following the kernel's sequence lock
+ * @param page
+ * @param value - set to the count
+ * @return FALSE if the counter cannot be read from user space right now
+ */
+bool read_page(const volatile perf_event_mmap_page *page, uint64_t &value)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t sequence;
+  do
+  {
+    sequence = page->lock;
+    atomic_signal_fence(memory_order_seq_cst);
+    uint32_t index = page->index;
+    uint16_t bits = page->pmc_width;
+    if (!page->cap_user_rdpmc || index == 0 || bits == 0 || bits > 64)
+    {
+      return false; // not allowed, or not on the PMU
+    }
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(index - 1));
+    // the hardware counter is pmc_width bits wide and sign extends into the offset
+    auto count = static_cast<int64_t>((static_cast<uint64_t>(high) << 32) | low);
+    count = static_cast<int64_t>(static_cast<uint64_t>(count) << (64 - bits)) >> (64 - bits);
+    value = static_cast<uint64_t>(page->offset + count);
+    atomic_signal_fence(memory_order_seq_cst);
+  } while (page->lock != sequence);
+  return true;
+#else
+  (void) page;
+  (void) value;
+  return false;
+#endif
+}
+
+uint64_t scaled(uint64_t value, uint64_t enabled, uint64_t running)
+{
+  if (running == 0)
+  {
+    return 0;
+  }
+  return (running < enabled)
+         ? static_cast<uint64_t>(static_cast<double>(value) * enabled / running) : value;
+}
+#endif
+
+/**
+ * Counters of the calling thread, opened on its first scope and kept until the thread exits
+ */
+const PerfCounters::Events &thread_events()
+{
+  thread_local unique_ptr<PerfCounters::Events> events;
+  if (!events)
+  {
+    events = make_unique<PerfCounters::Events>(false);
+  }
+  return *events;
+}
+
+double ratio(uint64_t numerator, uint64_t denominator)
+{
+  return (denominator == 0) ? 0.0 : static_cast<double>(numerator) / denominator;
+}
+
+} // namespace
+
+PerfCounters::Events::Events(bool inherit)
+{
+  fds.fill(-1);
+  pages.fill(nullptr);
+  order.fill(Cycles);
+  opened = 0;
+  grouped = !inherit;
+
+#ifdef __linux__
+  for (size_t event = 0; event < events; event++)
+  {
+    uint32_t type = 0;
+    uint64_t config = 0;
+    if (!event_config(static_cast<Event>(event), type, config))
+    {
+      continue;
+    }
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = inherit ? 1 : 0;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING
+                       | (grouped ? PERF_FORMAT_GROUP : 0);
+    // counting starts with the leader, which takes the others along
+    int leader = (grouped && opened > 0) ? fds[order[0]] : -1;
+    attr.disabled = (leader == -1) ? 1 : 0;
+
+    int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+    if (fd < 0)
+    {
+      if (event == Cycles)
+      {
+        error = string("perf_event_open: ") + strerror(errno);
+        return;
+      }
+      continue;
+    }
+    fds[event] = fd;
+    order[opened++] = static_cast<Event>(event);
+    void *page = mmap(nullptr, static_cast<size_t>(sysconf(_SC_PAGESIZE)), PROT_READ, MAP_SHARED,
+                      fd, 0);
+    pages[event] = (page == MAP_FAILED) ? nullptr : page;
+  }
+
+  for (size_t event = 0; event < events; event++)
+  {
+    if (fds[event] >= 0 && (!grouped || event == order[0]))
+    {
+      ioctl(fds[event], PERF_EVENT_IOC_RESET, grouped ? PERF_IOC_FLAG_GROUP : 0);
+      ioctl(fds[event], PERF_EVENT_IOC_ENABLE, grouped ? PERF_IOC_FLAG_GROUP : 0);
+    }
+  }
+#else
+  error = "performance counters are read through Linux perf_event_open";
+#endif
+}
+
+PerfCounters::Events::~Events()
+{
+#ifdef __linux__
+  for (void *page : pages)
+  {
+    if (page != nullptr)
+    {
+      munmap(page, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+    }
+  }
+  for (int fd : fds)
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+#endif
+}
+
+bool PerfCounters::Events::available() const
+{
+  return fds[Cycles] >= 0;
+}
+
+bool PerfCounters::Events::counted(Event event) const
+{
+  return fds[event] >= 0;
+}
+
+const string &PerfCounters::Events::get_error() const
+{
+  return error;
+}
+
+PerfCounters::Values PerfCounters::Events::read() const
+{
+  Values values{};
+#ifdef __linux__
+  if (!available())
+  {
+    return values;
+  }
+  if (grouped)
+  {
+    // nr, time enabled, time running, then one value per counter in the group
+    uint64_t buffer[3 + events];
+    if (::read(fds[order[0]], buffer, sizeof(buffer)) < static_cast<ssize_t>(3 * sizeof(uint64_t)))
+    {
+      return values;
+    }
+    for (size_t counter = 0; counter < buffer[0] && counter < opened; counter++)
+    {
+      values[order[counter]] = scaled(buffer[3 + counter], buffer[1], buffer[2]);
+    }
+    return values;
+  }
+  for (size_t event = 0; event < events; event++)
+  {
+    // value, time enabled, time running
+    uint64_t buffer[3];
+    if (fds[event] >= 0 && ::read(fds[event], buffer, sizeof(buffer)) == sizeof(buffer))
+    {
+      values[event] = scaled(buffer[0], buffer[1], buffer[2]);
+    }
+  }
+#endif
+  return values;
+}
+
+bool PerfCounters::Events::read_user(Values &values) const
+{
+  values.fill(0);
+#ifdef __linux__
+  if (!available())
+  {
+    return false;
+  }
+  for (size_t event = 0; event < events; event++)
+  {
+    if (fds[event] < 0)
+    {
+      continue;
+    }
+    if (pages[event] == nullptr
+        || !read_page(static_cast<const volatile perf_event_mmap_page *>(pages[event]),
+                      values[event]))
+    {
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+PerfCounters::Scope::Scope(PerfCounters *countersIn, Stage stageIn, uint64_t pixelsIn)
+{
+  counters = countersIn;
+  stage = stageIn;
+  pixels = pixelsIn;
+  events = nullptr;
+  user = stage == Stage::Iterate || stage == Stage::Colorize;
+  if (counters != nullptr && counters->available())
+  {
+    events = &thread_events();
+    if (!user)
+    {
+      begin = events->read();
+    } else if (!events->read_user(begin)) {
+      events = nullptr; // a system call here would cost more than the kernel
+      counters->add_unread(stage, pixels);
+    }
+  }
+}
+
+PerfCounters::Scope::~Scope()
+{
+  if (events == nullptr || !events->available())
+  {
+    return;
+  }
+  Values end;
+  if (!user)
+  {
+    end = events->read();
+  } else if (!events->read_user(end)) {
+    counters->add_unread(stage, pixels);
+    return;
+  }
+  for (size_t event = 0; event < PerfCounters::events; event++)
+  {
+    end[event] -= begin[event];
+  }
+  counters->add(stage, end, pixels);
+}
+
+PerfCounters::PerfCounters()
+{
+  for (Totals &stage : totals)
+  {
+    for (auto &count : stage.counts)
+    {
+      count = 0;
+    }
+    stage.pixels = 0;
+    stage.unreadPixels = 0;
+  }
+  Events probe(false);
+  availableEvents = probe.available();
+  error = probe.get_error();
+  for (size_t event = 0; event < events; event++)
+  {
+    counted[event] = probe.counted(static_cast<Event>(event));
+  }
+}
+
+bool PerfCounters::available() const
+{
+  return availableEvents;
+}
+
+const string &PerfCounters::get_error() const
+{
+  return error;
+}
+
+void PerfCounters::add(Stage stage, const Values &values, uint64_t pixels)
+{
+  Totals &stageTotals = totals[static_cast<size_t>(stage)];
+  for (size_t event = 0; event < events; event++)
+  {
+    stageTotals.counts[event].fetch_add(values[event], memory_order_relaxed);
+  }
+  stageTotals.pixels.fetch_add(pixels, memory_order_relaxed);
+}
+
+void PerfCounters::add_unread(Stage stage, uint64_t pixels)
+{
+  totals[static_cast<size_t>(stage)].unreadPixels.fetch_add(pixels, memory_order_relaxed);
+}
+
+PerfCounters::Values PerfCounters::get_counts(Stage stage) const
+{
+  Values values{};
+  for (size_t event = 0; event < events; event++)
+  {
+    values[event] = totals[static_cast<size_t>(stage)].counts[event].load(memory_order_relaxed);
+  }
+  return values;
+}
+
+uint64_t PerfCounters::get_pixels(Stage stage) const
+{
+  return totals[static_cast<size_t>(stage)].pixels.load(memory_order_relaxed);
+}
+
+uint64_t PerfCounters::get_unread_pixels(Stage stage) const
+{
+  return totals[static_cast<size_t>(stage)].unreadPixels.load(memory_order_relaxed);
+}
+
+void PerfCounters::print_ratios(ostream &os, const Values &values,
+                                const array<bool, events> &counted, uint64_t pixels)
+{
+  const char *names[events] = {"cycles", "instructions", "branch misses", "L1 misses",
+                               "LLC misses", "FP ops"};
+  os << "IPC " << ratio(values[Instructions], values[Cycles]) << ", per pixel:";
+  for (size_t event = 0; event < events; event++)
+  {
+    os << (event == 0 ? " " : ", ") << names[event] << " ";
+    if (counted[event])
+    {
+      os << ratio(values[event], pixels);
+    } else {
+      os << "n/a";
+    }
+  }
+}
+
+ostream &operator<<(ostream &os, const PerfCounters &counters)
+{
+  if (!counters.available())
+  {
+    os << "Performance counters unavailable: " << counters.error << "\n";
+    return os;
+  }
+  for (size_t stage = 0; stage < PerfCounters::stages; stage++)
+  {
+    uint64_t pixels = counters.get_pixels(static_cast<PerfCounters::Stage>(stage));
+    if (pixels > 0)
+    {
+      os << "Counters " << stageNames[stage] << ": " << pixels << " pixels, ";
+      PerfCounters::print_ratios(os, counters.get_counts(static_cast<PerfCounters::Stage>(stage)),
+                                 counters.counted, pixels);
+      os << "\n";
+    }
+    uint64_t unread = counters.get_unread_pixels(static_cast<PerfCounters::Stage>(stage));
+    if (unread > 0)
+    {
+      os << "Counters " << stageNames[stage] << ": " << unread << " pixels not counted, "
+         << unreadReason << "\n";
+    }
+  }
+  return os;
+}
@@ -0,0 +1,243 @@
+#ifndef C____PERFCOUNTERS_H_
+#define C____PERFCOUNTERS_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+/**
+ * Hardware performance counters around the render kernels and stages, read through Linux
+ * perf_event_open. Every thread counts itself in its own counter group, opened the first time the
+ * thread enters a Scope, and scopes add their deltas to the totals of their stage. Counting is
+ * user space only. Stage scopes read the counters with a read() call; kernel scopes are taken
+ * twice per pixel, where a system call would evict enough cache lines and branch history to
+ * swamp the kernel's own counts, so they read the counters from user space with rdpmc through
+ * the counters' mapped pages, and count nothing where the kernel does not allow that. Where the
+ * counters cannot be opened (other systems, perf_event_paranoid, virtual machines without a PMU)
+ * the scopes do nothing. The report says why in either case
+ */
+class PerfCounters
+{
+ public:
+
+  enum Event
+  {
+    Cycles,
+    Instructions,
+    BranchMisses,
+    L1Misses,
+
+    /**
+     * last level cache misses
+     */
+    LLCMisses,
+
+    /**
+     * FP arithmetic instructions retired on Intel, FLOPs retired on AMD; counted on x86 only
+     */
+    FPOps
+  };
+
+  static const std::size_t events = 6;
+
+  using Values = std::array<std::uint64_t, events>;
+
+  /**
+   * Set of counters of the calling thread, optionally inherited by the processes and threads it
+   * creates afterwards
+   */
+  class Events
+  {
+   public:
+
+    /**
+     * Open the counters; the ones the machine lacks stay closed
+     * @param inherit - also count children created after this; these counters are read one by one
+     * as the kernel cannot inherit a group
+     */
+    explicit Events(bool inherit);
+
+    ~Events();
+
+    Events(const Events &) = delete;
+
+    Events &operator=(const Events &) = delete;
+
+    /**
+     * @return TRUE if at least the cycle counter is open
+     */
+    bool available() const;
+
+    bool counted(Event event) const;
+
+    /**
+     * @return why the cycle counter could not be opened, empty if it was
+     */
+    const std::string &get_error() const;
+
+    /**
+     * @return counts so far, scaled up where the kernel multiplexed the counters; 0 for closed
+     * counters
+     */
+    Values read() const;
+
+    /**
+     * Read the counts without a system call, through rdpmc; counts are not scaled, so only
+     * differences of two reads mean something
+     * @param values - counts so far, 0 for closed counters
+     * @return FALSE if a counter cannot be read from user space right now (not x86, rdpmc not
+     * allowed, or the counter is multiplexed out)
+     */
+    bool read_user(Values &values) const;
+
+   private:
+
+    std::array<int, events> fds;
+
+    /**
+     * mapped perf_event_mmap_page of each open counter, nullptr where mapping failed
+     */
+    std::array<void *, events> pages;
+
+    /**
+     * counters in the group, in the order the group read returns them
+     */
+    std::array<Event, events> order;
+
+    std::size_t opened;
+
+    bool grouped;
+
+    std::string error;
+  };
+
+  /**
+   * Kernels and stages that take scopes; Band includes the kernels of its pixels
+   */
+  enum class Stage
+  {
+    Iterate,
+    Colorize,
+    Band,
+    Color
+  };
+
+  static const std::size_t stages = 4;
+
+  /**
+   * Counts a stage on the calling thread from construction to destruction
+   */
+  class Scope
+  {
+   public:
+
+    /**
+     * @param countersIn - nullptr for no counting
+     * @param stageIn - Iterate and Colorize are read from user space only, see read_user()
+     * @param pixelsIn - pixels handled in the scope, the denominator of the per-pixel ratios
+     */
+    Scope(PerfCounters *countersIn, Stage stageIn, std::uint64_t pixelsIn);
+
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+
+    Scope &operator=(const Scope &) = delete;
+
+   private:
+
+    PerfCounters *counters;
+
+    Stage stage;
+
+    std::uint64_t pixels;
+
+    const Events *events;
+
+    /**
+     * kernel scope, read with read_user()
+     */
+    bool user;
+
+    Values begin;
+  };
+
+  /**
+   * Default constructor, probes the counters on the calling thread
+   */
+  PerfCounters();
+
+  bool available() const;
+
+  /**
+   * @return why the counters are unavailable, empty if they are available
+   */
+  const std::string &get_error() const;
+
+  /**
+   * Add counts to a stage
+   * @param stage
+   * @param values
+   * @param pixels
+   */
+  void add(Stage stage, const Values &values, std::uint64_t pixels);
+
+  Values get_counts(Stage stage) const;
+
+  std::uint64_t get_pixels(Stage stage) const;
+
+  /**
+   * @param stage
+   * @return pixels of kernel scopes that counted nothing as rdpmc was unavailable
+   */
+  std::uint64_t get_unread_pixels(Stage stage) const;
+
+  /**
+   * Print IPC and per-pixel ratios of every stage that was entered
+   * @param os
+   * @param counters
+   * @return
+   */
+  friend std::ostream &operator<<(std::ostream &os, const PerfCounters &counters);
+
+  /**
+   * Print the IPC and per-pixel ratios of a set of counts, "n/a" for counters that were not counted
+   * @param os
+   * @param values
+   * @param counted - counters that were open
+   * @param pixels
+   */
+  static void print_ratios(std::ostream &os, const Values &values,
+                           const std::array<bool, events> &counted, std::uint64_t pixels);
+
+ private:
+
+  struct Totals
+  {
+    std::array<std::atomic<std::uint64_t>, events> counts;
+
+    std::atomic<std::uint64_t> pixels;
+
+    std::atomic<std::uint64_t> unreadPixels;
+  };
+
+  /**
+   * Note a kernel scope that could not read the counters from user space
+   * @param stage
+   * @param pixels
+   */
+  void add_unread(Stage stage, std::uint64_t pixels);
+
+  std::array<Totals, stages> totals;
+
+  std::array<bool, events> counted;
+
+  bool availableEvents;
+
+  std::string error;
+};
+
+#endif //C____PERFCOUNTERS_H_
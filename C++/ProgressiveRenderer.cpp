@@ -0,0 +1,177 @@
+#include "ProgressiveRenderer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+
+using namespace std;
+
+ProgressiveRenderer::ProgressiveRenderer(const FrameRenderer &renderer) : renderer(renderer)
+{
+  width = renderer.get_width();
+  height = renderer.get_height();
+  coarsestStep = 8;
+  blockSkip = false;
+  sink = nullptr;
+  iterated = 0;
+}
+
+void ProgressiveRenderer::set_coarsest_step(int stepIn)
+{
+  coarsestStep = max(1, stepIn);
+}
+
+void ProgressiveRenderer::set_block_skip(bool blockSkipIn)
+{
+  blockSkip = blockSkipIn;
+}
+
+void ProgressiveRenderer::set_sink(Sink sinkIn)
+{
+  sink = std::move(sinkIn);
+}
+
+size_t ProgressiveRenderer::get_iterated() const
+{
+  return iterated;
+}
+
+size_t ProgressiveRenderer::render_level(int step, int rowBegin, int rowEnd)
+{
+  Mandelbrot gigabrot(width, height);
+  renderer.setup(gigabrot);
+
+  size_t count = 0;
+  for (int pY = rowBegin; pY < rowEnd; pY += step)
+  {
+    for (int pX = 0; pX < width; pX += step)
+    {
+      size_t pixel = static_cast<size_t>(pY) * width + pX;
+      if (known[pixel])
+      {
+        continue; // computed by a coarser level or filled from block corners
+      }
+      gigabrot.current_pixel(pX, pY);
+      gigabrot.get_c();
+      gigabrot.iterate();
+      rgb[3 * pixel + 2] = rgb[3 * pixel + 1] = rgb[3 * pixel] = gigabrot.colorize_bw();
+      iterations[pixel] = gigabrot.get_iter();
+      known[pixel] = 1;
+      gigabrot.reset();
+      count++;
+    }
+  }
+  gigabrot.flush_bla_counts();
+  return count;
+}
+
+void ProgressiveRenderer::fill_blocks(int step, int rowBegin, int rowEnd)
+{
+  int block = 2 * step;
+  for (int y0 = rowBegin; y0 + block < min(rowEnd + block, height); y0 += block)
+  {
+    for (int x0 = 0; x0 + block < width; x0 += block)
+    {
+      size_t corners[4] = {static_cast<size_t>(y0) * width + x0,
+                           static_cast<size_t>(y0) * width + x0 + block,
+                           static_cast<size_t>(y0 + block) * width + x0,
+                           static_cast<size_t>(y0 + block) * width + x0 + block};
+      bool agree = true;
+      for (size_t corner : corners)
+      {
+        agree = agree && iterations[corner] == iterations[corners[0]]
+            && rgb[3 * corner] == rgb[3 * corners[0]];
+      }
+      if (!agree)
+      {
+        continue;
+      }
+      for (int pY = y0; pY < y0 + block; pY++)
+      {
+        for (int pX = x0; pX < x0 + block; pX++)
+        {
+          size_t pixel = static_cast<size_t>(pY) * width + pX;
+          if (!known[pixel])
+          {
+            memcpy(&rgb[3 * pixel], &rgb[3 * corners[0]], 3);
+            iterations[pixel] = iterations[corners[0]];
+            known[pixel] = 1;
+          }
+        }
+      }
+    }
+  }
+}
+
+void ProgressiveRenderer::build_snapshot(int step)
+{
+  snapshot.resize(rgb.size());
+  for (int pY = 0; pY < height; pY++)
+  {
+    for (int pX = 0; pX < width; pX++)
+    {
+      size_t pixel = static_cast<size_t>(pY) * width + pX;
+      // filled pixels are already final, everything else shows its grid point
+      size_t source = known[pixel] ? pixel
+                                   : static_cast<size_t>(pY - pY % step) * width + (pX - pX % step);
+      memcpy(&snapshot[3 * pixel], &rgb[3 * source], 3);
+    }
+  }
+}
+
+void ProgressiveRenderer::run(ThreadPool &pool)
+{
+  size_t pixels = static_cast<size_t>(width) * height;
+  rgb.assign(3 * pixels, 0);
+  iterations.assign(pixels, 0);
+  known.assign(pixels, 0);
+  iterated = 0;
+
+  int step = 1;
+  while (step < coarsestStep)
+  {
+    step *= 2;
+  }
+
+  future<void> writer;
+  for (; step >= 1; step /= 2)
+  {
+    // bands are whole blocks of the previous level, so block fills never cross bands
+    int bandRows = 2 * step * max(1, renderer.get_band_height() / 2);
+    bool fill = blockSkip && step < coarsestStep;
+
+    vector<future<size_t>> bands;
+    for (int rowBegin = 0; rowBegin < height; rowBegin += bandRows)
+    {
+      int rowEnd = min(height, rowBegin + bandRows);
+      bands.push_back(pool.enqueue_task([this, step, rowBegin, rowEnd, fill]()
+                                        {
+                                          if (fill)
+                                          {
+                                            fill_blocks(step, rowBegin, rowEnd);
+                                          }
+                                          return render_level(step, rowBegin, rowEnd);
+                                        }));
+    }
+    for (auto &band : bands)
+    {
+      iterated += band.get();
+    }
+
+    // the previous snapshot must be out before its buffer is rebuilt
+    if (writer.valid())
+    {
+      writer.get();
+    }
+    if (sink)
+    {
+      if (step == 1)
+      {
+        sink(step, rgb);
+      } else {
+        build_snapshot(step);
+        writer = async(launch::async, [this, step]() {sink(step, snapshot);});
+      }
+    }
+  }
+}
@@ -0,0 +1,107 @@
+#ifndef C____PROGRESSIVERENDERER_H_
+#define C____PROGRESSIVERENDERER_H_
+
+#include "FrameRenderer.h"
+#include "ThreadPool.h"
+
+#include <functional>
+#include <vector>
+
+/**
+ * Coarse-to-fine renderer for previews: renders every 8th pixel first, then refines to every
+ * 4th, 2nd and finally every pixel, reusing the pixels of the coarser levels. A snapshot of the
+ * whole image is handed to the sink after each level
+ */
+class ProgressiveRenderer
+{
+ public:
+
+  /**
+   * Receives a full-resolution snapshot after each level
+   * step - grid spacing of the level just finished, 1 for the final image
+   */
+  using Sink = std::function<void(int step, const std::vector<unsigned char> &rgb)>;
+
+  /**
+   * Default parametrized constructor
+   * @param renderer - image size and render parameters
+   */
+  explicit ProgressiveRenderer(const FrameRenderer &renderer);
+
+  /**
+   * @param stepIn - grid spacing of the first level, a power of 2
+   */
+  void set_coarsest_step(int stepIn);
+
+  /**
+   * Skip refining blocks whose four corners have exactly the same iteration count and color;
+   * their pixels are filled from the corners instead
+   * @param blockSkipIn
+   */
+  void set_block_skip(bool blockSkipIn);
+
+  void set_sink(Sink sinkIn);
+
+  /**
+   * Render all levels, returns once the final snapshot has been handed to the sink
+   * @param pool
+   */
+  void run(ThreadPool &pool);
+
+  /**
+   * @return number of pixels actually iterated by the last run()
+   */
+  std::size_t get_iterated() const;
+
+ private:
+
+  /**
+   * Render the pixels of one level within rows [rowBegin, rowEnd)
+   * @param step - grid spacing of the level
+   * @param rowBegin - multiple of 2 * step
+   * @param rowEnd
+   * @return pixels iterated
+   */
+  std::size_t render_level(int step, int rowBegin, int rowEnd);
+
+  /**
+   * Fill blocks of size 2 * step whose corners agree, within rows [rowBegin, rowEnd)
+   * @param step
+   * @param rowBegin
+   * @param rowEnd
+   */
+  void fill_blocks(int step, int rowBegin, int rowEnd);
+
+  /**
+   * Expand the pixels computed so far to a full image, each pixel taking its grid point's color
+   * @param step
+   */
+  void build_snapshot(int step);
+
+  const FrameRenderer &renderer;
+
+  int width;
+
+  int height;
+
+  int coarsestStep;
+
+  bool blockSkip;
+
+  Sink sink;
+
+  std::vector<unsigned char> rgb;
+
+  std::vector<int> iterations;
+
+  /**
+   * 1 for pixels already computed or filled
+   */
+  std::vector<unsigned char> known;
+
+  std::vector<unsigned char> snapshot;
+
+  std::size_t iterated;
+};
+
+#endif //C____PROGRESSIVERENDERER_H_
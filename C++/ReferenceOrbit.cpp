@@ -0,0 +1,56 @@
+#include "ReferenceOrbit.h"
+
+using namespace std;
+
+ReferenceOrbit::ReferenceOrbit(complex<double> center, int iterMax) : center(center), iterMax(0),
+isEscaped(false)
+{
+  orbit.push_back(0.0);
+  extend(iterMax);
+}
+
+void ReferenceOrbit::extend(int iterMaxIn)
+{
+  if (iterMaxIn <= iterMax)
+  {
+    return;
+  }
+  iterMax = iterMaxIn;
+  if (isEscaped)
+  {
+    return;
+  }
+
+  orbit.reserve(static_cast<size_t>(iterMax) + 1);
+  complex<double> z = orbit.back();
+  while (orbit.size() <= static_cast<size_t>(iterMax))
+  {
+    z = z * z + center;
+    orbit.push_back(z);
+    if (abs(z) > escapeRadius)
+    {
+      isEscaped = true;
+      break;
+    }
+  }
+}
+
+complex<double> ReferenceOrbit::get_center() const
+{
+  return center;
+}
+
+size_t ReferenceOrbit::size() const
+{
+  return orbit.size();
+}
+
+bool ReferenceOrbit::escaped() const
+{
+  return isEscaped;
+}
+
+int ReferenceOrbit::get_iterMax() const
+{
+  return iterMax;
+}
@@ -0,0 +1,64 @@
+#ifndef C____REFERENCEORBIT_H_
+#define C____REFERENCEORBIT_H_
+
+#include <complex>
+#include <vector>
+
+/**
+ * Orbit of a single reference point, iterated once and shared by every pixel of a deep view.
+ * Pixels then only iterate their (small) offset from this orbit, which keeps full precision long
+ * after the pixel spacing has fallen below what c itself can resolve
+ */
+class ReferenceOrbit
+{
+ public:
+
+  /**
+   * Default parametrized constructor
+   * @param center - reference point C
+   * @param iterMax - maximum orbit length
+   */
+  ReferenceOrbit(std::complex<double> center, int iterMax);
+
+  /**
+   * Continue the orbit up to a new maximum length, keeping the iterations already computed
+   * @param iterMaxIn
+   */
+  void extend(int iterMaxIn);
+
+  std::complex<double> get_center() const;
+
+  /**
+   * @return number of stored orbit points, Z(0) included
+   */
+  std::size_t size() const;
+
+  /**
+   * @return TRUE if the reference escaped before reaching its maximum length
+   */
+  bool escaped() const;
+
+  int get_iterMax() const;
+
+  const std::complex<double> &operator[](std::size_t n) const
+  {
+    return orbit[n];
+  }
+
+ private:
+
+  std::complex<double> center;
+
+  /**
+   * Z(n) for n = 0 ... size() - 1
+   */
+  std::vector<std::complex<double>> orbit;
+
+  int iterMax;
+
+  bool isEscaped;
+
+  const double escapeRadius = 1000000.0;
+};
+
+#endif //C____REFERENCEORBIT_H_
@@ -0,0 +1,245 @@
+#include "RenderJob.h"
+#include "PPM.h"
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+bool RenderJob::parse(const string &line, RenderJob &job)
+{
+  istringstream fields(line);
+  RenderJob parsed;
+  double centerRe, centerIm, span;
+  if (!(fields >> parsed.fileName >> parsed.width >> parsed.height >> centerRe >> centerIm >> span)
+      || parsed.width <= 0 || parsed.height <= 0 || !(span > 0.0))
+  {
+    return false;
+  }
+  parsed.view = View::from_center({centerRe, centerIm}, span, parsed.width, parsed.height);
+
+  // optional trailing fields, in order; a failed read would zero its field
+  int iterMax, thin;
+  double stripeDensity;
+  if (fields >> iterMax)
+  {
+    parsed.iterMax = iterMax;
+    if (fields >> stripeDensity)
+    {
+      parsed.stripeDensity = stripeDensity;
+      if (fields >> thin)
+      {
+        parsed.thin = thin;
+      }
+    }
+  }
+  if (fields.fail() && !fields.eof())
+  {
+    return false;
+  }
+  job = parsed;
+  return true;
+}
+
+void RenderJob::configure(FrameRenderer &renderer) const
+{
+  renderer.set_view(view);
+  renderer.set_iterMax(iterMax);
+  renderer.set_stripe_density(stripeDensity);
+  renderer.set_border(thin);
+}
+
+BatchRenderer::BatchRenderer(ThreadPool &pool) : pool(pool)
+{
+  jobsInFlight = 2;
+  perturbationThreshold = 1e-12;
+  costModel = nullptr;
+  written = 0;
+  failed = 0;
+  orbitsBuilt = 0;
+  orbitsReused = 0;
+  pixels = 0;
+  seconds = 0.0;
+}
+
+void BatchRenderer::set_jobs_in_flight(size_t jobsInFlightIn)
+{
+  jobsInFlight = max<size_t>(1, jobsInFlightIn);
+}
+
+void BatchRenderer::set_perturbation_threshold(double thresholdIn)
+{
+  perturbationThreshold = thresholdIn;
+}
+
+void BatchRenderer::set_cost_model(CostModel *costModelIn)
+{
+  costModel = costModelIn;
+}
+
+void BatchRenderer::add_job(const RenderJob &job)
+{
+  jobs.push_back(job);
+}
+
+bool BatchRenderer::add_job_file(const string &path)
+{
+  ifstream file(path);
+  if (!file)
+  {
+    cout << "Could not open job file " << path << "\n";
+    return false;
+  }
+  bool valid = true;
+  string line;
+  for (int lineNumber = 1; getline(file, line); lineNumber++)
+  {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == string::npos || line[start] == '#')
+    {
+      continue;
+    }
+    RenderJob job;
+    if (RenderJob::parse(line, job))
+    {
+      jobs.push_back(job);
+    } else {
+      cout << path << ":" << lineNumber << ": malformed job, skipped\n";
+      valid = false;
+    }
+  }
+  return valid;
+}
+
+size_t BatchRenderer::get_job_count() const
+{
+  return jobs.size();
+}
+
+shared_ptr<const ReferenceOrbit> BatchRenderer::reference_orbit(const RenderJob &job)
+{
+  if (cachedOrbit && cachedOrbit->get_center() == job.view.center
+      && cachedOrbit->get_iterMax() >= job.iterMax)
+  {
+    orbitsReused++;
+    return cachedOrbit;
+  }
+  // running jobs may still read the cached orbit, so it is replaced rather than extended
+  cachedOrbit = make_shared<const ReferenceOrbit>(job.view.center, job.iterMax);
+  orbitsBuilt++;
+  return cachedOrbit;
+}
+
+unique_ptr<BatchRenderer::Running> BatchRenderer::start(const RenderJob &job)
+{
+  auto running = make_unique<Running>();
+  running->job = job;
+  running->renderer = make_unique<FrameRenderer>(job.width, job.height);
+  job.configure(*running->renderer);
+  running->renderer->set_cost_model(costModel);
+  if (job.view.spanRe / job.width < perturbationThreshold)
+  {
+    running->orbit = reference_orbit(job);
+    running->renderer->set_reference(running->orbit.get(), 0.0);
+    running->bla = make_unique<BLATable>(*running->orbit, running->renderer->max_reference_offset(),
+                                         job.stripeDensity);
+    running->renderer->set_bla(running->bla.get());
+  }
+  running->bands = running->renderer->render_async(pool, running->rgb, running->iterations);
+  return running;
+}
+
+void BatchRenderer::finish(unique_ptr<Running> running)
+{
+  // every band must be done before the images and renderer are freed, even when one threw
+  for (auto &band : running->bands)
+  {
+    band.wait();
+  }
+  try
+  {
+    for (auto &band : running->bands)
+    {
+      band.get();
+    }
+  } catch (const exception &e) {
+    cout << "Job " << running->job.fileName << " failed: " << e.what() << "\n";
+    failed++;
+    return;
+  }
+  pixels += static_cast<uint64_t>(running->job.width) * running->job.height;
+
+  // bound the images waiting for the disk as well
+  while (writers.size() >= jobsInFlight)
+  {
+    (writers.front().get() ? written : failed)++;
+    writers.pop_front();
+  }
+  writers.push_back(async(launch::async, [finished = std::move(running)]()
+                          {
+                            return write_image(finished->job, finished->rgb);
+                          }));
+}
+
+bool BatchRenderer::write_image(const RenderJob &job, const vector<unsigned char> &rgb)
+{
+  PPM pgm(job.fileName, job.width, job.height);
+  if (!pgm.init_stream())
+  {
+    cout << "Could not open ofstream for image\n";
+    return false;
+  }
+  pgm.write_header();
+  pgm.write_row(rgb); // image rows are contiguous
+  pgm.close();
+  return true;
+}
+
+size_t BatchRenderer::run()
+{
+  auto begin = chrono::steady_clock::now();
+  size_t writtenBefore = written;
+
+  deque<unique_ptr<Running>> running;
+  for (const auto &job : jobs)
+  {
+    if (running.size() >= jobsInFlight)
+    {
+      finish(std::move(running.front()));
+      running.pop_front();
+    }
+    running.push_back(start(job));
+  }
+  while (!running.empty())
+  {
+    finish(std::move(running.front()));
+    running.pop_front();
+  }
+  while (!writers.empty())
+  {
+    (writers.front().get() ? written : failed)++;
+    writers.pop_front();
+  }
+
+  seconds += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  return written - writtenBefore;
+}
+
+ostream &operator<<(ostream &os, const BatchRenderer &batch)
+{
+  os << "Batch: " << batch.written << " of " << batch.jobs.size() << " jobs written";
+  if (batch.failed > 0)
+  {
+    os << ", " << batch.failed << " failed";
+  }
+  os << ", " << batch.jobsInFlight << " in flight\n";
+  os << "Throughput: " << batch.pixels / 1e6 / max(batch.seconds, 1e-9) << " Mpixel/sec, "
+     << batch.written / max(batch.seconds, 1e-9) << " images/sec\n";
+  if (batch.orbitsBuilt + batch.orbitsReused > 0)
+  {
+    os << "Reference orbits: " << batch.orbitsBuilt << " built, " << batch.orbitsReused
+       << " reused\n";
+  }
+  return os;
+}
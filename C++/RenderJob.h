@@ -0,0 +1,173 @@
+#ifndef C____RENDERJOB_H_
+#define C____RENDERJOB_H_
+
+#include "BLATable.h"
+#include "CostModel.h"
+#include "FrameRenderer.h"
+#include "ReferenceOrbit.h"
+#include "ThreadPool.h"
+#include "View.h"
+
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Everything needed to render one image, without touching code or stdin
+ */
+struct RenderJob
+{
+  std::string fileName = "gigabrot_default.ppm";
+
+  int width = 1000;
+
+  int height = 1000;
+
+  View view = View::from_plane(-2.2, 0.8, -1.5, 1.5);
+
+  int iterMax = 1000;
+
+  double stripeDensity = 7.0;
+
+  int thin = 3;
+
+  /**
+   * Parse one job file line:
+   * name.ppm width height centerRe centerIm span [iterMax [stripeDensity [thin]]]
+   * span is the width of the view along the real axis
+   * @param line
+   * @param job - filled in on success
+   * @return FALSE for malformed lines
+   */
+  static bool parse(const std::string &line, RenderJob &job);
+
+  /**
+   * Apply the job's parameters to a renderer of the job's size
+   * @param renderer
+   */
+  void configure(FrameRenderer &renderer) const;
+};
+
+/**
+ * Runs many jobs through one shared pool. Jobs are pipelined: the bands of the next jobs are
+ * queued behind those of the current one, so workers never wait for a job to finish, and each
+ * finished image is written on its own thread while later jobs compute. Deep views reuse the
+ * last reference orbit when they share its center
+ */
+class BatchRenderer
+{
+ public:
+
+  /**
+   * Default parametrized constructor
+   * @param pool - shared by every job
+   */
+  explicit BatchRenderer(ThreadPool &pool);
+
+  /**
+   * @param jobsInFlightIn - jobs queued on the pool at once (default 2); as many rendered images
+   * may wait for the disk, so at most twice this many images are held in memory
+   */
+  void set_jobs_in_flight(std::size_t jobsInFlightIn);
+
+  /**
+   * @param thresholdIn - pixel width below which jobs are perturbed against a reference orbit
+   */
+  void set_perturbation_threshold(double thresholdIn);
+
+  /**
+   * @param costModelIn - plans the bands of every job, see FrameRenderer::set_cost_model(); jobs
+   * on nearby views reuse the band times of earlier ones. nullptr for bands of equal height
+   */
+  void set_cost_model(CostModel *costModelIn);
+
+  void add_job(const RenderJob &job);
+
+  /**
+   * Read jobs from a file, one per line; blank lines and lines starting with # are skipped
+   * @param path
+   * @return FALSE if the file could not be opened or had malformed lines
+   */
+  bool add_job_file(const std::string &path);
+
+  std::size_t get_job_count() const;
+
+  /**
+   * Render and write every job
+   * @return number of images written
+   */
+  std::size_t run();
+
+  friend std::ostream &operator<<(std::ostream &os, const BatchRenderer &batch);
+
+ private:
+
+  /**
+   * A job whose bands are on the pool
+   */
+  struct Running
+  {
+    RenderJob job;
+
+    std::unique_ptr<FrameRenderer> renderer;
+
+    std::shared_ptr<const ReferenceOrbit> orbit;
+
+    std::unique_ptr<BLATable> bla;
+
+    std::vector<unsigned char> rgb;
+
+    std::vector<int> iterations;
+
+    std::vector<std::future<void>> bands;
+  };
+
+  /**
+   * Set up a job and queue its bands
+   */
+  std::unique_ptr<Running> start(const RenderJob &job);
+
+  /**
+   * Wait for a job's bands and hand the image to a writer thread
+   */
+  void finish(std::unique_ptr<Running> running);
+
+  /**
+   * @return orbit for a deep job, the cached one if it has the same center and enough iterations
+   */
+  std::shared_ptr<const ReferenceOrbit> reference_orbit(const RenderJob &job);
+
+  static bool write_image(const RenderJob &job, const std::vector<unsigned char> &rgb);
+
+  ThreadPool &pool;
+
+  std::vector<RenderJob> jobs;
+
+  std::size_t jobsInFlight;
+
+  double perturbationThreshold;
+
+  CostModel *costModel;
+
+  std::shared_ptr<const ReferenceOrbit> cachedOrbit;
+
+  std::deque<std::future<bool>> writers;
+
+  // totals
+  std::size_t written;
+
+  std::size_t failed;
+
+  std::size_t orbitsBuilt;
+
+  std::size_t orbitsReused;
+
+  std::uint64_t pixels;
+
+  double seconds;
+};
+
+#endif //C____RENDERJOB_H_
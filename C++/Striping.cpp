@@ -3,7 +3,11 @@
 using namespace std;
 
 Striping::Striping(double average, complex<double> z, complex<double> dc) : Shading("Striping"),
-average(average), reflection(z, dc)
+average(average), reflection(Neumorphic(z, dc).calculate())
+{}
+
+Striping::Striping(double average, double reflection) : Shading("Striping"), average(average),
+reflection(reflection)
 {}
 
 Striping::~Striping()
@@ -12,7 +16,7 @@ Striping::~Striping()
 unsigned char Striping::calculate_bw()
 {
   return static_cast<unsigned char>((static_cast<double>((maxColorValue - 1)) - (100.0 *
-  average)) * reflection.calculate()); // explicit casting
+  average)) * reflection); // explicit casting
 }
 
 unsigned char Striping::calculate_r()
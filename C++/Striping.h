@@ -10,6 +10,13 @@ class Striping : public Shading
 
   Striping(double average, std::complex<double> z, std::complex<double> dc);
 
+  /**
+   * Striping from an already computed Neumorphic reflection
+   * @param average - stripe average
+   * @param reflection - Neumorphic::calculate() of the pixel
+   */
+  Striping(double average, double reflection);
+
   ~Striping();
 
   unsigned char calculate_bw();
@@ -26,7 +33,7 @@ class Striping : public Shading
 
   double average;
 
-  Neumorphic reflection;
+  double reflection;
 };
 
 #endif //C___STRIPING_H
\ No newline at end of file
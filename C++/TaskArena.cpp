@@ -0,0 +1,183 @@
+#include "TaskArena.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+
+/**
+ * In front of every block; links the block into a freelist while it is free
+ */
+struct alignas(max_align_t) Header
+{
+  size_t sizeClass;
+
+  Header *next;
+};
+
+/**
+ * Chain of free blocks of one class
+ */
+struct Chain
+{
+  Header *head = nullptr;
+
+  size_t length = 0;
+
+  void push(Header *block)
+  {
+    block->next = head;
+    head = block;
+    length++;
+  }
+
+  Header *pop()
+  {
+    Header *block = head;
+    head = block->next;
+    length--;
+    return block;
+  }
+
+  /**
+   * @param count - at most length
+   * @return the first count blocks as their own chain
+   */
+  Chain split(size_t count)
+  {
+    Chain front{head, count};
+    Header *last = head;
+    for (size_t i = 1; i < count; i++)
+    {
+      last = last->next;
+    }
+    head = last->next;
+    last->next = nullptr;
+    length -= count;
+    return front;
+  }
+};
+
+/**
+ * Batches handed back by threads, shared by all threads
+ */
+struct Depot
+{
+  mutex lock;
+
+  vector<Chain> chains[TaskArena::classes];
+};
+
+atomic<uint64_t> heapBlocks{0};
+
+/**
+ * Never destroyed, blocks may be freed by thread_local destructors during exit
+ */
+Depot &depot()
+{
+  static Depot *shared = new Depot;
+  return *shared;
+}
+
+size_t payload(size_t sizeClass)
+{
+  return TaskArena::smallestBlock << sizeClass;
+}
+
+/**
+ * The calling thread's freelists
+ */
+struct Cache
+{
+  Chain free[TaskArena::classes];
+
+  ~Cache()
+  {
+    Depot &shared = depot();
+    scoped_lock guard(shared.lock);
+    for (size_t c = 0; c < TaskArena::classes; c++)
+    {
+      if (free[c].length > 0)
+      {
+        shared.chains[c].push_back(free[c]);
+      }
+    }
+  }
+};
+
+thread_local Cache cache;
+
+} // namespace
+
+void *TaskArena::allocate(size_t bytes)
+{
+  size_t sizeClass = 0;
+  while (sizeClass < classes && payload(sizeClass) < bytes)
+  {
+    sizeClass++;
+  }
+
+  Header *block = nullptr;
+  if (sizeClass < classes)
+  {
+    Chain &free = cache.free[sizeClass];
+    if (free.length == 0)
+    {
+      Depot &shared = depot();
+      scoped_lock guard(shared.lock);
+      if (!shared.chains[sizeClass].empty())
+      {
+        free = shared.chains[sizeClass].back();
+        shared.chains[sizeClass].pop_back();
+      }
+    }
+    if (free.length > 0)
+    {
+      block = free.pop();
+    }
+  }
+  if (block == nullptr)
+  {
+    size_t size = sizeof(Header) + ((sizeClass < classes) ? payload(sizeClass) : bytes);
+    block = static_cast<Header *>(::operator new(size));
+    heapBlocks.fetch_add(1, memory_order_relaxed);
+  }
+  block->sizeClass = sizeClass;
+  return block + 1;
+}
+
+void TaskArena::deallocate(void *pointer) noexcept
+{
+  if (pointer == nullptr)
+  {
+    return;
+  }
+  Header *block = static_cast<Header *>(pointer) - 1;
+  size_t sizeClass = block->sizeClass;
+  if (sizeClass == classes)
+  {
+    ::operator delete(block);
+    return;
+  }
+
+  Chain &free = cache.free[sizeClass];
+  free.push(block);
+  if (free.length >= 2 * batch)
+  {
+    Chain spare = free.split(batch);
+    Depot &shared = depot();
+    scoped_lock guard(shared.lock);
+    shared.chains[sizeClass].push_back(spare);
+  }
+}
+
+uint64_t TaskArena::heap_blocks()
+{
+  return heapBlocks.load(memory_order_relaxed);
+}
@@ -0,0 +1,89 @@
+#ifndef C____TASKARENA_H_
+#define C____TASKARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Storage for task state too big to live inline: captures of large callables and the shared
+ * state of futures. Blocks come in a few size classes and are recycled through a freelist per
+ * thread; a thread whose list runs long hands a batch to a shared depot, one whose list runs dry
+ * takes a batch back, so a producer thread and the workers freeing its tasks settle into reusing
+ * the same blocks and steady-state submission does not touch malloc
+ */
+class TaskArena
+{
+ public:
+
+  /**
+   * @param bytes
+   * @return block of at least bytes, aligned for any type
+   */
+  static void *allocate(std::size_t bytes);
+
+  /**
+   * Return a block to the calling thread's freelist, on any thread
+   * @param block - from allocate(), may be nullptr
+   */
+  static void deallocate(void *block) noexcept;
+
+  /**
+   * @return blocks taken from the heap so far, for all threads
+   */
+  static std::uint64_t heap_blocks();
+
+  /**
+   * payload of the smallest class; each class doubles it
+   */
+  inline static const std::size_t smallestBlock = 64;
+
+  /**
+   * larger requests go straight to the heap
+   */
+  inline static const std::size_t classes = 6;
+
+  /**
+   * blocks moved between a thread and the depot at once
+   */
+  inline static const std::size_t batch = 32;
+};
+
+/**
+ * Allocator over the arena, for std::promise and other allocator-aware task state
+ * @tparam T
+ */
+template<typename T>
+struct TaskAllocator
+{
+  using value_type = T;
+
+  TaskAllocator() noexcept = default;
+
+  template<typename U>
+  TaskAllocator(const TaskAllocator<U> &) noexcept
+  {}
+
+  T *allocate(std::size_t n)
+  {
+    return static_cast<T *>(TaskArena::allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *block, std::size_t) noexcept
+  {
+    TaskArena::deallocate(block);
+  }
+
+  template<typename U>
+  bool operator==(const TaskAllocator<U> &) const noexcept
+  {
+    return true;
+  }
+
+  template<typename U>
+  bool operator!=(const TaskAllocator<U> &) const noexcept
+  {
+    return false;
+  }
+};
+
+#endif //C____TASKARENA_H_
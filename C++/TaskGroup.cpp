@@ -0,0 +1,74 @@
+#include "TaskGroup.h"
+
+using namespace std;
+
+TaskGroup::TaskGroup(ThreadPool &pool, ThreadPool::TaskOptions options) : pool(pool),
+options(move(options)), state(make_shared<State>())
+{}
+
+TaskGroup::~TaskGroup()
+{
+  try
+  {
+    wait();
+  } catch (...)
+  {
+    // nobody asked for it
+  }
+}
+
+void TaskGroup::wait()
+{
+  while (state->pending.load(memory_order_acquire) > 0)
+  {
+    if (pool.run_pending_task())
+    {
+      continue;
+    }
+    // the group's remaining tasks are running elsewhere, or the queues were busy
+    unique_lock guard(state->lock);
+    state->done.wait_for(guard, helpInterval,
+                         [this]() {return state->pending.load(memory_order_acquire) == 0;});
+  }
+
+  exception_ptr error;
+  {
+    scoped_lock guard(state->lock);
+    error = exchange(state->error, nullptr);
+    state->cancelled.store(false, memory_order_relaxed);
+  }
+  if (error)
+  {
+    rethrow_exception(error);
+  }
+}
+
+void TaskGroup::cancel()
+{
+  state->cancelled.store(true, memory_order_relaxed);
+}
+
+size_t TaskGroup::pending() const
+{
+  return state->pending.load(memory_order_relaxed);
+}
+
+void TaskGroup::State::fail(exception_ptr exception)
+{
+  scoped_lock guard(lock);
+  if (!error)
+  {
+    error = move(exception);
+  }
+  cancelled.store(true, memory_order_relaxed);
+}
+
+void TaskGroup::State::finish()
+{
+  if (pending.fetch_sub(1, memory_order_acq_rel) == 1)
+  {
+    // under the lock, so a waiter between its check and its wait cannot miss the notification
+    scoped_lock guard(lock);
+    done.notify_all();
+  }
+}
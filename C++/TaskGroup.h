@@ -0,0 +1,148 @@
+#ifndef C____TASKGROUP_H_
+#define C____TASKGROUP_H_
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+/**
+ * Tasks submitted to a pool under one handle, so that a caller can wait for just its own work
+ * and one long-lived pool serves any number of renders. wait() runs queued pool work on the
+ * waiting thread until the group is done, then rethrows the first exception a task threw; that
+ * exception also drops the group's tasks that have not started yet. A group can be reused after
+ * wait() returns
+ */
+class TaskGroup
+{
+ public:
+
+  /**
+   * Default parametrized constructor
+   * @param pool - runs the tasks, must outlive the group
+   * @param options - priority and cancellation of every task of the group
+   */
+  explicit TaskGroup(ThreadPool &pool, ThreadPool::TaskOptions options = {});
+
+  /**
+   * Waits for the tasks still in the group; exceptions are dropped, call wait() to see them
+   */
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup &) = delete;
+
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  /**
+   * Submit a task to the group
+   * @tparam T - callable as void()
+   * @param work
+   */
+  template<typename T>
+  void run(T &&work)
+  {
+    state->pending.fetch_add(1, std::memory_order_relaxed);
+    pool.enqueue_work_with(options, [completion = Completion(state),
+                                     work = std::forward<T>(work)]() mutable
+                                    {
+                                      if (completion.state->cancelled.load(
+                                          std::memory_order_relaxed))
+                                      {
+                                        return;
+                                      }
+                                      try
+                                      {
+                                        work();
+                                      } catch (...)
+                                      {
+                                        completion.state->fail(std::current_exception());
+                                      }
+                                    });
+  }
+
+  /**
+   * Run pool work on the calling thread until every task of the group has finished or was
+   * dropped, then rethrow the first exception of a task, if any
+   */
+  void wait();
+
+  /**
+   * Drop the tasks of the group that have not started; running ones finish
+   */
+  void cancel();
+
+  /**
+   * @return tasks submitted and not yet finished or dropped
+   */
+  std::size_t pending() const;
+
+  /**
+   * How long wait() blocks between looking for queued work when none was found
+   */
+  inline static const std::chrono::microseconds helpInterval{500};
+
+ private:
+
+  struct State
+  {
+    std::atomic<std::size_t> pending{0};
+
+    std::atomic<bool> cancelled{false};
+
+    std::mutex lock;
+
+    std::condition_variable done;
+
+    std::exception_ptr error;
+
+    /**
+     * Keep the first exception and drop the tasks that have not started
+     * @param exception
+     */
+    void fail(std::exception_ptr exception);
+
+    void finish();
+  };
+
+  /**
+   * Finishes a task of the group when destroyed, both after the task ran and when the pool
+   * drops it for a cancelled token
+   */
+  struct Completion
+  {
+    explicit Completion(std::shared_ptr<State> stateIn) : state(std::move(stateIn))
+    {}
+
+    Completion(Completion &&other) noexcept : state(std::move(other.state))
+    {}
+
+    Completion &operator=(Completion &&) = delete;
+
+    ~Completion()
+    {
+      if (state)
+      {
+        state->finish();
+      }
+    }
+
+    std::shared_ptr<State> state;
+  };
+
+  ThreadPool &pool;
+
+  ThreadPool::TaskOptions options;
+
+  /**
+   * shared with the tasks, so a task finishing never touches a destroyed group
+   */
+  std::shared_ptr<State> state;
+};
+
+#endif //C____TASKGROUP_H_
@@ -1,6 +1,7 @@
 #include "ThreadPool.h"
 
-ThreadPool::ThreadPool(unsigned int numThreads) : queues(numThreads), count(numThreads)
+ThreadPool::ThreadPool(unsigned int numThreads, Affinity affinity) : queues(numThreads),
+victims(numThreads), topology(Topology::detect()), nodes(numThreads, 0), count(numThreads)
 {
   if (!numThreads)
   {
@@ -9,22 +10,133 @@ ThreadPool::ThreadPool(unsigned int numThreads) : queues(numThreads), count(numT
     throw std::invalid_argument("thread count must be positive! how did this happen??");
   }
 
-  auto worker = [this] (auto i) {
+  counters = std::make_unique<WorkerCounters[]>(count);
+  spin = (std::thread::hardware_concurrency() > 1) ? spinTime : std::chrono::microseconds(0);
+
+  // placement: nodes round-robin, then cores round-robin within the node
+  std::vector<std::vector<int>> cpus(count);
+  if (affinity != Affinity::None)
+  {
+    std::size_t nodeCount = topology.node_count();
+    for (std::size_t i = 0; i < count; i++)
+    {
+      nodes[i] = i % nodeCount;
+      const std::vector<int> &nodeCpus = topology.node_cpus(nodes[i]);
+      if (affinity == Affinity::Core)
+      {
+        cpus[i] = {nodeCpus[(i / nodeCount) % nodeCpus.size()]};
+      } else {
+        cpus[i] = nodeCpus;
+      }
+    }
+  }
+
+  for (std::size_t i = 0; i < count; i++)
+  {
+    victims[i].push_back(i);
+    for (std::size_t j = 1; j < count; j++)
+    {
+      if (nodes[(i + j) % count] == nodes[i])
+      {
+        victims[i].push_back((i + j) % count);
+      }
+    }
+    for (std::size_t j = 1; j < count; j++)
+    {
+      if (nodes[(i + j) % count] != nodes[i])
+      {
+        victims[i].push_back((i + j) % count);
+      }
+    }
+  }
+
+  auto worker = [this] (auto i, std::vector<int> cpuSet) {
+    if (!cpuSet.empty())
+    {
+      Topology::pin_current_thread(cpuSet);
+    }
+    Tracer::name_thread("worker " + std::to_string(i));
+    workerNode = nodes[i];
+    // first touch of the queue from the (pinned) worker keeps it on the worker's node
+    {
+      std::unique_lock guard(startLock);
+      queues[i] = std::make_unique<queue>();
+      queuesBuilt++;
+      started.notify_all();
+      started.wait(guard, [this] () {return queuesBuilt == count;});
+    }
+
+    const std::vector<std::size_t> &order = victims[i];
+    WorkerCounters &counter = counters[i];
     while (true)
     {
-      process proc;
+      // the first round of probes only takes high priority work
+      Task task;
       for (auto j = 0; j < count * countMult; j++)
       {
-        if (queues[(i + j) % count].try_pop(proc))
+        if (queues[order[j % count]]->try_pop(task, (j < count) ? 0 : priorities - 1))
         {
+          bump((j % count == 0) ? counter.ownPops : counter.steals);
           break;
         }
+        bump(counter.failedProbes);
       }
-      if (!proc && !queues[i].pop(proc))
+      // spin a little before parking, a burst of work usually arrives in quick succession
+      for (auto spinEnd = clock::now() + spin; !task.work && clock::now() < spinEnd;)
       {
-        break;
+        std::this_thread::yield();
+        for (auto j = 0; j < count; j++)
+        {
+          if (queues[order[j]]->try_pop(task))
+          {
+            bump((j == 0) ? counter.ownPops : counter.steals);
+            bump(counter.spunPops);
+            break;
+          }
+        }
       }
-      proc();
+      if (!task.work)
+      {
+        bump(counter.parks);
+        auto parked = clock::now();
+        bool popped;
+        {
+          Tracer::Span idle("idle", "pool");
+          popped = queues[i]->pop(task);
+        }
+        bump(counter.idleNanoseconds, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock::now() - parked).count());
+        if (!popped)
+        {
+          break;
+        }
+        bump(counter.ownPops);
+      }
+
+      if (task.token && task.token->cancelled())
+      {
+        bump(counter.cancelled);
+        continue;
+      }
+
+      auto begin = clock::now();
+      auto waited = std::chrono::duration_cast<std::chrono::microseconds>(begin - task.enqueued)
+          .count();
+      std::size_t bucket = 0;
+      while (bucket + 1 < latencyBuckets && (std::int64_t{1} << bucket) <= waited)
+      {
+        bucket++;
+      }
+      bump(counter.latency[bucket]);
+
+      {
+        Tracer::Span run("task", "pool");
+        task.work();
+      }
+
+      bump(counter.busyNanoseconds, std::chrono::duration_cast<std::chrono::nanoseconds>(
+          clock::now() - begin).count());
+      bump(counter.tasks);
     }
   };
 
@@ -32,18 +144,173 @@ ThreadPool::ThreadPool(unsigned int numThreads) : queues(numThreads), count(numT
 
   for (auto i = 0; i < numThreads; i++)
   {
-    threads.emplace_back(worker, i);
+    threads.emplace_back(worker, i, cpus[i]);
   }
+
+  std::unique_lock guard(startLock);
+  started.wait(guard, [this] () {return queuesBuilt == count;});
+}
+
+void ThreadPool::submit(process work, const TaskOptions &options)
+{
+  Task task{std::move(work), clock::now(), options.token};
+  auto lane = static_cast<std::size_t>(options.priority);
+
+  auto i = index++;
+
+  // try_push only moves from the task when it succeeds
+  for (auto j = 0; j < count * countMult; j++)
+  {
+    if (queues[(i + j) % count]->try_push(std::move(task), lane))
+    {
+      return;
+    }
+    failedPushes.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  blockingPushes.fetch_add(1, std::memory_order_relaxed);
+  queues[i % count]->push(std::move(task), lane);
+}
+
+bool ThreadPool::run_pending_task()
+{
+  Task task;
+  auto start = index.load(std::memory_order_relaxed);
+  for (std::size_t lane = 0; lane < priorities && !task.work; lane++)
+  {
+    for (std::size_t j = 0; j < count; j++)
+    {
+      if (queues[(start + j) % count]->try_pop(task, lane))
+      {
+        break;
+      }
+    }
+  }
+  if (!task.work)
+  {
+    return false;
+  }
+
+  helpedTasks.fetch_add(1, std::memory_order_relaxed);
+  if (task.token && task.token->cancelled())
+  {
+    return true;
+  }
+  Tracer::Span run("task", "pool");
+  task.work();
+  return true;
+}
+
+void ThreadPool::enqueue_bulk_with(const TaskOptions &options, std::vector<process> work)
+{
+  if (work.empty())
+  {
+    return;
+  }
+  auto enqueued = clock::now();
+  auto lane = static_cast<std::size_t>(options.priority);
+
+  // dealt round-robin like single submissions, so neighbouring items (and their costs) spread
+  // over the workers: queue i takes items i, i + used, ... under one lock, straight from work
+  std::size_t used = std::min(count, work.size());
+  std::size_t first = index.fetch_add(static_cast<unsigned int>(work.size()));
+  for (std::size_t i = 0; i < used; i++)
+  {
+    std::size_t share = (work.size() - i + used - 1) / used;
+    queues[(first + i) % count]->push_bulk(share, [&work, &enqueued, &options, i, used]
+        (std::size_t k)
+        {
+          return Task{std::move(work[i + k * used]), enqueued, options.token};
+        }, lane);
+  }
+}
+
+ThreadPool::Metrics ThreadPool::metrics() const
+{
+  Metrics snapshot;
+  snapshot.workers.resize(count);
+  for (std::size_t i = 0; i < count; i++)
+  {
+    const WorkerCounters &counter = counters[i];
+    Metrics::Worker &worker = snapshot.workers[i];
+    worker.tasks = counter.tasks.load(std::memory_order_relaxed);
+    worker.ownPops = counter.ownPops.load(std::memory_order_relaxed);
+    worker.steals = counter.steals.load(std::memory_order_relaxed);
+    worker.failedProbes = counter.failedProbes.load(std::memory_order_relaxed);
+    worker.parks = counter.parks.load(std::memory_order_relaxed);
+    worker.spunPops = counter.spunPops.load(std::memory_order_relaxed);
+    worker.cancelled = counter.cancelled.load(std::memory_order_relaxed);
+    worker.busySeconds = 1e-9 * counter.busyNanoseconds.load(std::memory_order_relaxed);
+    worker.idleSeconds = 1e-9 * counter.idleNanoseconds.load(std::memory_order_relaxed);
+    worker.queueHighWater = queues[i]->high_water();
+    for (std::size_t b = 0; b < latencyBuckets; b++)
+    {
+      worker.latency[b] = counter.latency[b].load(std::memory_order_relaxed);
+    }
+  }
+  snapshot.failedPushes = failedPushes.load(std::memory_order_relaxed);
+  snapshot.blockingPushes = blockingPushes.load(std::memory_order_relaxed);
+  snapshot.taskHeapBlocks = TaskArena::heap_blocks();
+  snapshot.helpedTasks = helpedTasks.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+std::ostream &operator<<(std::ostream &os, const ThreadPool::Metrics &metrics)
+{
+  std::uint64_t tasks = 0;
+  std::uint64_t latency[ThreadPool::latencyBuckets] = {};
+  for (const auto &worker : metrics.workers)
+  {
+    tasks += worker.tasks;
+    for (std::size_t b = 0; b < ThreadPool::latencyBuckets; b++)
+    {
+      latency[b] += worker.latency[b];
+    }
+  }
+
+  os << "Pool: " << metrics.workers.size() << " workers, " << tasks << " tasks, "
+     << metrics.failedPushes << " failed push probes, " << metrics.blockingPushes
+     << " blocking pushes, " << metrics.taskHeapBlocks << " task storage blocks from the heap, "
+     << metrics.helpedTasks << " tasks run by waiting threads\n";
+  for (std::size_t i = 0; i < metrics.workers.size(); i++)
+  {
+    const auto &worker = metrics.workers[i];
+    os << "  worker " << i << ": " << worker.tasks << " tasks (" << worker.ownPops << " own, "
+       << worker.steals << " stolen, " << worker.failedProbes << " failed probes), busy "
+       << worker.busySeconds << " sec, idle " << worker.idleSeconds << " sec in " << worker.parks
+       << " parks (" << worker.spunPops << " tasks found spinning), " << worker.cancelled << " cancelled, queue high-water "
+       << worker.queueHighWater << "\n";
+  }
+  os << "  queue wait:";
+  for (std::size_t b = 0; b < ThreadPool::latencyBuckets; b++)
+  {
+    if (latency[b] == 0)
+    {
+      continue;
+    }
+    if (b + 1 < ThreadPool::latencyBuckets)
+    {
+      os << " <" << (std::uint64_t{1} << b) << "us " << latency[b];
+    } else {
+      os << " longer " << latency[b];
+    }
+  }
+  os << "\n";
+  return os;
 }
 
 ThreadPool::~ThreadPool()
 {
   for (auto& queue: queues)
   {
-    queue.unblock();
+    queue->unblock();
   }
   for (auto& thread : threads)
   {
     thread.join();
   }
-}
\ No newline at end of file
+  if (metricsStream != nullptr)
+  {
+    *metricsStream << metrics();
+  }
+}
@@ -1,7 +1,12 @@
 #ifndef C____THREADPOOL_H_
 #define C____THREADPOOL_H_
 
+#include "CancellationToken.h"
+#include "TaskArena.h"
+#include "Topology.h"
+#include "Tracer.h"
 #include "UnboundedQueue.h"
+#include "UniqueFunction.h"
 
 #include <thread>
 #include <mutex>
@@ -9,6 +14,14 @@
 #include <functional>
 #include <atomic>
 #include <future>
+#include <memory>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <tuple>
+#include <type_traits>
 
 /**
  * Only using C++ intrinsics
@@ -17,64 +30,370 @@ class ThreadPool
 {
  public:
 
-  explicit ThreadPool(unsigned int numThreads);
+  /**
+   * Where workers run. Pinned workers are spread round-robin over the NUMA nodes, build their
+   * own queue so it is first touched on their node, and steal from workers on the same node
+   * before crossing to another
+   */
+  enum class Affinity
+  {
+    None, // let the OS place (and migrate) the workers
+    Core, // one core per worker
+    Node  // any core of one node per worker
+  };
+
+  /**
+   * Order in which queued tasks start: workers take high priority work from any queue before
+   * anything else, and within a queue never start a task while one of higher priority waits
+   */
+  enum class Priority
+  {
+    High,   // e.g. tiles on screen
+    Normal,
+    Low     // e.g. prefetch
+  };
+
+  inline static const std::size_t priorities = 3;
+
+  /**
+   * How a task is scheduled
+   */
+  struct TaskOptions
+  {
+    Priority priority = Priority::Normal;
+
+    /**
+     * a task whose token is cancelled before it starts is dropped; the future of a dropped
+     * enqueue_task() throws std::future_error (broken_promise)
+     */
+    std::optional<CancellationToken> token;
+  };
+
+  explicit ThreadPool(unsigned int numThreads, Affinity affinity = Affinity::None);
 
   ~ThreadPool();
 
+  /**
+   * @return number of worker threads
+   */
+  std::size_t get_thread_count() const
+  {
+    return count;
+  }
+
+  /**
+   * @param worker
+   * @return NUMA node a worker was placed on, 0 when unpinned
+   */
+  std::size_t get_node(std::size_t worker) const
+  {
+    return nodes[worker];
+  }
+
+  /**
+   * @return NUMA node of the calling worker, 0 on threads that are no pool worker or when the
+   * workers are not pinned
+   */
+  static std::size_t current_node()
+  {
+    return workerNode;
+  }
+
+  /**
+   * @return machine topology the workers were placed on
+   */
+  const Topology &get_topology() const
+  {
+    return topology;
+  }
+
+  /**
+   * Buckets of the task latency histogram: bucket b counts tasks that waited in a queue under
+   * 2^b microseconds, the last bucket everything longer
+   */
+  inline static const std::size_t latencyBuckets = 24;
+
+  /**
+   * Counters of the pool at one point in time
+   */
+  struct Metrics
+  {
+    struct Worker
+    {
+      std::uint64_t tasks;
+
+      /**
+       * tasks popped from the worker's own queue
+       */
+      std::uint64_t ownPops;
+
+      /**
+       * tasks taken from another worker's queue
+       */
+      std::uint64_t steals;
+
+      /**
+       * try_pop calls that came back empty or found the queue locked
+       */
+      std::uint64_t failedProbes;
+
+      /**
+       * times the worker fell back to the blocking pop
+       */
+      std::uint64_t parks;
+
+      /**
+       * tasks found while spinning before a park
+       */
+      std::uint64_t spunPops;
+
+      /**
+       * tasks dropped because their token was cancelled
+       */
+      std::uint64_t cancelled;
+
+      double busySeconds;
+
+      double idleSeconds;
+
+      std::size_t queueHighWater;
+
+      std::uint64_t latency[latencyBuckets];
+    };
+
+    std::vector<Worker> workers;
+
+    /**
+     * try_push calls that found a queue locked
+     */
+    std::uint64_t failedPushes;
+
+    /**
+     * enqueues that fell back to the blocking push
+     */
+    std::uint64_t blockingPushes;
+
+    /**
+     * task storage blocks taken from the heap, see TaskArena
+     */
+    std::uint64_t taskHeapBlocks;
+
+    /**
+     * tasks run by threads waiting on the pool's work, see run_pending_task()
+     */
+    std::uint64_t helpedTasks;
+  };
+
+  /**
+   * @return snapshot of the pool's counters, safe to take while it runs
+   */
+  Metrics metrics() const;
+
+  /**
+   * Print the metrics to a stream when the pool is destroyed
+   * @param osIn - nullptr to stay quiet (default)
+   */
+  void set_metrics_stream(std::ostream *osIn)
+  {
+    metricsStream = osIn;
+  }
+
+  /**
+   * Run one queued task on the calling thread, so a thread waiting for work of the pool helps
+   * instead of blocking (see TaskGroup::wait()). High priority work is taken first
+   * @return FALSE if no queued task was found
+   */
+  bool run_pending_task();
+
+  /**
+   * Move-only work item; small captures are stored inline, larger ones in the TaskArena
+   */
+  using process = UniqueFunction<void(void)>;
+
   template<typename T, typename... ARGS>
   void enqueue_work(T&& t, ARGS&&... args)
   {
-    auto work = [proc = std::forward<T>(t), tuple = std::make_tuple(std::forward<ARGS>(args)...)]
-        () {std::apply(proc, tuple);};
-
-    auto i = index++;
+    enqueue_work_with(TaskOptions(), std::forward<T>(t), std::forward<ARGS>(args)...);
+  }
 
-    for (auto j = 0; j < count * countMult; j++)
+  /**
+   * enqueue_work() with a priority and cancellation
+   */
+  template<typename T, typename... ARGS>
+  void enqueue_work_with(const TaskOptions &options, T&& t, ARGS&&... args)
+  {
+    if constexpr (sizeof...(ARGS) == 0)
     {
-      if (queues[(i + j) % count].try_push(work))
-      {
-        return;
-      }
-    }
+      submit(process(std::forward<T>(t)), options);
+    } else {
+      auto work = [proc = std::forward<T>(t), tuple = std::make_tuple(std::forward<ARGS>(args)...)]
+          () mutable {std::apply(proc, tuple);};
 
-    queues[i % count].push(std::move(work));
+      submit(std::move(work), options);
+    }
   }
 
+  /**
+   * Enqueue work whose result is needed later. The task and the future's shared state live in
+   * the TaskArena
+   * @return future holding the result (or exception) of the task
+   */
   template<typename T, typename... ARGS>
-  void enqueue_task(T&& t, ARGS&&... args)
+  auto enqueue_task(T&& t, ARGS&&... args)
   {
-    using taskReturnType = std::invoke_result<T, ARGS...>;
-    using taskType = std::packaged_task<taskReturnType()>;
+    return enqueue_task_with(TaskOptions(), std::forward<T>(t), std::forward<ARGS>(args)...);
+  }
 
-    auto task = std::make_shared<taskType>(std::bind(std::forward<T>(t), std::forward<ARGS>(args)...));
-    auto work = [=] () {(*task)();};
-    auto result = task->get_future();
+  /**
+   * enqueue_task() with a priority and cancellation
+   */
+  template<typename T, typename... ARGS>
+  auto enqueue_task_with(const TaskOptions &options, T&& t, ARGS&&... args)
+  {
+    auto [work, result] = package_task(std::forward<T>(t), std::forward<ARGS>(args)...);
+    submit(std::move(work), options);
+    return std::move(result);
+  }
 
-    auto i = index++;
+  /**
+   * Wrap work whose result is needed later, for enqueue_bulk()
+   * @return work item, and the future holding the result (or exception) of the work
+   */
+  template<typename T, typename... ARGS>
+  static auto package_task(T&& t, ARGS&&... args)
+  {
+    using taskReturnType = std::invoke_result_t<T, ARGS...>;
 
-    for (auto j = 0; j < count * countMult; j++)
-    {
-      if (queues[(i + j) % count].try_push(work))
-      {
-        return result;
-      }
-    }
+    std::promise<taskReturnType> promise(std::allocator_arg, TaskAllocator<taskReturnType>());
+    auto result = promise.get_future();
+    process work = [promise = std::move(promise), proc = std::forward<T>(t),
+                    tuple = std::make_tuple(std::forward<ARGS>(args)...)] () mutable
+        {
+          try
+          {
+            if constexpr (std::is_void_v<taskReturnType>)
+            {
+              std::apply(proc, tuple);
+              promise.set_value();
+            } else {
+              promise.set_value(std::apply(proc, tuple));
+            }
+          } catch (...)
+          {
+            promise.set_exception(std::current_exception());
+          }
+        };
 
-    queues[i % count].push(std::move(work));
+    return std::make_pair(std::move(work), std::move(result));
+  }
 
-    return result;
+  /**
+   * Enqueue a batch of work at once: the batch is dealt out round-robin over the worker queues,
+   * like single submissions, and each queue takes its share under one lock with one wakeup of
+   * its worker, instead of a lock and a wakeup per item
+   * @param work
+   */
+  void enqueue_bulk(std::vector<process> work)
+  {
+    enqueue_bulk_with(TaskOptions(), std::move(work));
   }
 
+  /**
+   * enqueue_bulk() with a priority and cancellation
+   */
+  void enqueue_bulk_with(const TaskOptions &options, std::vector<process> work);
+
+  /**
+   * How long a worker that ran out of work keeps looking for more, yielding between rounds,
+   * before it parks in its queue; bursts of small tasks then find their workers awake. Workers
+   * park right away on a single core, where spinning only delays the thread submitting the work
+   */
+  inline static const std::chrono::microseconds spinTime{50};
+
  private:
 
-  using process = std::function<void(void)>;
+  inline static thread_local std::size_t workerNode = 0;
+
+  using clock = std::chrono::steady_clock;
+
+  struct Task
+  {
+    process work;
 
-  using queue = UnboundedQueue<process>;
+    clock::time_point enqueued;
 
-  using queueVec = std::vector<queue>;
+    std::optional<CancellationToken> token;
+  };
 
+  using queue = UnboundedQueue<Task, priorities>;
+
+  /**
+   * Counters written only by their worker, padded so workers never share a cache line
+   */
+  struct alignas(64) WorkerCounters
+  {
+    std::atomic<std::uint64_t> tasks{0};
+    std::atomic<std::uint64_t> ownPops{0};
+    std::atomic<std::uint64_t> steals{0};
+    std::atomic<std::uint64_t> failedProbes{0};
+    std::atomic<std::uint64_t> parks{0};
+    std::atomic<std::uint64_t> spunPops{0};
+    std::atomic<std::uint64_t> cancelled{0};
+    std::atomic<std::uint64_t> busyNanoseconds{0};
+    std::atomic<std::uint64_t> idleNanoseconds{0};
+    std::atomic<std::uint64_t> latency[latencyBuckets] = {};
+  };
+
+  /**
+   * Add to a counter only its owner writes; a relaxed load and store, no locked instruction
+   */
+  static void bump(std::atomic<std::uint64_t> &counter, std::uint64_t amount = 1)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  }
+
+  /**
+   * Place work on a queue: a lock-free probe of the queues first, then a blocking push
+   */
+  void submit(process work, const TaskOptions &options);
+
+  using queueVec = std::vector<std::unique_ptr<queue>>;
+
+  /**
+   * built by their workers
+   */
   queueVec queues;
 
+  /**
+   * per worker, the queues to pop from in order: its own, its node's, then the rest
+   */
+  std::vector<std::vector<std::size_t>> victims;
+
+  Topology topology;
+
+  std::vector<std::size_t> nodes;
+
+  std::mutex startLock;
+
+  std::condition_variable started;
+
+  std::size_t queuesBuilt = 0;
+
+  std::unique_ptr<WorkerCounters[]> counters;
+
+  alignas(64) std::atomic<std::uint64_t> failedPushes{0};
+
+  std::atomic<std::uint64_t> blockingPushes{0};
+
+  std::atomic<std::uint64_t> helpedTasks{0};
+
+  std::ostream *metricsStream = nullptr;
+
+  /**
+   * spinTime, or none on a single core
+   */
+  std::chrono::microseconds spin;
+
 
   using Threads = std::vector<std::thread>;
 
@@ -89,4 +408,6 @@ class ThreadPool
 
 };
 
+std::ostream &operator<<(std::ostream &os, const ThreadPool::Metrics &metrics);
+
 #endif //C____THREADPOOL_H_
@@ -1,5 +1,7 @@
+#include "TaskGroup.h"
 #include "ThreadPool.h"
 
+#include <atomic>
 #include <thread>
 #include <iostream>
 #include <sstream>
@@ -13,56 +15,55 @@ int main()
 
   auto numThreads = thread::hardware_concurrency();
 
-  static std::exception_ptr globalExceptionPtr = nullptr;
-
   try
   {
+    // one pool for every round, no teardown to find out that the work is done
     ThreadPool pool(numThreads);
 
-    cout << "queueing up some random work\n";
-    for (size_t i = 0; i < 1000; i++)
+    for (size_t round = 0; round < 10; round++)
     {
-      // pass in lambda of some random work
-      pool.enqueue_work([i]()
-                        {
-                          try
-                          {
-                            size_t x;
-                            size_t repetitions = 10 + (10 * (rand() % 5));
-                            for (size_t j = 0; j < repetitions; j++)
-                            {
-                              x = i + (rand() % 200); // pretty good chance of generating a few
-                              // exceptions every few runs
-                            }
-                            if (x > 1000)
-                            {
-                              stringstream id;
-                              id << this_thread::get_id();
-                              throw runtime_error(id.str().c_str());
-                            }
-                          } catch (...)
-                          {
-                            globalExceptionPtr = current_exception();
-                          }
-                        });
-      if (globalExceptionPtr)
+      cout << "queueing up some random work, round " << round << "\n";
+      TaskGroup group(pool);
+      atomic<size_t> done = 0;
+      size_t offset = rand() % 200;
+      for (size_t i = 0; i < 1000; i++)
       {
-        try
-        {
-          rethrow_exception(globalExceptionPtr);
-        } catch (const exception &e)
-        {
-          cout << "caught exception in job from thread: " << e.what() << "\n";
-        }
+        // pass in lambda of some random work
+        group.run([i, offset, &done]()
+                  {
+                    size_t x = 0;
+                    size_t repetitions = 10 + (10 * (i % 5));
+                    for (size_t j = 0; j < repetitions; j++)
+                    {
+                      x = i + ((j * 7919 + offset) % 200); // a few exceptions every round
+                    }
+                    if (x > 1150)
+                    {
+                      stringstream id;
+                      id << this_thread::get_id();
+                      throw runtime_error(id.str().c_str());
+                    }
+                    done++;
+                  });
       }
+      try
+      {
+        group.wait(); // helps with the queued work, rethrows the first exception
+      } catch (const exception &e)
+      {
+        cout << "caught exception in job from thread: " << e.what() << "\n";
+      }
+      cout << done << " jobs done\n";
     }
+
     auto end = chrono::high_resolution_clock::now();
     auto duration = chrono::duration_cast<chrono::milliseconds>(end - begin);
     cout << "pool duration = " << duration.count() / 1000.f << " seconds\n";
+    cout << pool.metrics();
   } catch (const exception &ex)
   {
     cout << "caught exception from thread pool: " << ex.what() << "\n";
   }
 
   return 0;
-}
\ No newline at end of file
+}
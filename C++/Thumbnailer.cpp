@@ -0,0 +1,203 @@
+#include "Thumbnailer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+Thumbnailer::Thumbnailer(int width, int height, vector<int> factors) : width(width), height(height)
+{
+  sort(factors.begin(), factors.end());
+  for (int factor : factors)
+  {
+    if (factor < 1)
+    {
+      throw invalid_argument("thumbnail factor must be positive");
+    }
+    auto level = make_unique<Level>();
+    level->factor = factor;
+    level->width = (width + factor - 1) / factor;
+    level->height = (height + factor - 1) / factor;
+    level->source = -1;
+    for (int i = static_cast<int>(levels.size()) - 1; i >= 0; i--)
+    {
+      if (factor % levels[i]->factor == 0)
+      {
+        level->source = i;
+        break;
+      }
+    }
+    levels.push_back(std::move(level));
+  }
+}
+
+bool Thumbnailer::open(const string &fileName)
+{
+  string base = fileName.substr(0, fileName.rfind(".ppm"));
+  bool opened = true;
+  for (auto &level : levels)
+  {
+    level->image = make_unique<PPM>(base + "_" + to_string(level->factor) + ".ppm", level->width,
+                                    level->height);
+    if (level->image->init_stream())
+    {
+      level->image->write_header();
+    } else {
+      opened = false;
+    }
+  }
+  return opened;
+}
+
+Thumbnailer::Partial Thumbnailer::make_partial(const Level &level, int firstRow, int rows) const
+{
+  Partial partial;
+  partial.firstRow = firstRow / level.factor;
+  partial.rows = (firstRow + rows - 1) / level.factor - partial.firstRow + 1;
+  partial.sums.assign(static_cast<size_t>(partial.rows) * level.width * 3, 0);
+  return partial;
+}
+
+void Thumbnailer::sum_pixels(const Level &level, const unsigned char *rgb, int firstRow, int rows,
+                             Partial &partial) const
+{
+  int factor = level.factor;
+  for (int y = 0; y < rows; y++)
+  {
+    const unsigned char *row = rgb + static_cast<size_t>(y) * width * 3;
+    uint32_t *sums = &partial.sums[static_cast<size_t>((firstRow + y) / factor - partial.firstRow)
+        * level.width * 3];
+    for (int column = 0; column < level.width; column++)
+    {
+      int xEnd = min(width, (column + 1) * factor);
+      for (int x = column * factor; x < xEnd; x++)
+      {
+        sums[3 * column] += row[3 * x];
+        sums[3 * column + 1] += row[3 * x + 1];
+        sums[3 * column + 2] += row[3 * x + 2];
+      }
+    }
+  }
+}
+
+void Thumbnailer::fold(const Level &level, const Level &fine, const Partial &finePartial,
+                       Partial &partial) const
+{
+  int ratio = level.factor / fine.factor;
+  for (int y = 0; y < finePartial.rows; y++)
+  {
+    const uint32_t *fineSums = &finePartial.sums[static_cast<size_t>(y) * fine.width * 3];
+    uint32_t *sums = &partial.sums[static_cast<size_t>((finePartial.firstRow + y) / ratio
+        - partial.firstRow) * level.width * 3];
+    for (int x = 0; x < fine.width; x++)
+    {
+      int column = x / ratio;
+      sums[3 * column] += fineSums[3 * x];
+      sums[3 * column + 1] += fineSums[3 * x + 1];
+      sums[3 * column + 2] += fineSums[3 * x + 2];
+    }
+  }
+}
+
+void Thumbnailer::add_band(int firstRow, int rows, const unsigned char *rgb)
+{
+  if (rows <= 0)
+  {
+    return;
+  }
+
+  // box filter without locks, coarser levels folded from finer ones
+  vector<Partial> partials;
+  partials.reserve(levels.size());
+  for (const auto &level : levels)
+  {
+    partials.push_back(make_partial(*level, firstRow, rows));
+    if (level->source < 0)
+    {
+      sum_pixels(*level, rgb, firstRow, rows, partials.back());
+    } else {
+      fold(*level, *levels[level->source], partials[level->source], partials.back());
+    }
+  }
+
+  for (size_t i = 0; i < levels.size(); i++)
+  {
+    merge(*levels[i], partials[i], firstRow, rows);
+  }
+}
+
+void Thumbnailer::merge(Level &level, const Partial &partial, int firstRow, int rows)
+{
+  size_t rowSums = static_cast<size_t>(level.width) * 3;
+  scoped_lock guard(level.lock);
+  for (int y = 0; y < partial.rows; y++)
+  {
+    int row = partial.firstRow + y;
+    int blockBegin = row * level.factor;
+    int blockEnd = min(height, blockBegin + level.factor);
+    int received = min(blockEnd, firstRow + rows) - max(blockBegin, firstRow);
+
+    Accumulator &accumulator = level.open[row];
+    if (accumulator.sums.empty())
+    {
+      accumulator.sums.assign(rowSums, 0);
+    }
+    const uint32_t *sums = &partial.sums[static_cast<size_t>(y) * rowSums];
+    for (size_t i = 0; i < rowSums; i++)
+    {
+      accumulator.sums[i] += sums[i];
+    }
+    accumulator.rowsReceived += received;
+    level.maxOpen = max(level.maxOpen, level.open.size());
+
+    if (accumulator.rowsReceived == blockEnd - blockBegin)
+    {
+      finish_row(level, row, accumulator);
+      level.open.erase(row);
+    }
+  }
+}
+
+void Thumbnailer::finish_row(Level &level, int row, const Accumulator &accumulator)
+{
+  int blockRows = min(height, (row + 1) * level.factor) - row * level.factor;
+  vector<unsigned char> pixels(static_cast<size_t>(level.width) * 3);
+  for (int column = 0; column < level.width; column++)
+  {
+    int blockColumns = min(width, (column + 1) * level.factor) - column * level.factor;
+    uint32_t divisor = static_cast<uint32_t>(blockRows) * blockColumns;
+    for (int k = 0; k < 3; k++)
+    {
+      pixels[3 * column + k] = static_cast<unsigned char>(
+          (accumulator.sums[3 * column + k] + divisor / 2) / divisor);
+    }
+  }
+  if (level.image)
+  {
+    level.image->write_row(row, pixels);
+  }
+}
+
+void Thumbnailer::close()
+{
+  for (auto &level : levels)
+  {
+    if (level->image)
+    {
+      level->image->close();
+      level->image.reset();
+    }
+  }
+}
+
+ostream &operator<<(ostream &os, const Thumbnailer &thumbnailer)
+{
+  os << "Thumbnails:";
+  for (const auto &level : thumbnailer.levels)
+  {
+    os << " 1/" << level->factor << " (" << level->width << "x" << level->height << ", at most "
+       << level->maxOpen << " rows open)";
+  }
+  os << "\n";
+  return os;
+}
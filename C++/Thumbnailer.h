@@ -0,0 +1,135 @@
+#ifndef C____THUMBNAILER_H_
+#define C____THUMBNAILER_H_
+
+#include "PPM.h"
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Builds downscaled copies of an image (1/4, 1/16, 1/64 by default) from its bands as they leave
+ * the render pipeline, so the full-resolution file never has to be read back. Bands may arrive
+ * in any order and from any thread; each band is box-filtered on the thread that hands it over
+ * and only merged under a lock. Only output rows still waiting for input rows are kept, and a
+ * row is written out as soon as its last input row arrives
+ */
+class Thumbnailer
+{
+ public:
+
+  /**
+   * Default parametrized constructor
+   * @param width - full image width
+   * @param height - full image height
+   * @param factors - downscale factors
+   */
+  Thumbnailer(int width, int height, std::vector<int> factors = {4, 16, 64});
+
+  /**
+   * Open one output per factor, named after the full image: name.ppm gives name_4.ppm, ...
+   * @param fileName
+   * @return FALSE if any file could not be opened
+   */
+  bool open(const std::string &fileName);
+
+  /**
+   * Accumulate a band of the full image, thread safe
+   * @param firstRow - image row of the first band row
+   * @param rows - number of rows
+   * @param rgb - pixel data of the band
+   */
+  void add_band(int firstRow, int rows, const unsigned char *rgb);
+
+  /**
+   * Close the outputs; every row of the image must have been added
+   */
+  void close();
+
+  friend std::ostream &operator<<(std::ostream &os, const Thumbnailer &thumbnailer);
+
+ private:
+
+  /**
+   * Box sums of one output row still missing input rows
+   */
+  struct Accumulator
+  {
+    std::vector<std::uint32_t> sums;
+
+    int rowsReceived = 0;
+  };
+
+  struct Level
+  {
+    int factor;
+
+    int width;
+
+    int height;
+
+    /**
+     * finer level this one is folded from, -1 to sum the pixels directly
+     */
+    int source;
+
+    std::unique_ptr<PPM> image;
+
+    std::mutex lock;
+
+    std::map<int, Accumulator> open;
+
+    std::size_t maxOpen = 0;
+  };
+
+  /**
+   * Box sums of one band at one level
+   */
+  struct Partial
+  {
+    int firstRow;
+
+    int rows;
+
+    std::vector<std::uint32_t> sums;
+  };
+
+  /**
+   * @param level
+   * @param firstRow
+   * @param rows
+   * @return empty partial covering the output rows of a band
+   */
+  Partial make_partial(const Level &level, int firstRow, int rows) const;
+
+  void sum_pixels(const Level &level, const unsigned char *rgb, int firstRow, int rows,
+                  Partial &partial) const;
+
+  /**
+   * Sum a finer level's partial into a coarser one; exact since the sums are not rounded
+   */
+  void fold(const Level &level, const Level &fine, const Partial &finePartial,
+            Partial &partial) const;
+
+  /**
+   * Add a band's partial to the open rows, writing out completed rows
+   */
+  void merge(Level &level, const Partial &partial, int firstRow, int rows);
+
+  /**
+   * Divide out a completed row and write it
+   */
+  void finish_row(Level &level, int row, const Accumulator &accumulator);
+
+  int width;
+
+  int height;
+
+  std::vector<std::unique_ptr<Level>> levels;
+};
+
+#endif //C____THUMBNAILER_H_
@@ -0,0 +1,464 @@
+#include "TiledTIFF.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef GIGABROT_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+// field types
+const uint16_t typeShort = 3;
+const uint16_t typeLong = 4;
+const uint16_t typeLong8 = 16;
+
+/**
+ * Size of the BigTIFF header: byte order, version 43, offset size, first directory offset
+ */
+const size_t headerSize = 16;
+
+/**
+ * @param data - little endian bytes are appended to it
+ * @param value
+ * @param bytes - size of the value
+ */
+void put(vector<unsigned char> &data, uint64_t value, int bytes)
+{
+  for (int byte = 0; byte < bytes; byte++)
+  {
+    data.push_back(static_cast<unsigned char>(value >> (8 * byte)));
+  }
+}
+
+/**
+ * Packs codes most significant bit first, as TIFF LZW expects
+ */
+class BitWriter
+{
+ public:
+
+  explicit BitWriter(vector<unsigned char> &outIn) : out(outIn)
+  {
+    bits = 0;
+    count = 0;
+  }
+
+  void put(int code, int width)
+  {
+    bits = (bits << width) | static_cast<uint32_t>(code);
+    count += width;
+    while (count >= 8)
+    {
+      count -= 8;
+      out.push_back(static_cast<unsigned char>(bits >> count));
+    }
+  }
+
+  void flush()
+  {
+    if (count > 0)
+    {
+      out.push_back(static_cast<unsigned char>(bits << (8 - count)));
+      count = 0;
+    }
+  }
+
+ private:
+
+  vector<unsigned char> &out;
+
+  uint32_t bits;
+
+  int count;
+};
+
+/**
+ * TIFF LZW with early change: codes widen from 9 to 12 bits one code before the table needs
+ * it, and the table is cleared just before it fills, exactly as libtiff's encoder does
+ * @param in
+ * @param out - compressed data is appended to it
+ */
+void lzw_encode(const vector<unsigned char> &in, vector<unsigned char> &out)
+{
+  const int clearCode = 256;
+  const int endCode = 257;
+  const int firstCode = 258;
+  const int lastCode = 4095;
+  // (prefix code, byte) -> code, open addressing; the table is at most half full
+  const size_t slots = 8192;
+  vector<int32_t> keys(slots);
+  vector<uint16_t> codes(slots);
+
+  BitWriter bits(out);
+  int width = 9;
+  int next = firstCode;
+  auto reset = [&keys, &width, &next, firstCode]()
+  {
+    fill(keys.begin(), keys.end(), -1);
+    width = 9;
+    next = firstCode;
+  };
+  // after a code is written the decoder adds an entry, one behind the encoder's table
+  auto added = [&bits, &width, &next, &reset, lastCode, clearCode]()
+  {
+    if (next == lastCode - 1)
+    {
+      bits.put(clearCode, width);
+      reset();
+    } else if (next > (1 << width) - 1) {
+      width++;
+    }
+  };
+
+  reset();
+  bits.put(clearCode, width);
+  if (!in.empty())
+  {
+    int prefix = in[0];
+    for (size_t index = 1; index < in.size(); index++)
+    {
+      int32_t key = (prefix << 8) | in[index];
+      size_t slot = (static_cast<uint32_t>(key) * 2654435761U >> 19) & (slots - 1);
+      while (keys[slot] != -1 && keys[slot] != key)
+      {
+        slot = (slot + 1) & (slots - 1);
+      }
+      if (keys[slot] == key)
+      {
+        prefix = codes[slot];
+        continue;
+      }
+      bits.put(prefix, width);
+      keys[slot] = key;
+      codes[slot] = static_cast<uint16_t>(next++);
+      prefix = in[index];
+      added();
+    }
+    bits.put(prefix, width);
+    next++;
+    added();
+  }
+  bits.put(endCode, width);
+  bits.flush();
+}
+
+} // namespace
+
+TiledTIFF::TiledTIFF(const string &fileName, int width, int height, int tileSizeIn,
+                     Compression compressionIn) : width(width), height(height)
+{
+  if (width <= 0 || height <= 0)
+  {
+    throw invalid_argument("image size must be positive");
+  }
+  if (tileSizeIn <= 0 || tileSizeIn % 16 != 0)
+  {
+    throw invalid_argument("tile size must be a positive multiple of 16");
+  }
+  if (!available(compressionIn))
+  {
+    throw invalid_argument(string(name(compressionIn)) + " compression is not built in");
+  }
+  this->fileName = outputDirectory + fileName;
+  tileSize = tileSizeIn;
+  tilesAcross = (width + tileSize - 1) / tileSize;
+  tilesDown = (height + tileSize - 1) / tileSize;
+  compression = compressionIn;
+  fileEnd = 0;
+  tilesWritten = 0;
+  blankTiles = 0;
+  rawBytes = 0;
+  storedBytes = 0;
+}
+
+TiledTIFF::~TiledTIFF()
+{
+  if (image.is_open())
+  {
+    close();
+  }
+}
+
+bool TiledTIFF::open()
+{
+  image.open(fileName, ios::binary);
+  if (!image.is_open())
+  {
+    return false;
+  }
+
+  size_t tiles = static_cast<size_t>(tilesAcross) * tilesDown;
+  tileOffsets.assign(tiles, 0);
+  tileBytes.assign(tiles, 0);
+
+  vector<unsigned char> header{'I', 'I'};
+  put(header, 43, 2); // BigTIFF
+  put(header, 8, 2);  // offsets are 8 bytes
+  put(header, 0, 2);
+  put(header, 0, 8);  // first directory, set by close()
+  image.write((char const *) header.data(), header.size());
+  fileEnd = headerSize;
+  return true;
+}
+
+void TiledTIFF::write_tile(int tileX, int tileY, const unsigned char *rgb, size_t rowBytes)
+{
+  if (tileX < 0 || tileX >= tilesAcross || tileY < 0 || tileY >= tilesDown)
+  {
+    throw invalid_argument("tile out of the image");
+  }
+
+  vector<unsigned char> tile;
+  vector<unsigned char> data;
+  fill_tile(tileX, tileY, rgb, rowBytes, tile);
+  compress(tile, data);
+
+  scoped_lock guard(lock);
+  size_t index = static_cast<size_t>(tileY) * tilesAcross + tileX;
+  tileOffsets[index] = append(data);
+  tileBytes[index] = data.size();
+  tilesWritten++;
+  rawBytes += 3 * static_cast<uint64_t>(tileSize) * tileSize;
+  storedBytes += data.size();
+}
+
+void TiledTIFF::fill_tile(int tileX, int tileY, const unsigned char *rgb, size_t rowBytes,
+                          vector<unsigned char> &tile) const
+{
+  size_t tileRowBytes = 3 * static_cast<size_t>(tileSize);
+  tile.assign(tileRowBytes * tileSize, 0);
+  int columns = min(tileSize, width - tileX * tileSize);
+  int rows = min(tileSize, height - tileY * tileSize);
+  for (int row = 0; row < rows; row++)
+  {
+    copy_n(rgb + row * rowBytes, 3 * columns, tile.begin() + row * tileRowBytes);
+  }
+
+  if (compression != Compression::None)
+  {
+    // horizontal differencing, each sample less the same sample of the pixel to its left
+    for (int row = 0; row < tileSize; row++)
+    {
+      unsigned char *pixels = tile.data() + row * tileRowBytes;
+      for (size_t sample = tileRowBytes - 1; sample >= 3; sample--)
+      {
+        pixels[sample] -= pixels[sample - 3];
+      }
+    }
+  }
+}
+
+void TiledTIFF::compress(vector<unsigned char> &tile, vector<unsigned char> &data) const
+{
+  switch (compression)
+  {
+    case Compression::None:
+      data.swap(tile);
+      return;
+    case Compression::LZW:
+      data.reserve(tile.size() / 2);
+      lzw_encode(tile, data);
+      return;
+    case Compression::Deflate:
+    {
+#ifdef GIGABROT_ZLIB
+      uLongf size = compressBound(static_cast<uLong>(tile.size()));
+      data.resize(size);
+      if (compress2(data.data(), &size, tile.data(), static_cast<uLong>(tile.size()),
+                    Z_DEFAULT_COMPRESSION) != Z_OK)
+      {
+        throw runtime_error("deflate failed on a tile of " + fileName);
+      }
+      data.resize(size);
+#endif
+      return;
+    }
+  }
+}
+
+uint64_t TiledTIFF::append(const vector<unsigned char> &data)
+{
+  uint64_t offset = fileEnd;
+  image.write((char const *) data.data(), data.size());
+  if (!image)
+  {
+    throw runtime_error("could not write " + fileName);
+  }
+  fileEnd += data.size();
+  return offset;
+}
+
+void TiledTIFF::close()
+{
+  {
+    scoped_lock guard(lock);
+    // one black tile stands in for every tile that was never handed in
+    uint64_t blankOffset = 0;
+    uint64_t blankSize = 0;
+    for (size_t index = 0; index < tileOffsets.size(); index++)
+    {
+      if (tileOffsets[index] != 0)
+      {
+        continue;
+      }
+      if (blankSize == 0)
+      {
+        vector<unsigned char> tile(3 * static_cast<size_t>(tileSize) * tileSize, 0);
+        vector<unsigned char> data;
+        compress(tile, data);
+        blankOffset = append(data);
+        blankSize = data.size();
+      }
+      tileOffsets[index] = blankOffset;
+      tileBytes[index] = blankSize;
+      blankTiles++;
+    }
+    write_directory();
+  }
+  image.close();
+  cout << "File " << fileName << " saved\n";
+}
+
+void TiledTIFF::write_directory()
+{
+  struct Entry
+  {
+    uint16_t tag;
+
+    uint16_t type;
+
+    uint64_t count;
+
+    uint64_t value;
+  };
+
+  uint64_t tiles = tileOffsets.size();
+  uint16_t scheme = (compression == Compression::LZW) ? 5
+                    : (compression == Compression::Deflate) ? 8 : 1;
+  // sorted by tag
+  vector<Entry> entries{{256, typeLong, 1, static_cast<uint64_t>(width)},   // ImageWidth
+                        {257, typeLong, 1, static_cast<uint64_t>(height)},  // ImageLength
+                        {258, typeShort, 3, 0x000800080008ULL},             // 8 bits each
+                        {259, typeShort, 1, scheme},                        // Compression
+                        {262, typeShort, 1, 2},                             // RGB
+                        {277, typeShort, 1, 3},                             // SamplesPerPixel
+                        {284, typeShort, 1, 1}};                            // chunky
+  if (compression != Compression::None)
+  {
+    entries.push_back({317, typeShort, 1, 2}); // horizontal differencing
+  }
+  entries.push_back({322, typeLong, 1, static_cast<uint64_t>(tileSize)}); // TileWidth
+  entries.push_back({323, typeLong, 1, static_cast<uint64_t>(tileSize)}); // TileLength
+
+  // the tables follow the directory, unless a single value fits in its entry
+  vector<unsigned char> data((8 - fileEnd % 8) % 8, 0); // word aligned
+  uint64_t directory = fileEnd + data.size();
+  uint64_t tables = directory + 8 + 20 * (entries.size() + 2) + 8;
+  entries.push_back({324, typeLong8, tiles, (tiles == 1) ? tileOffsets[0] : tables});
+  entries.push_back({325, typeLong8, tiles, (tiles == 1) ? tileBytes[0] : tables + 8 * tiles});
+
+  put(data, entries.size(), 8);
+  for (const Entry &entry : entries)
+  {
+    put(data, entry.tag, 2);
+    put(data, entry.type, 2);
+    put(data, entry.count, 8);
+    put(data, entry.value, 8);
+  }
+  put(data, 0, 8); // no further directory
+  if (tiles > 1)
+  {
+    for (uint64_t offset : tileOffsets)
+    {
+      put(data, offset, 8);
+    }
+    for (uint64_t bytes : tileBytes)
+    {
+      put(data, bytes, 8);
+    }
+  }
+  append(data);
+
+  vector<unsigned char> first;
+  put(first, directory, 8);
+  image.seekp(8);
+  image.write((char const *) first.data(), first.size());
+}
+
+int TiledTIFF::get_tile_size() const
+{
+  return tileSize;
+}
+
+int TiledTIFF::get_tiles_across() const
+{
+  return tilesAcross;
+}
+
+int TiledTIFF::get_tiles_down() const
+{
+  return tilesDown;
+}
+
+string TiledTIFF::get_file_name() const
+{
+  return fileName;
+}
+
+const char *TiledTIFF::name(Compression compression)
+{
+  switch (compression)
+  {
+    case Compression::None:
+      return "none";
+    case Compression::LZW:
+      return "lzw";
+    case Compression::Deflate:
+      return "deflate";
+  }
+  return "unknown";
+}
+
+bool TiledTIFF::parse(const string &nameIn, Compression &compression)
+{
+  for (Compression candidate : {Compression::None, Compression::LZW, Compression::Deflate})
+  {
+    if (nameIn == name(candidate))
+    {
+      compression = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TiledTIFF::available(Compression compression)
+{
+  if (compression == Compression::Deflate)
+  {
+#ifdef GIGABROT_ZLIB
+    return true;
+#else
+    return false;
+#endif
+  }
+  return true;
+}
+
+ostream &operator<<(ostream &os, const TiledTIFF &tiff)
+{
+  os << "TIFF: " << tiff.tilesWritten << " tiles of " << tiff.tileSize << "x" << tiff.tileSize
+     << " written, " << tiff.blankTiles << " blank, " << TiledTIFF::name(tiff.compression)
+     << " compression, " << tiff.rawBytes << " bytes stored in " << tiff.storedBytes;
+  if (tiff.storedBytes > 0)
+  {
+    os << " (" << static_cast<double>(tiff.rawBytes) / tiff.storedBytes << ":1)";
+  }
+  os << "\n";
+  return os;
+}
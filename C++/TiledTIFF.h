@@ -0,0 +1,178 @@
+#ifndef C____TILEDTIFF_H_
+#define C____TILEDTIFF_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * BigTIFF output for images too large for a P6 file, written as square RGB tiles. Tiles are
+ * compressed on the thread that hands them in and appended to the file as they come, in any
+ * order; their offsets go into a table written with the directory when the file is closed, so
+ * only one tile is ever held per writing thread and viewers can page in the tiles they show.
+ * Compressed tiles use horizontal differencing (predictor 2) before LZW or deflate; deflate
+ * needs a build with zlib (GIGABROT_ZLIB), see available()
+ */
+class TiledTIFF
+{
+ public:
+
+  enum class Compression
+  {
+    None,
+    LZW,     // in-tree encoder, TIFF 6.0 variant
+    Deflate  // zlib, Adobe deflate
+  };
+
+  /**
+   * Default parametrized constructor
+   * contains output directory, like PPM
+   * @param fileName
+   * @param width
+   * @param height
+   * @param tileSizeIn - tile width and height, a multiple of 16
+   * @param compressionIn
+   */
+  TiledTIFF(const std::string &fileName, int width, int height, int tileSizeIn = 256,
+            Compression compressionIn = Compression::None);
+
+  /**
+   * Closes the file if still open
+   */
+  ~TiledTIFF();
+
+  /**
+   * Create the file and write the header; the directory offset is filled in by close()
+   * @return TRUE if the file could be opened
+   */
+  bool open();
+
+  /**
+   * Compress a tile and append it to the file; thread safe. Pixels past the right or bottom edge
+   * of the image are written black
+   * @param tileX - tile column
+   * @param tileY - tile row
+   * @param rgb - top left pixel of the tile
+   * @param rowBytes - distance between the tile's rows in rgb
+   */
+  void write_tile(int tileX, int tileY, const unsigned char *rgb, std::size_t rowBytes);
+
+  /**
+   * Write the tiles that were never handed in as black, then the directory with the tile offset
+   * table, and close the file
+   */
+  void close();
+
+  int get_tile_size() const;
+
+  /**
+   * @return tile columns
+   */
+  int get_tiles_across() const;
+
+  /**
+   * @return tile rows
+   */
+  int get_tiles_down() const;
+
+  std::string get_file_name() const;
+
+  /**
+   * @param compression
+   * @return name as taken by parse()
+   */
+  static const char *name(Compression compression);
+
+  /**
+   * @param nameIn - none, lzw or deflate
+   * @param compression - set if the name is known
+   * @return FALSE for an unknown name
+   */
+  static bool parse(const std::string &nameIn, Compression &compression);
+
+  /**
+   * @param compression
+   * @return FALSE if the compression was not built in
+   */
+  static bool available(Compression compression);
+
+  friend std::ostream &operator<<(std::ostream &os, const TiledTIFF &tiff);
+
+ private:
+
+  /**
+   * Copy a tile out of the image, pad it and apply the predictor
+   * @param tileX
+   * @param tileY
+   * @param rgb
+   * @param rowBytes
+   * @param tile - tileSize * tileSize pixels
+   */
+  void fill_tile(int tileX, int tileY, const unsigned char *rgb, std::size_t rowBytes,
+                 std::vector<unsigned char> &tile) const;
+
+  /**
+   * @param tile - from fill_tile()
+   * @param data - tile as stored in the file
+   */
+  void compress(std::vector<unsigned char> &tile, std::vector<unsigned char> &data) const;
+
+  /**
+   * Append stored tile data; the caller holds the lock
+   * @param data
+   * @return file offset of the data
+   */
+  std::uint64_t append(const std::vector<unsigned char> &data);
+
+  /**
+   * Write the image file directory at the end of the file and point the header at it
+   */
+  void write_directory();
+
+  const std::string outputDirectory = "..\\..\\output\\";
+
+  std::string fileName;
+
+  int width;
+
+  int height;
+
+  int tileSize;
+
+  int tilesAcross;
+
+  int tilesDown;
+
+  Compression compression;
+
+  std::mutex lock;
+
+  std::ofstream image;
+
+  /**
+   * end of the file, where the next tile goes
+   */
+  std::uint64_t fileEnd;
+
+  /**
+   * 0 for tiles not written yet
+   */
+  std::vector<std::uint64_t> tileOffsets;
+
+  std::vector<std::uint64_t> tileBytes;
+
+  // metrics
+  std::uint64_t tilesWritten;
+
+  std::uint64_t blankTiles;
+
+  std::uint64_t rawBytes;
+
+  std::uint64_t storedBytes;
+};
+
+#endif //C____TILEDTIFF_H_
@@ -0,0 +1,122 @@
+#include "Topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+vector<int> Topology::parse_cpu_list(const string &list)
+{
+  vector<int> cpus;
+  stringstream ranges(list);
+  string range;
+  while (getline(ranges, range, ','))
+  {
+    size_t dash = range.find('-');
+    try
+    {
+      int first = stoi(range.substr(0, dash));
+      int last = (dash == string::npos) ? first : stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; cpu++)
+      {
+        cpus.push_back(cpu);
+      }
+    } catch (const exception &) {
+      // blank or malformed entry, ie the trailing newline
+    }
+  }
+  return cpus;
+}
+
+Topology Topology::detect()
+{
+  Topology topology;
+
+  vector<int> allowed;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (CPU_ISSET(cpu, &set))
+      {
+        allowed.push_back(cpu);
+      }
+    }
+  }
+#endif
+  if (allowed.empty())
+  {
+    for (int cpu = 0; cpu < static_cast<int>(max(1U, thread::hardware_concurrency())); cpu++)
+    {
+      allowed.push_back(cpu);
+    }
+  }
+
+  for (int node = 0;; node++)
+  {
+    ifstream cpuList("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    if (!cpuList)
+    {
+      break; // node numbers are contiguous on every machine we run on
+    }
+    string list;
+    getline(cpuList, list);
+    vector<int> cpus;
+    for (int cpu : parse_cpu_list(list))
+    {
+      if (binary_search(allowed.begin(), allowed.end(), cpu))
+      {
+        cpus.push_back(cpu);
+      }
+    }
+    if (!cpus.empty())
+    {
+      topology.nodes.push_back(std::move(cpus));
+    }
+  }
+  if (topology.nodes.empty())
+  {
+    topology.nodes.push_back(std::move(allowed));
+  }
+  return topology;
+}
+
+bool Topology::pin_current_thread(const vector<int> &cpus)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus)
+  {
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+    {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+ostream &operator<<(ostream &os, const Topology &topology)
+{
+  os << "Topology: " << topology.nodes.size() << " node(s):";
+  for (size_t node = 0; node < topology.nodes.size(); node++)
+  {
+    os << " " << node << " (" << topology.nodes[node].size() << " cores)";
+  }
+  os << "\n";
+  return os;
+}
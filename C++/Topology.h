@@ -0,0 +1,59 @@
+#ifndef C____TOPOLOGY_H_
+#define C____TOPOLOGY_H_
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * NUMA nodes and the cores this process may run on in each of them, read from
+ * /sys/devices/system/node. Machines (or kernels) without that information are one node
+ */
+class Topology
+{
+ public:
+
+  /**
+   * @return topology of this machine, restricted to the cores the process is allowed to use
+   */
+  static Topology detect();
+
+  /**
+   * @return number of nodes with usable cores
+   */
+  std::size_t node_count() const
+  {
+    return nodes.size();
+  }
+
+  /**
+   * @param node
+   * @return usable cores of a node
+   */
+  const std::vector<int> &node_cpus(std::size_t node) const
+  {
+    return nodes[node];
+  }
+
+  /**
+   * Pin the calling thread
+   * @param cpus - cores it may run on
+   * @return FALSE if the thread could not be pinned
+   */
+  static bool pin_current_thread(const std::vector<int> &cpus);
+
+  friend std::ostream &operator<<(std::ostream &os, const Topology &topology);
+
+ private:
+
+  /**
+   * @param list - kernel cpu list, ie "0-3,8-11"
+   * @return cores in the list
+   */
+  static std::vector<int> parse_cpu_list(const std::string &list);
+
+  std::vector<std::vector<int>> nodes;
+};
+
+#endif //C____TOPOLOGY_H_
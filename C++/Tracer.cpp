@@ -0,0 +1,191 @@
+#include "Tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+atomic<bool> Tracer::active{false};
+
+atomic<uint64_t> Tracer::session{0};
+
+mutex Tracer::ringsLock;
+
+vector<unique_ptr<Tracer::Ring>> Tracer::rings;
+
+size_t Tracer::ringSize = 1 << 16;
+
+namespace
+{
+
+atomic<int64_t> epoch{0};
+
+thread_local string threadName;
+
+/**
+ * Ring of the calling thread and the session it belongs to
+ */
+thread_local Tracer::Ring *threadRing = nullptr;
+
+int64_t steady_nanoseconds()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Quote a string for JSON
+ * @param text
+ * @return
+ */
+string quoted(const string &text)
+{
+  string out = "\"";
+  for (char character : text)
+  {
+    if (character == '"' || character == '\\')
+    {
+      out += '\\';
+    }
+    out += (static_cast<unsigned char>(character) < 0x20) ? ' ' : character;
+  }
+  return out + "\"";
+}
+
+/**
+ * @param nanoseconds
+ * @return microseconds as the trace format wants them, with nanosecond decimals
+ */
+string microseconds(uint64_t nanoseconds)
+{
+  char text[32];
+  snprintf(text, sizeof(text), "%llu.%03llu", static_cast<unsigned long long>(nanoseconds / 1000),
+           static_cast<unsigned long long>(nanoseconds % 1000));
+  return text;
+}
+
+} // namespace
+
+void Tracer::start(size_t eventsPerThread)
+{
+  scoped_lock guard(ringsLock);
+  ringSize = max<size_t>(1, eventsPerThread);
+  epoch.store(steady_nanoseconds(), memory_order_relaxed);
+  session++;
+  active = true;
+}
+
+bool Tracer::stop(const string &path)
+{
+  active = false;
+  scoped_lock guard(ringsLock);
+
+  ofstream file(path);
+  if (!file)
+  {
+    return false;
+  }
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  uint64_t dropped = 0;
+  uint64_t current = session.load();
+  for (const auto &ring : rings)
+  {
+    if (ring->session != current)
+    {
+      continue;
+    }
+    file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+         << ring->thread << ",\"args\":{\"name\":" << quoted(ring->name) << "}}";
+    first = false;
+
+    // a thread that checked enabled() before the stop may still be writing its next span, into
+    // the slot of the oldest once the ring has wrapped; that slot is left out
+    uint64_t written = ring->written.load(memory_order_acquire);
+    uint64_t size = ring->events.size();
+    uint64_t kept = (written >= size) ? size - 1 : written;
+    dropped += written - kept;
+    for (uint64_t index = written - kept; index < written; index++)
+    {
+      const Event &event = ring->events[index % size];
+      file << ",\n{\"ph\":\"X\",\"name\":" << quoted(event.name) << ",\"cat\":"
+           << quoted(event.category) << ",\"pid\":1,\"tid\":" << ring->thread
+           << ",\"ts\":" << microseconds(event.begin)
+           << ",\"dur\":" << microseconds(event.end - event.begin);
+      if (event.arg >= 0)
+      {
+        file << ",\"args\":{\"n\":" << event.arg << "}";
+      }
+      file << "}";
+    }
+  }
+  file << "\n],\"otherData\":{\"droppedSpans\":" << dropped << "}}\n";
+  return static_cast<bool>(file);
+}
+
+void Tracer::name_thread(const string &name)
+{
+  threadName = name;
+}
+
+uint64_t Tracer::now()
+{
+  return static_cast<uint64_t>(steady_nanoseconds() - epoch.load(memory_order_relaxed));
+}
+
+Tracer::Ring *Tracer::thread_ring()
+{
+  uint64_t current = session.load(memory_order_acquire);
+  if (threadRing != nullptr && threadRing->session == current)
+  {
+    return threadRing;
+  }
+
+  // first span of this thread in the session
+  scoped_lock guard(ringsLock);
+  auto ring = make_unique<Ring>();
+  ring->events.resize(ringSize);
+  ring->thread = rings.size() + 1;
+  ring->name = threadName.empty() ? "thread " + to_string(ring->thread) : threadName;
+  ring->session = current;
+  threadRing = ring.get();
+  rings.push_back(std::move(ring));
+  return threadRing;
+}
+
+void Tracer::record(const char *name, const char *category, uint64_t begin, uint64_t end,
+                    int64_t arg)
+{
+  if (!enabled())
+  {
+    return;
+  }
+  Ring *ring = thread_ring();
+  uint64_t written = ring->written.load(memory_order_relaxed);
+  ring->events[written % ring->events.size()] = {name, category, begin, end, arg};
+  ring->written.store(written + 1, memory_order_release);
+}
+
+Tracer::Session::Session(string pathIn) : path(std::move(pathIn))
+{
+  if (!path.empty())
+  {
+    start();
+  }
+}
+
+Tracer::Session::~Session()
+{
+  if (!path.empty())
+  {
+    if (stop(path))
+    {
+      cout << "Trace " << path << " saved\n";
+    } else {
+      cout << "Could not open ofstream for trace\n";
+    }
+  }
+}
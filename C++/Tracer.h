@@ -0,0 +1,186 @@
+#ifndef C____TRACER_H_
+#define C____TRACER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Optional timeline of the render: pool tasks and idle time, band computation, waits for writer
+ * buffers and in-flight slots, and disk writes, as spans per thread. Every thread records into its
+ * own ring buffer without locks (the oldest spans are overwritten when it wraps), and stop()
+ * writes all rings as Chrome trace-event JSON for chrome://tracing or Perfetto. Spans are only
+ * taken at task and band granularity, so tracing costs well under a percent of a render; while
+ * the tracer is off a span is a single relaxed load
+ */
+class Tracer
+{
+ public:
+
+  /**
+   * Start recording; spans of an earlier session are not written again
+   * @param eventsPerThread - ring size of each thread
+   */
+  static void start(std::size_t eventsPerThread = 1 << 16);
+
+  /**
+   * Stop recording and write the trace
+   * @param path - JSON file to write
+   * @return FALSE if the file could not be written
+   */
+  static bool stop(const std::string &path);
+
+  static bool enabled()
+  {
+    return active.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Name the calling thread in traces, e.g. "worker 3"; may be called before start()
+   * @param name
+   */
+  static void name_thread(const std::string &name);
+
+  /**
+   * @return nanoseconds since start()
+   */
+  static std::uint64_t now();
+
+  /**
+   * Record a finished span on the calling thread
+   * @param name - string literal, stored as a pointer
+   * @param category - string literal, stored as a pointer
+   * @param begin - from now()
+   * @param end - from now()
+   * @param arg - shown with the span, -1 for none
+   */
+  static void record(const char *name, const char *category, std::uint64_t begin,
+                     std::uint64_t end, std::int64_t arg = -1);
+
+  /**
+   * Records the span from its construction to its destruction
+   */
+  class Span
+  {
+   public:
+
+    /**
+     * @param nameIn - string literal
+     * @param categoryIn - string literal
+     * @param argIn - shown with the span, -1 for none
+     */
+    Span(const char *nameIn, const char *categoryIn, std::int64_t argIn = -1)
+    {
+      name = nameIn;
+      category = categoryIn;
+      arg = argIn;
+      begin = enabled() ? now() : 0;
+      recording = enabled();
+    }
+
+    ~Span()
+    {
+      if (recording)
+      {
+        record(name, category, begin, now(), arg);
+      }
+    }
+
+    Span(const Span &) = delete;
+
+    Span &operator=(const Span &) = delete;
+
+   private:
+
+    const char *name;
+
+    const char *category;
+
+    std::int64_t arg;
+
+    std::uint64_t begin;
+
+    bool recording;
+  };
+
+  /**
+   * Traces from construction to destruction, so that every return path of a mode writes the trace
+   */
+  class Session
+  {
+   public:
+
+    /**
+     * @param pathIn - JSON file to write, empty for no tracing
+     */
+    explicit Session(std::string pathIn);
+
+    ~Session();
+
+   private:
+
+    std::string path;
+  };
+
+  struct Event
+  {
+    const char *name;
+
+    const char *category;
+
+    std::uint64_t begin;
+
+    std::uint64_t end;
+
+    std::int64_t arg;
+  };
+
+  /**
+   * Spans of one thread, written only by that thread
+   */
+  struct Ring
+  {
+    std::vector<Event> events;
+
+    /**
+     * spans recorded so far; the latest events.size() of them are kept
+     */
+    std::atomic<std::uint64_t> written{0};
+
+    std::uint64_t thread;
+
+    std::string name;
+
+    std::uint64_t session;
+  };
+
+ private:
+
+  /**
+   * @return ring of the calling thread in the current session
+   */
+  static Ring *thread_ring();
+
+  static std::atomic<bool> active;
+
+  /**
+   * bumped by start(), so threads notice their ring belongs to an earlier session
+   */
+  static std::atomic<std::uint64_t> session;
+
+  static std::mutex ringsLock;
+
+  /**
+   * rings of every session; kept until the process exits, as a thread may still be recording
+   * into its ring while stop() reads it
+   */
+  static std::vector<std::unique_ptr<Ring>> rings;
+
+  static std::size_t ringSize;
+};
+
+#endif //C____TRACER_H_
@@ -1,13 +1,22 @@
 #ifndef C____UNBOUNDEDQUEUE_H_
 #define C____UNBOUNDEDQUEUE_H_
 
+#include <algorithm>
+#include <array>
 #include <mutex>
-#include <queue>
 #include <utility>
 #include <stdexcept>
 #include <condition_variable>
-
-template<typename T>
+#include <vector>
+
+/**
+ * Blocking FIFO queue with a lane per priority: pops take the oldest item of the lowest-numbered
+ * lane that has one. Lanes are circular buffers that keep their capacity, so once a queue has
+ * held as many items as it is handed again, pushes and pops no longer allocate
+ * @tparam T - default constructible and move assignable
+ * @tparam Lanes - priority levels, lane 0 first
+ */
+template<typename T, std::size_t Lanes = 1>
 class UnboundedQueue
 {
  public:
@@ -25,13 +34,15 @@ class UnboundedQueue
 
   /**
    * @param item - const reference
+   * @param lane
    */
-  void push(const T& item);
+  void push(const T& item, std::size_t lane = 0);
 
   /**
    * @param item - double reference
+   * @param lane
    */
-  void push(T&& item);
+  void push(T&& item, std::size_t lane = 0);
 
   /**
    * Emplace
@@ -41,13 +52,33 @@ class UnboundedQueue
   template<typename... ARGS>
   void emplace(ARGS&&... args);
 
-  bool try_push(const T& item);
+  /**
+   * Push a run of items under one lock, then wake one waiter
+   * @tparam Make - T(std::size_t)
+   * @param n - items
+   * @param make - builds the k-th item of the run
+   * @param lane
+   */
+  template<typename Make>
+  void push_bulk(std::size_t n, Make &&make, std::size_t lane = 0);
+
+  bool try_push(const T& item, std::size_t lane = 0);
 
-  bool try_push(T&& item);
+  /**
+   * @param item - only moved from on success
+   * @param lane
+   * @return FALSE if the queue was locked
+   */
+  bool try_push(T&& item, std::size_t lane = 0);
 
   bool pop(T& item);
 
-  bool try_pop(T& item);
+  /**
+   * @param item
+   * @param lastLane - lanes after it are left alone
+   * @return FALSE if the queue was locked or had nothing for the lanes
+   */
+  bool try_pop(T& item, std::size_t lastLane = Lanes - 1);
 
   std::size_t size() const;
 
@@ -59,57 +90,163 @@ class UnboundedQueue
 
   bool blocking() const;
 
+  /**
+   * @return most items the queue has held at once
+   */
+  std::size_t high_water() const;
+
 
  private:
 
-  using queue_t = std::queue<T>;
-  queue_t queue;
+  /**
+   * @param lastLane
+   * @return first nonempty lane up to lastLane, Lanes if none; queueLock must be held
+   */
+  std::size_t first_lane(std::size_t lastLane) const;
+
+  /**
+   * FIFO over a circular buffer that doubles when full and never shrinks
+   */
+  class Ring
+  {
+   public:
+
+    bool empty() const
+    {
+      return length == 0;
+    }
+
+    void push(T &&item)
+    {
+      if (length == slots.size())
+      {
+        grow();
+      }
+      slots[(head + length) & (slots.size() - 1)] = std::move(item);
+      length++;
+    }
+
+    /**
+     * @param item - the oldest item, moved out; its slot is reset so it holds on to nothing
+     */
+    void pop(T &item)
+    {
+      item = std::move(slots[head]);
+      slots[head] = T();
+      head = (head + 1) & (slots.size() - 1);
+      length--;
+    }
+
+   private:
+
+    void grow()
+    {
+      std::vector<T> larger(std::max<std::size_t>(16, 2 * slots.size()));
+      for (std::size_t i = 0; i < length; i++)
+      {
+        larger[i] = std::move(slots[(head + i) & (slots.size() - 1)]);
+      }
+      slots.swap(larger);
+      head = 0;
+    }
+
+    /**
+     * a power of two long
+     */
+    std::vector<T> slots;
+
+    std::size_t head = 0;
+
+    std::size_t length = 0;
+  };
+
+  std::array<Ring, Lanes> queue;
+
+  std::size_t items = 0;
 
   bool is_block;
 
+  std::size_t maxSize = 0;
+
   mutable std::mutex queueLock;
 
   std::condition_variable condition;
 
 };
 
-template<typename T>
-UnboundedQueue<T>::UnboundedQueue(bool block) : is_block(block)
+template<typename T, std::size_t Lanes>
+UnboundedQueue<T, Lanes>::UnboundedQueue(bool block) : is_block(block)
 {}
 
-template<typename T>
-void UnboundedQueue<T>::push(const T &item)
+template<typename T, std::size_t Lanes>
+std::size_t UnboundedQueue<T, Lanes>::first_lane(std::size_t lastLane) const
+{
+  for (std::size_t lane = 0; lane <= lastLane && lane < Lanes; lane++)
+  {
+    if (!queue[lane].empty())
+    {
+      return lane;
+    }
+  }
+  return Lanes;
+}
+
+template<typename T, std::size_t Lanes>
+void UnboundedQueue<T, Lanes>::push(const T &item, std::size_t lane)
 {
   {
     std::scoped_lock guard(queueLock);
-    queue.push(item);
+    queue[lane].push(T(item));
+    maxSize = std::max(maxSize, ++items);
   }
   condition.notify_one();
 }
 
-template<typename T>
-void UnboundedQueue<T>::push(T &&item)
+template<typename T, std::size_t Lanes>
+void UnboundedQueue<T, Lanes>::push(T &&item, std::size_t lane)
 {
   {
     std::scoped_lock guard(queueLock);
-    queue.push(std::move(item));
+    queue[lane].push(std::move(item));
+    maxSize = std::max(maxSize, ++items);
   }
   condition.notify_one();
 }
 
-template<typename T>
+template<typename T, std::size_t Lanes>
 template<typename... ARGS>
-void UnboundedQueue<T>::emplace(ARGS &&... args)
+void UnboundedQueue<T, Lanes>::emplace(ARGS &&... args)
+{
+  {
+    std::scoped_lock guard(queueLock);
+    queue[0].push(T(std::forward<ARGS>(args)...));
+    maxSize = std::max(maxSize, ++items);
+  }
+  condition.notify_one();
+}
+
+template<typename T, std::size_t Lanes>
+template<typename Make>
+void UnboundedQueue<T, Lanes>::push_bulk(std::size_t n, Make &&make, std::size_t lane)
 {
+  if (n == 0)
+  {
+    return;
+  }
   {
     std::scoped_lock guard(queueLock);
-    queue.emplace(std::forward<>(args)...);
+    for (std::size_t k = 0; k < n; k++)
+    {
+      queue[lane].push(make(k));
+      items++;
+    }
+    maxSize = std::max(maxSize, items);
   }
   condition.notify_one();
 }
 
-template<typename T>
-bool UnboundedQueue<T>::try_push(const T &item)
+template<typename T, std::size_t Lanes>
+bool UnboundedQueue<T, Lanes>::try_push(const T &item, std::size_t lane)
 {
   {
     std::unique_lock guard(queueLock, std::try_to_lock);
@@ -117,14 +254,15 @@ bool UnboundedQueue<T>::try_push(const T &item)
     {
       return false;
     }
-    queue.push(item);
+    queue[lane].push(T(item));
+    maxSize = std::max(maxSize, ++items);
   }
   condition.notify_one();
   return true;
 }
 
-template<typename T>
-bool UnboundedQueue<T>::try_push(T &&item)
+template<typename T, std::size_t Lanes>
+bool UnboundedQueue<T, Lanes>::try_push(T &&item, std::size_t lane)
 {
   {
     std::unique_lock guard(queueLock, std::try_to_lock);
@@ -132,62 +270,69 @@ bool UnboundedQueue<T>::try_push(T &&item)
     {
       return false;
     }
-    queue.push(std::move(item));
+    queue[lane].push(std::move(item));
+    maxSize = std::max(maxSize, ++items);
   }
   condition.notify_one();
   return true;
 }
 
-template<typename T>
-bool UnboundedQueue<T>::pop(T &item)
+template<typename T, std::size_t Lanes>
+bool UnboundedQueue<T, Lanes>::pop(T &item)
 {
   std::unique_lock guard(queueLock);
-  condition.wait(guard, [&] () {return !queue.empty() || !is_block;});
-  if (queue.empty())
+  condition.wait(guard, [&] () {return items > 0 || !is_block;});
+  if (items == 0)
   {
     return false;
   }
-  item = std::move(queue.front());
-  queue.pop();
+  std::size_t lane = first_lane(Lanes - 1);
+  queue[lane].pop(item);
+  items--;
   return true;
 }
 
-template<typename T>
-bool UnboundedQueue<T>::try_pop(T &item)
+template<typename T, std::size_t Lanes>
+bool UnboundedQueue<T, Lanes>::try_pop(T &item, std::size_t lastLane)
 {
   std::unique_lock guard(queueLock, std::try_to_lock);
-  if (!guard || queue.empty())
+  if (!guard)
   {
     return false;
   }
-  item = std::move(queue.front());
-  queue.pop();
+  std::size_t lane = first_lane(lastLane);
+  if (lane == Lanes)
+  {
+    return false;
+  }
+  queue[lane].pop(item);
+  items--;
   return true;
 }
 
-template<typename T>
-std::size_t UnboundedQueue<T>::size() const
+template<typename T, std::size_t Lanes>
+std::size_t UnboundedQueue<T, Lanes>::size() const
 {
   std::scoped_lock guard(queueLock);
-  return queue.size();
+  return items;
 }
 
-template<typename T>
-bool UnboundedQueue<T>::empty() const
+template<typename T, std::size_t Lanes>
+bool UnboundedQueue<T, Lanes>::empty() const
 {
   std::scoped_lock guard(queueLock);
-  return queue.empty();
+  return items == 0;
 }
 
-template<typename T>
-void UnboundedQueue<T>::block()
+template<typename T, std::size_t Lanes>
+void UnboundedQueue<T, Lanes>::block()
 {
   std::scoped_lock guard(queueLock);
   is_block = true;
 }
 
-template<typename T>
-void UnboundedQueue<T>::unblock()
+template<typename T, std::size_t Lanes>
+void UnboundedQueue<T, Lanes>::unblock()
 {
   {
     std::scoped_lock guard(queueLock);
@@ -196,15 +341,22 @@ void UnboundedQueue<T>::unblock()
   condition.notify_all();
 }
 
-template<typename T>
-bool UnboundedQueue<T>::blocking() const
+template<typename T, std::size_t Lanes>
+bool UnboundedQueue<T, Lanes>::blocking() const
 {
   std::scoped_lock guard(queueLock);
   return is_block;
 }
 
-template<typename T>
-UnboundedQueue<T>::~UnboundedQueue()
+template<typename T, std::size_t Lanes>
+std::size_t UnboundedQueue<T, Lanes>::high_water() const
+{
+  std::scoped_lock guard(queueLock);
+  return maxSize;
+}
+
+template<typename T, std::size_t Lanes>
+UnboundedQueue<T, Lanes>::~UnboundedQueue()
 = default;
 
 
@@ -0,0 +1,216 @@
+#ifndef C____UNIQUEFUNCTION_H_
+#define C____UNIQUEFUNCTION_H_
+
+#include "TaskArena.h"
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template<typename Signature, std::size_t Capacity = 64>
+class UniqueFunction;
+
+/**
+ * Move-only std::function: callables of up to Capacity bytes that move without throwing are held
+ * inline, larger ones in a TaskArena block, so neither a move-only capture nor a moderately sized
+ * one costs a heap allocation
+ * @tparam R - return type
+ * @tparam ARGS - argument types
+ * @tparam Capacity - inline storage in bytes
+ */
+template<typename R, typename... ARGS, std::size_t Capacity>
+class UniqueFunction<R(ARGS...), Capacity>
+{
+ public:
+
+  UniqueFunction() noexcept = default;
+
+  UniqueFunction(std::nullptr_t) noexcept
+  {}
+
+  /**
+   * @tparam F - callable as R(ARGS...)
+   * @param f - moved or copied in
+   */
+  template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, UniqueFunction>>>
+  UniqueFunction(F &&f)
+  {
+    using Callable = std::decay_t<F>;
+    if constexpr (fits<Callable>)
+    {
+      ::new (static_cast<void *>(storage)) Callable(std::forward<F>(f));
+      ops = &inlineOps<Callable>;
+    } else {
+      static_assert(alignof(Callable) <= alignof(std::max_align_t),
+                    "over-aligned callables are not supported");
+      void *block = TaskArena::allocate(sizeof(Callable));
+      try
+      {
+        ::new (block) Callable(std::forward<F>(f));
+      } catch (...)
+      {
+        TaskArena::deallocate(block);
+        throw;
+      }
+      ::new (static_cast<void *>(storage)) Callable *(static_cast<Callable *>(block));
+      ops = &arenaOps<Callable>;
+    }
+  }
+
+  UniqueFunction(UniqueFunction &&other) noexcept
+  {
+    take(other);
+  }
+
+  UniqueFunction &operator=(UniqueFunction &&other) noexcept
+  {
+    if (this != &other)
+    {
+      reset();
+      take(other);
+    }
+    return *this;
+  }
+
+  UniqueFunction &operator=(std::nullptr_t) noexcept
+  {
+    reset();
+    return *this;
+  }
+
+  UniqueFunction(const UniqueFunction &) = delete;
+
+  UniqueFunction &operator=(const UniqueFunction &) = delete;
+
+  ~UniqueFunction()
+  {
+    reset();
+  }
+
+  explicit operator bool() const noexcept
+  {
+    return ops != nullptr;
+  }
+
+  R operator()(ARGS... args)
+  {
+    return ops->invoke(storage, std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @tparam F
+   * @return TRUE if a callable of type F is held inline
+   */
+  template<typename F>
+  static constexpr bool stored_inline()
+  {
+    return fits<std::decay_t<F>>;
+  }
+
+ private:
+
+  static_assert(Capacity >= sizeof(void *), "inline storage must hold an arena pointer");
+
+  /**
+   * What the held callable's type knows how to do
+   */
+  struct Ops
+  {
+    R (*invoke)(void *storage, ARGS &&... args);
+
+    /**
+     * move-construct into empty storage and destroy the source
+     */
+    void (*move)(void *to, void *from) noexcept;
+
+    void (*destroy)(void *storage) noexcept;
+  };
+
+  template<typename C>
+  static constexpr bool fits = sizeof(C) <= Capacity
+      && alignof(C) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<C>;
+
+  template<typename C>
+  static R call(C &callable, ARGS &&... args)
+  {
+    if constexpr (std::is_void_v<R>)
+    {
+      std::invoke(callable, std::forward<ARGS>(args)...);
+    } else {
+      return std::invoke(callable, std::forward<ARGS>(args)...);
+    }
+  }
+
+  template<typename C>
+  static C *inline_target(void *storageIn)
+  {
+    return std::launder(reinterpret_cast<C *>(storageIn));
+  }
+
+  template<typename C>
+  static C *&arena_target(void *storageIn)
+  {
+    return *std::launder(reinterpret_cast<C **>(storageIn));
+  }
+
+  template<typename C>
+  inline static const Ops inlineOps = {
+      [](void *storageIn, ARGS &&... args) -> R
+      {
+        return call(*inline_target<C>(storageIn), std::forward<ARGS>(args)...);
+      },
+      [](void *to, void *from) noexcept
+      {
+        C *source = inline_target<C>(from);
+        ::new (to) C(std::move(*source));
+        source->~C();
+      },
+      [](void *storageIn) noexcept
+      {
+        inline_target<C>(storageIn)->~C();
+      }};
+
+  template<typename C>
+  inline static const Ops arenaOps = {
+      [](void *storageIn, ARGS &&... args) -> R
+      {
+        return call(*arena_target<C>(storageIn), std::forward<ARGS>(args)...);
+      },
+      [](void *to, void *from) noexcept
+      {
+        ::new (to) C *(arena_target<C>(from));
+      },
+      [](void *storageIn) noexcept
+      {
+        C *callable = arena_target<C>(storageIn);
+        callable->~C();
+        TaskArena::deallocate(callable);
+      }};
+
+  void take(UniqueFunction &other) noexcept
+  {
+    if (other.ops != nullptr)
+    {
+      other.ops->move(storage, other.storage);
+      ops = other.ops;
+      other.ops = nullptr;
+    }
+  }
+
+  void reset() noexcept
+  {
+    if (ops != nullptr)
+    {
+      ops->destroy(storage);
+      ops = nullptr;
+    }
+  }
+
+  alignas(std::max_align_t) unsigned char storage[Capacity];
+
+  const Ops *ops = nullptr;
+};
+
+#endif //C____UNIQUEFUNCTION_H_
@@ -0,0 +1,74 @@
+#ifndef C____VIEW_H_
+#define C____VIEW_H_
+
+#include <complex>
+
+/**
+ * Region of the complex plane to be rendered, stored as a center and span so that deep zooms
+ * do not lose the view to cancellation in cxMin/cxMax
+ */
+struct View
+{
+  /**
+   * Center of the view
+   */
+  std::complex<double> center;
+
+  /**
+   * Width of the view along the real axis
+   */
+  double spanRe;
+
+  /**
+   * Height of the view along the imaginary axis
+   */
+  double spanIm;
+
+  /**
+   * Build a view from the plane bounds used by Mandelbrot::set_plane()
+   * @param cxMin
+   * @param cxMax
+   * @param cyMin
+   * @param cyMax
+   * @return view
+   */
+  static View from_plane(double cxMin, double cxMax, double cyMin, double cyMax)
+  {
+    return View{{0.5 * (cxMin + cxMax), 0.5 * (cyMin + cyMax)}, cxMax - cxMin, cyMax - cyMin};
+  }
+
+  /**
+   * Build an aspect-correct view for an image
+   * @param center
+   * @param spanRe - width of the view along the real axis
+   * @param width - image width
+   * @param height - image height
+   * @return view
+   */
+  static View from_center(std::complex<double> center, double spanRe, int width, int height)
+  {
+    return View{center, spanRe, spanRe * static_cast<double>(height) / static_cast<double>(width)};
+  }
+
+  double cx_min() const
+  {
+    return real(center) - 0.5 * spanRe;
+  }
+
+  double cx_max() const
+  {
+    return real(center) + 0.5 * spanRe;
+  }
+
+  double cy_min() const
+  {
+    return imag(center) - 0.5 * spanIm;
+  }
+
+  double cy_max() const
+  {
+    return imag(center) + 0.5 * spanIm;
+  }
+};
+
+#endif //C____VIEW_H_
@@ -0,0 +1,230 @@
+#include "ZoomSequence.h"
+#include "PPM.h"
+
+#include <cmath>
+#include <future>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+
+ZoomSequence::ZoomSequence(int width, int height, int frameCount) : width(width), height(height),
+frameCount(frameCount)
+{
+  start = View::from_plane(-2.2, 0.8, -1.5, 1.5);
+  end = start;
+  iterMax = 1000;
+  iterMaxCap = 100000;
+  perturbationThreshold = 1e-12;
+  costModel = nullptr;
+  prefix = "zoom";
+}
+
+void ZoomSequence::set_views(const View &startIn, const View &endIn)
+{
+  start = startIn;
+  end = endIn;
+}
+
+void ZoomSequence::set_iterMax(int iterMaxIn)
+{
+  iterMax = iterMaxIn;
+}
+
+void ZoomSequence::set_iterMax_cap(int iterMaxCapIn)
+{
+  iterMaxCap = iterMaxCapIn;
+}
+
+void ZoomSequence::set_file_prefix(const string &prefixIn)
+{
+  prefix = prefixIn;
+}
+
+void ZoomSequence::set_perturbation_threshold(double thresholdIn)
+{
+  perturbationThreshold = thresholdIn;
+}
+
+void ZoomSequence::set_cost_model(CostModel *costModelIn)
+{
+  costModel = costModelIn;
+}
+
+View ZoomSequence::frame_view(int frame) const
+{
+  double t = (frameCount > 1) ? static_cast<double>(frame) / (frameCount - 1) : 0.0;
+  View view{};
+  view.spanRe = start.spanRe * pow(end.spanRe / start.spanRe, t);
+  view.spanIm = start.spanIm * pow(end.spanIm / start.spanIm, t);
+  view.center = end.center + frame_offset(frame);
+  return view;
+}
+
+complex<double> ZoomSequence::frame_offset(int frame) const
+{
+  double t = (frameCount > 1) ? static_cast<double>(frame) / (frameCount - 1) : 0.0;
+  double spanRe = start.spanRe * pow(end.spanRe / start.spanRe, t);
+  // weight the center by how much of the span is left to zoom, so the target stays put on
+  // screen instead of the center sliding linearly
+  double w = (start.spanRe != end.spanRe) ? (spanRe - end.spanRe) / (start.spanRe - end.spanRe)
+                                          : 1.0 - t;
+  return (start.center - end.center) * w;
+}
+
+int ZoomSequence::reproject(int prevFrame, const vector<int> &prevIterations, int prevIterMax,
+                            int nextFrame)
+{
+  View prev = frame_view(prevFrame);
+  View next = frame_view(nextFrame);
+  complex<double> prevOffset = frame_offset(prevFrame);
+  complex<double> nextOffset = frame_offset(nextFrame);
+
+  double prevPixWidth = prev.spanRe / width;
+  double prevPixHeight = prev.spanIm / height;
+  double nextPixWidth = next.spanRe / width;
+  double nextPixHeight = next.spanIm / height;
+
+  // next frame's top-left corner in previous frame pixels; offsets keep this exact at depth
+  double x0 = ((real(nextOffset) - 0.5 * next.spanRe) - (real(prevOffset) - 0.5 * prev.spanRe))
+      / prevPixWidth;
+  double y0 = ((imag(prevOffset) + 0.5 * prev.spanIm) - (imag(nextOffset) + 0.5 * next.spanIm))
+      / prevPixHeight;
+  double xStep = nextPixWidth / prevPixWidth;
+  double yStep = nextPixHeight / prevPixHeight;
+
+  auto interior = [&](long x, long y)
+  {
+    if (x < 0 || y < 0 || x >= width || y >= height)
+    {
+      return false;
+    }
+    return prevIterations[static_cast<size_t>(y) * width + x] >= prevIterMax;
+  };
+
+  interiorHint.assign(static_cast<size_t>(width) * height, 0);
+  for (int pY = 0; pY < height; pY++)
+  {
+    auto y = static_cast<long>(floor(y0 + pY * yStep + 0.5));
+    for (int pX = 0; pX < width; pX++)
+    {
+      auto x = static_cast<long>(floor(x0 + pX * xStep + 0.5));
+      // only trust the hint away from the boundary of the previous interior
+      bool hint = true;
+      for (long dy = -1; dy <= 1 && hint; dy++)
+      {
+        for (long dx = -1; dx <= 1 && hint; dx++)
+        {
+          hint = interior(x + dx, y + dy);
+        }
+      }
+      interiorHint[static_cast<size_t>(pY) * width + pX] = hint;
+    }
+  }
+
+  // escape times grow as the zoom deepens; once more than 0.1% of the last frame escaped in the
+  // top quarter of its iterMax, boundary pixels are about to be mistaken for interior
+  size_t late = 0;
+  for (int iterations : prevIterations)
+  {
+    if (iterations < prevIterMax && 4 * iterations >= 3 * prevIterMax)
+    {
+      late++;
+    }
+  }
+  if (1000 * late > prevIterations.size())
+  {
+    return max(prevIterMax, min(iterMaxCap, prevIterMax + prevIterMax / 2));
+  }
+  return prevIterMax;
+}
+
+string ZoomSequence::frame_name(int frame) const
+{
+  stringstream name;
+  name << prefix << "_" << setw(5) << setfill('0') << frame << ".ppm";
+  return name.str();
+}
+
+void ZoomSequence::write_frame(int frame, const vector<unsigned char> &rgb) const
+{
+  PPM pgm(frame_name(frame), width, height);
+  if (!pgm.init_stream())
+  {
+    cout << "Could not open ofstream for image\n";
+  }
+  pgm.write_header();
+  pgm.write_row(rgb); // frame rows are contiguous
+  pgm.close();
+}
+
+void ZoomSequence::run(ThreadPool &pool)
+{
+  FrameRenderer renderer(width, height);
+  renderer.set_cost_model(costModel);
+  unique_ptr<ReferenceOrbit> orbit;
+  unique_ptr<BLATable> bla;
+
+  // double buffered: one frame is written while the next renders
+  vector<unsigned char> rgb[2];
+  vector<int> iterations[2];
+  future<void> writer;
+
+  int frameIterMax = iterMax;
+  for (int frame = 0; frame < frameCount; frame++)
+  {
+    int current = frame % 2;
+    if (frame > 0)
+    {
+      frameIterMax = reproject(frame - 1, iterations[1 - current], frameIterMax, frame);
+      renderer.set_interior_hint(&interiorHint);
+    }
+
+    View view = frame_view(frame);
+    renderer.set_view(view);
+    renderer.set_iterMax(frameIterMax);
+
+    if (view.spanRe / width < perturbationThreshold)
+    {
+      if (!orbit)
+      {
+        orbit = make_unique<ReferenceOrbit>(end.center, frameIterMax);
+      } else {
+        orbit->extend(frameIterMax); // reuse the orbit, only compute the new tail
+      }
+      renderer.set_reference(orbit.get(), frame_offset(frame));
+      bla = make_unique<BLATable>(*orbit, renderer.max_reference_offset(),
+                                     renderer.get_stripe_density());
+      renderer.set_bla(bla.get());
+    } else {
+      renderer.set_reference(nullptr, 0.0);
+      bla.reset();
+      renderer.set_bla(nullptr);
+    }
+
+    renderer.render(pool, rgb[current], iterations[current]);
+
+    // this buffer was last written by frame - 2, whose writer was joined before frame - 1's began
+    if (writer.valid())
+    {
+      writer.get();
+    }
+    writer = async(launch::async, [this, frame, &frameRgb = rgb[current]]()
+                   {
+                     write_frame(frame, frameRgb);
+                   });
+
+    cout << "Frame " << frame + 1 << "/" << frameCount << " rendered, iterMax " << frameIterMax
+         << "\n";
+    if (bla)
+    {
+      cout << *bla;
+    }
+  }
+
+  if (writer.valid())
+  {
+    writer.get();
+  }
+}
@@ -0,0 +1,123 @@
+#ifndef C____ZOOMSEQUENCE_H_
+#define C____ZOOMSEQUENCE_H_
+
+#include "CostModel.h"
+#include "FrameRenderer.h"
+#include "ReferenceOrbit.h"
+#include "ThreadPool.h"
+#include "View.h"
+
+#include <complex>
+#include <string>
+#include <vector>
+
+/**
+ * Renders a zoom animation from a start view to an end view through one persistent pool.
+ * Frames share work: deep frames perturb against one reference orbit at the zoom target, and
+ * each frame's iteration counts are reprojected onto the next to raise iterMax ahead of time and
+ * to flag interior regions for periodicity checking. Frame N is written while N+1 is computed
+ */
+class ZoomSequence
+{
+ public:
+
+  /**
+   * Default parametrized constructor
+   * @param width - frame width
+   * @param height - frame height
+   * @param frameCount - number of frames, start and end views included
+   */
+  ZoomSequence(int width, int height, int frameCount);
+
+  /**
+   * Set zoom path; the end view center is the zoom target
+   * @param startIn
+   * @param endIn
+   */
+  void set_views(const View &startIn, const View &endIn);
+
+  /**
+   * @param iterMaxIn - iterMax of the first frame, later frames never go below it
+   */
+  void set_iterMax(int iterMaxIn);
+
+  /**
+   * @param iterMaxCapIn - upper bound for the iterMax raised from previous frames
+   */
+  void set_iterMax_cap(int iterMaxCapIn);
+
+  /**
+   * @param prefixIn - frames are saved as prefix_00000.ppm, prefix_00001.ppm, ...
+   */
+  void set_file_prefix(const std::string &prefixIn);
+
+  /**
+   * @param thresholdIn - pixel width below which frames are perturbed against the reference orbit
+   */
+  void set_perturbation_threshold(double thresholdIn);
+
+  /**
+   * @param costModelIn - plans the bands of every frame, see FrameRenderer::set_cost_model();
+   * nullptr for bands of equal height
+   */
+  void set_cost_model(CostModel *costModelIn);
+
+  /**
+   * @param frame
+   * @return view of a frame, zooming exponentially towards the end view
+   */
+  View frame_view(int frame) const;
+
+  /**
+   * @param frame
+   * @return frame center relative to the zoom target, without the rounding of frame_view()
+   */
+  std::complex<double> frame_offset(int frame) const;
+
+  /**
+   * Render and save every frame
+   * @param pool
+   */
+  void run(ThreadPool &pool);
+
+ private:
+
+  /**
+   * Map a frame's iteration counts onto the next frame; fills interiorHint
+   * @param prevFrame
+   * @param prevIterations
+   * @param prevIterMax
+   * @param nextFrame
+   * @return iterMax suggested for the next frame
+   */
+  int reproject(int prevFrame, const std::vector<int> &prevIterations, int prevIterMax,
+                int nextFrame);
+
+  std::string frame_name(int frame) const;
+
+  void write_frame(int frame, const std::vector<unsigned char> &rgb) const;
+
+  int width;
+
+  int height;
+
+  int frameCount;
+
+  View start;
+
+  View end;
+
+  int iterMax;
+
+  int iterMaxCap;
+
+  double perturbationThreshold;
+
+  CostModel *costModel;
+
+  std::string prefix;
+
+  std::vector<unsigned char> interiorHint;
+};
+
+#endif //C____ZOOMSEQUENCE_H_
@@ -1,40 +1,154 @@
 #include "PPM.h"
+#include "AsyncWriter.h"
+#include "BandScheduler.h"
 #include "Colorization.h"
+#include "CostModel.h"
+#include "EqualizedColoring.h"
+#include "ExecutionBackend.h"
 #include "Mandelbrot.h"
+#include "PerfCounters.h"
+#include "ProgressiveRenderer.h"
+#include "RenderJob.h"
+#include "TaskGroup.h"
+#include "Thumbnailer.h"
 #include "ThreadPool.h"
+#include "TiledTIFF.h"
+#include "Tracer.h"
+#include "ZoomSequence.h"
 
+#include <algorithm>
 #include <chrono>
+#include <complex>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
 using namespace std;
 
-int main()
+/**
+ * Remove an optional flag from the arguments so the positional ones keep their places
+ * @param argc
+ * @param argv
+ * @param flag
+ * @return TRUE if the flag was given
+ */
+bool take_flag(int &argc, char *argv[], const string &flag)
 {
+  for (int i = 1; i < argc; i++)
+  {
+    if (argv[i] == flag)
+    {
+      copy(argv + i + 1, argv + argc, argv + i);
+      argc--;
+      return true;
+    }
+  }
+  return false;
+}
 
-  int width;
-  int height;
-  cout << "Enter width and height in pixels:\n";
-  cin >> width >> height;
+/**
+ * Remove an option and its values from the arguments, see take_flag()
+ * @param argc
+ * @param argv
+ * @param option
+ * @param count - number of values following the option
+ * @return values, empty if the option was not given
+ */
+vector<string> take_option(int &argc, char *argv[], const string &option, int count)
+{
+  for (int i = 1; i + count < argc; i++)
+  {
+    if (argv[i] == option)
+    {
+      vector<string> values(argv + i + 1, argv + i + 1 + count);
+      copy(argv + i + 1 + count, argv + argc, argv + i);
+      argc -= count + 1;
+      return values;
+    }
+  }
+  return {};
+}
 
-  string fileName;
-  cout << "Enter output file name in the form 'name.ppm':\n";
-  cin >> fileName;
+/**
+ * Formula options:
+ * --formula mandelbrot|multibrotD|juliaD|burningship, D = 2 ... Mandelbrot::maxDegree
+ * --julia re im - fixed c of Julia formulas
+ */
+struct FormulaOptions
+{
+  Mandelbrot::Formula formula = Mandelbrot::Formula::Mandelbrot;
 
-  auto begin = chrono::steady_clock::now();
+  int degree = 2;
 
-  // set up image stream for writing
-  PPM pgm(fileName, width, height);
-  // PPM pgm(width, height); // for testing
-  if (!pgm.init_stream())
+  complex<double> juliaC = 0.0;
+
+  /**
+   * Remove the formula options from the arguments
+   * @param argc
+   * @param argv
+   * @return FALSE for an unknown formula
+   */
+  bool take(int &argc, char *argv[])
   {
-    cout << "Could not open ofstream for image\n";
+    vector<string> julia = take_option(argc, argv, "--julia", 2);
+    if (!julia.empty())
+    {
+      juliaC = {stod(julia[0]), stod(julia[1])};
+    }
+    vector<string> name = take_option(argc, argv, "--formula", 1);
+    if (name.empty() || name[0] == "mandelbrot")
+    {
+      return true;
+    }
+    if (name[0] == "burningship")
+    {
+      formula = Mandelbrot::Formula::BurningShip;
+      return true;
+    }
+    for (auto [prefix, family] : {make_pair(string("multibrot"), Mandelbrot::Formula::Multibrot),
+                                  make_pair(string("julia"), Mandelbrot::Formula::Julia)})
+    {
+      if (name[0].rfind(prefix, 0) == 0)
+      {
+        string suffix = name[0].substr(prefix.size());
+        formula = family;
+        degree = suffix.empty() ? 2 : stoi(suffix);
+        return true;
+      }
+    }
+    cout << "Unknown formula " << name[0] << "\n";
+    return false;
   }
-  pgm.write_header();
 
-  // set up container for image row data
-  vector<unsigned char> row{}; // didn't realize array needs compile-time const length :(
-  row.resize(width * 3); // avoid constant resizing by allocating up front
+  void apply(FrameRenderer &renderer) const
+  {
+    renderer.set_formula(formula, degree);
+    renderer.set_julia_c(juliaC);
+  }
+};
+
+/**
+ * Render row by row on the calling thread and stream the rows to the image file
+ * @param renderer - image size and render parameters
+ * @param pgm - file name and header
+ * @return FALSE if the file could not be opened
+ */
+bool render_serial_rows(const FrameRenderer &renderer, const PPM &pgm)
+{
+  int width = renderer.get_width();
+  int height = renderer.get_height();
+
+  // set up image stream for writing; rows go out in ~1 MiB bands on the writer thread
+  size_t rowBytes = static_cast<size_t>(width) * 3;
+  int bandRows = max(1, static_cast<int>((1 << 20) / rowBytes));
+  string header = pgm.header_string(AsyncWriter::alignment);
+  AsyncWriter writer(pgm.get_file_name(), bandRows * rowBytes);
+  if (!writer.open(header.size() + rowBytes * height))
+  {
+    return false;
+  }
+  writer.write(header.data(), header.size(), 0);
 
   cout << "Rendering row by row:\n";
 
@@ -46,27 +160,630 @@ int main()
   // unsigned int numThreads = thread::hardware_concurrency();
   // cout << "numThreads: " << numThreads << "\n";
 
-  for (size_t pY = 0; pY < height; pY++)
+  // rows below the real axis come from the conjugates of the rows above it
+  for (int bandBegin = 0; bandBegin < height; bandBegin += bandRows)
   {
-    for (size_t pX = 0; pX < width; pX++)
+    FrameRenderer::BandRows rows = renderer.band_rows(bandBegin, min(height, bandBegin + bandRows));
+    if (rows.first < 0)
     {
-      size_t subPixel = 3 * pX;
-      gigabrot.current_pixel(pX, pY);
-      gigabrot.get_c();
-      gigabrot.iterate();
-      row[subPixel + 2] = row[subPixel + 1] = row[subPixel] =
-          gigabrot.colorize_bw();
-      gigabrot.reset();
+      continue; // written along with the mirror rows
     }
+
+    AsyncWriter::Buffer *band = writer.acquire();
+    AsyncWriter::Buffer *mirrorBand = (rows.mirrorLast >= 0) ? writer.acquire() : nullptr;
+    renderer.render_band(rows, band->data, nullptr,
+                         (mirrorBand != nullptr) ? mirrorBand->data : nullptr, nullptr);
     {
       // implemented due to possibility of having huge image, keep memory usage low
       // might be causing the issues with parallelization, ruining the embarrassingly parallel
       // aspect of the Mandelbrot set
-      pgm.write_row(row);
+      band->offset = header.size() + rows.first * rowBytes;
+      band->size = (rows.last - rows.first + 1) * rowBytes;
+      writer.submit(band);
+      if (mirrorBand != nullptr)
+      {
+        mirrorBand->offset = header.size() + rows.mirrorFirst * rowBytes;
+        mirrorBand->size = (rows.mirrorLast - rows.mirrorFirst + 1) * rowBytes;
+        writer.submit(mirrorBand);
+      }
     }
   }
 
+  writer.close();
+  cout << "File " << pgm.get_file_name() << " saved\n";
+  cout << writer;
+  return true;
+}
+
+/**
+ * Serial mode, the interactive row-by-row render driven from the command line:
+ * serial [--perf-counters] width height name.ppm [centerRe centerIm span [iterMax]]
+ * --perf-counters reads the hardware counters around the kernels and stages, see PerfCounters
+ */
+int render_serial(int argc, char *argv[])
+{
+  bool perfCounters = take_flag(argc, argv, "--perf-counters");
+  if (argc < 5)
+  {
+    cout << "Usage: " << argv[0] << " serial [--perf-counters] width height name.ppm "
+                                    "[centerRe centerIm span [iterMax]]\n";
+    return 1;
+  }
+
+  int width = stoi(argv[2]);
+  int height = stoi(argv[3]);
+
+  auto begin = chrono::steady_clock::now();
+
+  FrameRenderer renderer(width, height);
+  if (argc > 7)
+  {
+    renderer.set_view(View::from_center({stod(argv[5]), stod(argv[6])}, stod(argv[7]), width,
+                                        height));
+  }
+  if (argc > 8)
+  {
+    renderer.set_iterMax(stoi(argv[8]));
+  }
+  PerfCounters counters;
+  if (perfCounters)
+  {
+    renderer.set_perf_counters(&counters);
+  }
+  PPM pgm(argv[4], width, height);
+  if (!render_serial_rows(renderer, pgm))
+  {
+    cout << "Could not open ofstream for image\n";
+    return 1;
+  }
+  cout << "Iterations: " << renderer.get_iteration_count() << "\n";
+  if (perfCounters)
+  {
+    cout << counters;
+  }
+
+  auto end = chrono::steady_clock::now();
+  cout << "Time elapsed: "
+       << static_cast<float>(chrono::duration_cast<chrono::milliseconds>(end - begin).count()) / 1000.F
+       << " sec\n";
+  return 0;
+}
+
+/**
+ * Execution backend mode, the whole image in memory on one backend:
+ * backend [--threads n] [--equalize] name width height name.ppm [centerRe centerIm span [iterMax]]
+ * name is serial, omp-static, omp-dynamic, omp-guided, pool or std-par, see ExecutionBackend
+ * --threads sets the thread count of the backend, its default by default
+ * --equalize colors the stripe average by histogram equalization in a second pass
+ */
+int render_backend(int argc, char *argv[])
+{
+  vector<string> threadCount = take_option(argc, argv, "--threads", 1);
+  bool equalize = take_flag(argc, argv, "--equalize");
+  ExecutionBackend::Kind kind = ExecutionBackend::Kind::Serial;
+  if (argc < 6 || !ExecutionBackend::parse(argv[2], kind))
+  {
+    cout << "Usage: " << argv[0] << " backend [--threads n] [--equalize] "
+                                    "serial|omp-static|omp-dynamic|omp-guided|pool|std-par "
+                                    "width height name.ppm [centerRe centerIm span [iterMax]]\n";
+    return 1;
+  }
+  if (!ExecutionBackend::available(kind))
+  {
+    cout << "Backend " << argv[2] << " is not built in\n";
+    return 1;
+  }
+
+  int width = stoi(argv[3]);
+  int height = stoi(argv[4]);
+
+  auto begin = chrono::steady_clock::now();
+
+  FrameRenderer renderer(width, height);
+  if (argc > 8)
+  {
+    renderer.set_view(View::from_center({stod(argv[6]), stod(argv[7])}, stod(argv[8]), width,
+                                        height));
+  }
+  if (argc > 9)
+  {
+    renderer.set_iterMax(stoi(argv[9]));
+  }
+  EqualizedColoring equalizer(width, height);
+  if (equalize)
+  {
+    renderer.set_equalizer(&equalizer);
+  }
+
+  size_t threads = threadCount.empty() ? 0 : stoul(threadCount[0]);
+  unique_ptr<ThreadPool> pool;
+  if (kind == ExecutionBackend::Kind::Pool)
+  {
+    pool = make_unique<ThreadPool>((threads > 0) ? threads
+                                                 : max(1U, thread::hardware_concurrency()));
+  }
+  ExecutionBackend backend(kind, pool.get(), threads);
+
+  vector<unsigned char> rgb;
+  vector<int> iterations;
+  renderer.render(backend, rgb, iterations);
+
+  PPM pgm(argv[5], width, height);
+  if (!pgm.init_stream())
+  {
+    cout << "Could not open ofstream for image\n";
+    return 1;
+  }
+  pgm.write_header();
+  pgm.write_row(rgb); // image rows are contiguous
   pgm.close();
+  cout << "Backend: " << ExecutionBackend::name(kind) << "\n";
+  cout << "Iterations: " << renderer.get_iteration_count() << "\n";
+  if (equalize)
+  {
+    cout << equalizer;
+  }
+
+  auto end = chrono::steady_clock::now();
+  cout << "Time elapsed: "
+       << static_cast<float>(chrono::duration_cast<chrono::milliseconds>(end - begin).count()) / 1000.F
+       << " sec\n";
+  return 0;
+}
+
+/**
+ * Tiled BigTIFF mode, for images too large for a P6 file:
+ * tiled [--threads n] [--tile n] [--compression none|lzw|deflate] [--formula name]
+ * [--julia re im] width height name.tif [centerRe centerIm span [iterMax]]
+ * --tile sets the tile width and height, a multiple of 16, 256 by default
+ * --compression compresses each tile, none by default, see TiledTIFF
+ * Each task renders one row of tiles and writes its tiles as soon as it is done, so only one
+ * row of tiles per worker is ever in memory and rows land in the file in the order they finish
+ */
+int render_tiled(int argc, char *argv[])
+{
+  vector<string> threadCount = take_option(argc, argv, "--threads", 1);
+  vector<string> tileSize = take_option(argc, argv, "--tile", 1);
+  vector<string> compressionName = take_option(argc, argv, "--compression", 1);
+  TiledTIFF::Compression compression = TiledTIFF::Compression::None;
+  FormulaOptions formula;
+  if (!formula.take(argc, argv))
+  {
+    return 1;
+  }
+  if (argc < 5 || (!compressionName.empty() && !TiledTIFF::parse(compressionName[0], compression)))
+  {
+    cout << "Usage: " << argv[0] << " tiled [--threads n] [--tile n] "
+                                    "[--compression none|lzw|deflate] [--formula name] "
+                                    "[--julia re im] width height name.tif "
+                                    "[centerRe centerIm span [iterMax]]\n";
+    return 1;
+  }
+  if (!TiledTIFF::available(compression))
+  {
+    cout << "Compression " << compressionName[0] << " is not built in\n";
+    return 1;
+  }
+
+  int width = stoi(argv[2]);
+  int height = stoi(argv[3]);
+
+  auto begin = chrono::steady_clock::now();
+
+  FrameRenderer renderer(width, height);
+  if (argc > 7)
+  {
+    renderer.set_view(View::from_center({stod(argv[5]), stod(argv[6])}, stod(argv[7]), width,
+                                        height));
+  }
+  if (argc > 8)
+  {
+    renderer.set_iterMax(stoi(argv[8]));
+  }
+  formula.apply(renderer);
+
+  TiledTIFF tiff(argv[4], width, height, tileSize.empty() ? 256 : stoi(tileSize[0]),
+                 compression);
+  if (!tiff.open())
+  {
+    cout << "Could not open ofstream for image\n";
+    return 1;
+  }
+  unsigned int threads = threadCount.empty() ? thread::hardware_concurrency()
+                                             : static_cast<unsigned int>(stoul(threadCount[0]));
+  ThreadPool pool(max(1U, threads));
+  {
+    TaskGroup group(pool);
+    int size = tiff.get_tile_size();
+    for (int tileY = 0; tileY < tiff.get_tiles_down(); tileY++)
+    {
+      group.run([&renderer, &tiff, tileY, size, width, height]()
+                {
+                  int rowBegin = tileY * size;
+                  int rowEnd = min(height, rowBegin + size);
+                  size_t rowBytes = 3 * static_cast<size_t>(width);
+                  vector<unsigned char> rgb(rowBytes * (rowEnd - rowBegin));
+                  renderer.render_rows(rowBegin, rowEnd, rgb.data(), nullptr);
+                  size_t tileBytes = 3 * static_cast<size_t>(size);
+                  for (int tileX = 0; tileX < tiff.get_tiles_across(); tileX++)
+                  {
+                    tiff.write_tile(tileX, tileY, rgb.data() + tileX * tileBytes, rowBytes);
+                  }
+                });
+    }
+    group.wait(); // rethrows the first exception
+  }
+  tiff.close();
+  cout << tiff;
+  cout << "Iterations: " << renderer.get_iteration_count() << "\n";
+
+  auto end = chrono::steady_clock::now();
+  cout << "Time elapsed: "
+       << static_cast<float>(chrono::duration_cast<chrono::milliseconds>(end - begin).count()) / 1000.F
+       << " sec\n";
+  return 0;
+}
+
+/**
+ * Zoom animation mode:
+ * zoom [--cost-model] width height frames startRe startIm startSpan endRe endIm endSpan [iterMax]
+ * [prefix]
+ * spans are the widths of the views along the real axis
+ * --cost-model cuts frames into bands of equal estimated cost, see CostModel
+ */
+int render_zoom(int argc, char *argv[])
+{
+  bool costModel = take_flag(argc, argv, "--cost-model");
+  if (argc < 11)
+  {
+    cout << "Usage: " << argv[0] << " zoom [--cost-model] width height frames startRe startIm "
+                                    "startSpan endRe endIm endSpan [iterMax] [prefix]\n";
+    return 1;
+  }
+
+  int width = stoi(argv[2]);
+  int height = stoi(argv[3]);
+  int frames = stoi(argv[4]);
+  View startView = View::from_center({stod(argv[5]), stod(argv[6])}, stod(argv[7]), width, height);
+  View endView = View::from_center({stod(argv[8]), stod(argv[9])}, stod(argv[10]), width, height);
+
+  auto begin = chrono::steady_clock::now();
+
+  ZoomSequence sequence(width, height, frames);
+  sequence.set_views(startView, endView);
+  if (argc > 11)
+  {
+    sequence.set_iterMax(stoi(argv[11]));
+  }
+  if (argc > 12)
+  {
+    sequence.set_file_prefix(argv[12]);
+  }
+  CostModel model;
+  if (costModel)
+  {
+    sequence.set_cost_model(&model);
+  }
+
+  ThreadPool pool(max(1U, thread::hardware_concurrency()));
+  sequence.run(pool);
+  if (costModel)
+  {
+    cout << model;
+  }
+
+  auto end = chrono::steady_clock::now();
+  cout << "Time elapsed: "
+       << static_cast<float>(chrono::duration_cast<chrono::milliseconds>(end - begin).count()) / 1000.F
+       << " sec\n";
+  return 0;
+}
+
+/**
+ * Progressive preview mode:
+ * progressive width height name.ppm [centerRe centerIm span [iterMax [skip]]]
+ * the file is rewritten after every level; skip = 1 fills blocks whose corners agree
+ */
+int render_progressive(int argc, char *argv[])
+{
+  if (argc < 5)
+  {
+    cout << "Usage: " << argv[0] << " progressive width height name.ppm [centerRe centerIm span "
+                                    "[iterMax [skip]]]\n";
+    return 1;
+  }
+
+  int width = stoi(argv[2]);
+  int height = stoi(argv[3]);
+  string fileName = argv[4];
+
+  auto begin = chrono::steady_clock::now();
+
+  FrameRenderer renderer(width, height);
+  if (argc > 7)
+  {
+    renderer.set_view(View::from_center({stod(argv[5]), stod(argv[6])}, stod(argv[7]), width,
+                                        height));
+  }
+  if (argc > 8)
+  {
+    renderer.set_iterMax(stoi(argv[8]));
+  }
+
+  ProgressiveRenderer progressive(renderer);
+  progressive.set_block_skip(argc > 9 && stoi(argv[9]) != 0);
+  progressive.set_sink([&](int step, const vector<unsigned char> &rgb)
+                       {
+                         PPM pgm(fileName, width, height);
+                         if (!pgm.init_stream())
+                         {
+                           cout << "Could not open ofstream for image\n";
+                         }
+                         pgm.write_header();
+                         pgm.write_row(rgb);
+                         pgm.close();
+                         cout << "1/" << step << " resolution after "
+                              << chrono::duration_cast<chrono::milliseconds>(
+                                  chrono::steady_clock::now() - begin).count() << " ms\n";
+                       });
+
+  ThreadPool pool(max(1U, thread::hardware_concurrency()));
+  progressive.run(pool);
+
+  cout << progressive.get_iterated() << " of " << static_cast<size_t>(width) * height
+       << " pixels iterated\n";
+  return 0;
+}
+
+/**
+ * Parallel streaming mode within a memory budget:
+ * parallel [--threads n] [--thumbnails] [--pin-cores|--pin-nodes] [--pool-metrics]
+ * [--perf-counters] [--trace file.json] [--fill-exterior|--estimate-exterior] [--equalize]
+ * [--formula name] [--julia re im] width height name.ppm
+ * [budgetMiB [centerRe centerIm span [iterMax]]]
+ * --threads sets the worker count, all hardware threads by default
+ * --thumbnails also writes 1/4, 1/16 and 1/64 scale copies of the image
+ * --pin-cores/--pin-nodes pin the workers to cores/NUMA nodes
+ * --pool-metrics prints the thread pool's counters when it shuts down
+ * --perf-counters reads the hardware counters around the kernels and stages, see PerfCounters
+ * --trace writes a timeline of the pool, the bands and the writer for chrome://tracing or
+ * Perfetto, see Tracer
+ * --fill-exterior/--estimate-exterior iterate/interpolate pixels proven exterior by the distance
+ * estimate of a neighbor, see FrameRenderer::set_exterior_fill()
+ * --equalize colors the stripe average by histogram equalization in a second pass, see
+ * EqualizedColoring
+ * --formula, --julia choose the formula, see FormulaOptions
+ */
+int render_parallel(int argc, char *argv[])
+{
+  vector<string> threadCount = take_option(argc, argv, "--threads", 1);
+  bool thumbnails = take_flag(argc, argv, "--thumbnails");
+  ThreadPool::Affinity affinity = ThreadPool::Affinity::None;
+  if (take_flag(argc, argv, "--pin-cores"))
+  {
+    affinity = ThreadPool::Affinity::Core;
+  }
+  if (take_flag(argc, argv, "--pin-nodes"))
+  {
+    affinity = ThreadPool::Affinity::Node;
+  }
+  bool poolMetrics = take_flag(argc, argv, "--pool-metrics");
+  bool perfCounters = take_flag(argc, argv, "--perf-counters");
+  vector<string> trace = take_option(argc, argv, "--trace", 1);
+  FrameRenderer::ExteriorFill exteriorFill = FrameRenderer::ExteriorFill::Off;
+  if (take_flag(argc, argv, "--fill-exterior"))
+  {
+    exteriorFill = FrameRenderer::ExteriorFill::Exact;
+  }
+  if (take_flag(argc, argv, "--estimate-exterior"))
+  {
+    exteriorFill = FrameRenderer::ExteriorFill::Estimate;
+  }
+  bool equalize = take_flag(argc, argv, "--equalize");
+  FormulaOptions formula;
+  if (!formula.take(argc, argv))
+  {
+    return 1;
+  }
+  if (argc < 5)
+  {
+    cout << "Usage: " << argv[0] << " parallel [--threads n] [--thumbnails] "
+                                    "[--pin-cores|--pin-nodes] [--pool-metrics] [--perf-counters] "
+                                    "[--trace file.json] "
+                                    "[--fill-exterior|--estimate-exterior] "
+                                    "[--equalize] [--formula name] [--julia re im] width height name.ppm "
+                                    "[budgetMiB [centerRe centerIm span [iterMax]]]\n"
+         << "formulas: mandelbrot, multibrotD, juliaD, burningship with D = 2 ... "
+         << Mandelbrot::maxDegree << "\n";
+    return 1;
+  }
+
+  int width = stoi(argv[2]);
+  int height = stoi(argv[3]);
+  size_t budget = ((argc > 5) ? stoul(argv[5]) : 512) * 1024 * 1024;
+
+  // outlives the pool and the writer, so the trace is written once their threads are done
+  Tracer::name_thread("main");
+  Tracer::Session session(trace.empty() ? "" : trace[0]);
+  auto begin = chrono::steady_clock::now();
+
+  FrameRenderer renderer(width, height);
+  if (argc > 8)
+  {
+    renderer.set_view(View::from_center({stod(argv[6]), stod(argv[7])}, stod(argv[8]), width,
+                                        height));
+  }
+  if (argc > 9)
+  {
+    renderer.set_iterMax(stoi(argv[9]));
+  }
+  renderer.set_exterior_fill(exteriorFill);
+  formula.apply(renderer);
+  EqualizedColoring equalizer(width, height);
+  if (equalize)
+  {
+    renderer.set_equalizer(&equalizer);
+  }
+  PerfCounters counters;
+  if (perfCounters)
+  {
+    renderer.set_perf_counters(&counters);
+  }
+
+  PPM pgm(argv[4], width, height);
+  unsigned int threads = threadCount.empty() ? thread::hardware_concurrency()
+                                             : static_cast<unsigned int>(stoul(threadCount[0]));
+  ThreadPool pool(max(1U, threads), affinity);
+  if (poolMetrics)
+  {
+    pool.set_metrics_stream(&cout);
+  }
+  BandScheduler scheduler(renderer, budget);
+  Thumbnailer thumbs(width, height);
+  if (thumbnails)
+  {
+    if (!thumbs.open(argv[4]))
+    {
+      cout << "Could not open ofstream for thumbnails\n";
+      return 1;
+    }
+    scheduler.add_band_sink([&thumbs](int firstRow, int rows, const unsigned char *rgb,
+                                      const int *) { thumbs.add_band(firstRow, rows, rgb); },
+                            false);
+  }
+  if (!scheduler.run(pool, pgm))
+  {
+    cout << "Could not open ofstream for image\n";
+    return 1;
+  }
+  thumbs.close();
+  cout << "File " << pgm.get_file_name() << " saved\n";
+  cout << scheduler;
+  cout << "Iterations: " << renderer.get_iteration_count() << "\n";
+  if (affinity != ThreadPool::Affinity::None)
+  {
+    cout << pool.get_topology();
+  }
+  if (thumbnails)
+  {
+    cout << thumbs;
+  }
+  if (equalize)
+  {
+    cout << equalizer;
+  }
+  if (perfCounters)
+  {
+    cout << counters;
+  }
+  if (exteriorFill != FrameRenderer::ExteriorFill::Off)
+  {
+    FrameRenderer::FillCounts counts = renderer.get_fill_counts();
+    cout << "Exterior fill: " << counts.iterated << " pixels iterated, " << counts.exterior
+         << " iterated as known exterior, " << counts.estimated << " estimated\n";
+  }
+
+  auto end = chrono::steady_clock::now();
+  cout << "Time elapsed: "
+       << static_cast<float>(chrono::duration_cast<chrono::milliseconds>(end - begin).count()) / 1000.F
+       << " sec\n";
+  return 0;
+}
+
+/**
+ * Headless batch mode, every job on one pool:
+ * batch [--pool-metrics] [--cost-model] jobs.txt [jobsInFlight]
+ * one job per line: name.ppm width height centerRe centerIm span [iterMax [stripeDensity [thin]]]
+ * --cost-model cuts jobs into bands of equal estimated cost, see CostModel
+ */
+int render_batch(int argc, char *argv[])
+{
+  bool poolMetrics = take_flag(argc, argv, "--pool-metrics");
+  bool costModel = take_flag(argc, argv, "--cost-model");
+  if (argc < 3)
+  {
+    cout << "Usage: " << argv[0] << " batch [--pool-metrics] [--cost-model] jobs.txt "
+                                    "[jobsInFlight]\n"
+         << "job lines: name.ppm width height centerRe centerIm span [iterMax [stripeDensity "
+            "[thin]]]\n";
+    return 1;
+  }
+
+  ThreadPool pool(max(1U, thread::hardware_concurrency()));
+  if (poolMetrics)
+  {
+    pool.set_metrics_stream(&cout);
+  }
+  BatchRenderer batch(pool);
+  CostModel model;
+  if (costModel)
+  {
+    batch.set_cost_model(&model);
+  }
+  bool valid = batch.add_job_file(argv[2]);
+  if (argc > 3)
+  {
+    batch.set_jobs_in_flight(stoul(argv[3]));
+  }
+  size_t written = batch.run();
+  cout << batch;
+  if (costModel)
+  {
+    cout << model;
+  }
+  return (valid && written == batch.get_job_count()) ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc > 1 && string(argv[1]) == "zoom")
+  {
+    return render_zoom(argc, argv);
+  }
+  if (argc > 1 && string(argv[1]) == "progressive")
+  {
+    return render_progressive(argc, argv);
+  }
+  if (argc > 1 && string(argv[1]) == "parallel")
+  {
+    return render_parallel(argc, argv);
+  }
+  if (argc > 1 && string(argv[1]) == "serial")
+  {
+    return render_serial(argc, argv);
+  }
+  if (argc > 1 && string(argv[1]) == "backend")
+  {
+    return render_backend(argc, argv);
+  }
+  if (argc > 1 && string(argv[1]) == "tiled")
+  {
+    return render_tiled(argc, argv);
+  }
+  if (argc > 1 && string(argv[1]) == "batch")
+  {
+    return render_batch(argc, argv);
+  }
+
+  int width;
+  int height;
+  cout << "Enter width and height in pixels:\n";
+  cin >> width >> height;
+
+  string fileName;
+  cout << "Enter output file name in the form 'name.ppm':\n";
+  cin >> fileName;
+
+  auto begin = chrono::steady_clock::now();
+
+  PPM pgm(fileName, width, height);
+  // PPM pgm(width, height); // for testing
+  FrameRenderer renderer(width, height);
+  if (!render_serial_rows(renderer, pgm))
+  {
+    cout << "Could not open ofstream for image\n";
+    return 1;
+  }
 
   auto end = chrono::steady_clock::now();
   cout << "Time elapsed: "
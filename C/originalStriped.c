@@ -3,24 +3,27 @@
 #include <complex.h>
 #include <sys/time.h>
 #include <omp.h>
+#include <stdlib.h>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 #define M_PI 3.14159265358979323846 /* pi */
 
 
 // image size
 int iX, iY;
-const int iXmax = 500;
-const int iYmax = 500; // for main antenna
+int iXmax = 500;
+int iYmax = 500; // for main antenna
 
-const int iterationMax = 1000;
+int iterationMax = 1000;
 
 
 // coordinate plane to be rendered
-const double CxMin = -2.2;
-const double CxMax = 0.8;
-const double CyMin = -1.5;
-const double CyMax = 1.5;
+double CxMin = -2.2;
+double CxMax = 0.8;
+double CyMin = -1.5;
+double CyMax = 1.5;
 
 double pixelWidth; //=(CxMax-CxMin)/iXmax;
 double pixelHeight; // =(CyMax-CyMin)/iYmax;
@@ -113,7 +116,7 @@ int colorize(double _Complex c, unsigned char *color, int iMax) {
         if (R > escapeRadius) { // exterior of M set
             u = Z / dC;
             u = u / cabs(u);
-            reflection = cDot(u, v) + h2;
+            reflection = c_dot(u, v) + h2;
             reflection = reflection / (1.0 + h2); // rescale so that t does not get bigger than 1
             if (reflection < 0.0) reflection = 0.0;
             break;
@@ -157,7 +160,7 @@ int colorize(double _Complex c, unsigned char *color, int iMax) {
         color[1] = b; // Green
         color[2] = b; // Blue
     }
-    return 0;
+    return i; // iterations done, for benchmarking
 }
 
 
@@ -200,13 +203,32 @@ void writePixel() {
     size_t pix = 3;
 }
 
+// command line: [width height [iterationMax [CxMin CxMax CyMin CyMax [filename]]]]
+void parseArgs(int argc, char *argv[]) {
+    if (argc > 2) {
+        iXmax = atoi(argv[1]);
+        iYmax = atoi(argv[2]);
+    }
+    if (argc > 3) iterationMax = atoi(argv[3]);
+    if (argc > 7) {
+        CxMin = atof(argv[4]);
+        CxMax = atof(argv[5]);
+        CyMin = atof(argv[6]);
+        CyMax = atof(argv[7]);
+    }
+    if (argc > 8) filename = argv[8];
+}
+
 // ************************************* main *************************
-int main() {
+int main(int argc, char *argv[]) {
 
     struct timeval begin, end;
     gettimeofday(&begin, 0);
 
     double _Complex c;
+    long long iterations = 0; // total over the image
+
+    parseArgs(argc, argv);
 
     setup();
 
@@ -219,13 +241,14 @@ int main() {
             // compute pixel coordinate
             c = giveC(iX, iY);
             // compute  pixel color (24 bit = 3 bytes)
-            colorize(c, color, iterationMax);
+            iterations += colorize(c, color, iterationMax);
             // write color to the file
             fwrite(color, 1, 3, fp);
         }
     }
 
     close();
+    printf("Iterations: %lld\n", iterations);
 
     gettimeofday(&end, 0);
     long seconds = end.tv_sec - begin.tv_sec;
@@ -1,23 +1,22 @@
 #include <stdio.h>
 #include <math.h>
-#include <complex.h>
 #include <sys/time.h>
 #include <omp.h>
+#include <stdlib.h>
 
 #define M_PI 3.14159265358979323846
 
 /************************************* image variables ********************************************/
-int pX, pY;
-const int pXmax = 1280; // 2 billion+ px each side should be enough resolution right???????
-const int pYmax = 1280; // for main antenna
-const int iterationMax = 1000;
+int pXmax = 1280; // 2 billion+ px each side should be enough resolution right???????
+int pYmax = 1280; // for main antenna
+int iterationMax = 1000;
 /**************************************************************************************************/
 
 /****************************** coordinate plane to be rendered ***********************************/
-const double CxMin = -2.2;
-const double CxMax = 0.8;
-const double CyMin = -1.5;
-const double CyMax = 1.5;
+double CxMin = -2.2;
+double CxMax = 0.8;
+double CyMin = -1.5;
+double CyMax = 1.5;
 /**************************************************************************************************/
 
 /**************************************** file stuff **********************************************/
@@ -36,41 +35,15 @@ const double escapeRadius = 1000000; // big! (bail-out value)
 double lnER;
 /**************************************************************************************************/
 
-/**
- * Function: get_c
- * ---------------
- * Gets the corresponding coordinate point for the location of a pixel.
- *
- * Inputs:
- *  iX: number of x-iteration
- *  iY: number of y-iteration
- *
- * Returns:
- *  Complex double form of the coordinate.
- */
-double _Complex get_c(int iX, int iY) {
-    double Cx, Cy;
-    Cy = CyMax - iY * pixelHeight;
-    //if (fabs(Cy)< pixelHeight/3.0) Cy=0.0; // main antenna
-    Cx = CxMin + iX * pixelWidth;
-    return Cx + Cy * I;
-}
-
-/**
- * Function: c_dot
- * ---------------
- * Computes the dot product of 2 complex double vectors.
- *
- * Inputs:
- *  a: vector 1
- *  b: vector 2
- *
- * Returns:
- *  The dot product in double form.
- */
-double c_dot(double _Complex a, double _Complex b) {
-    return creal(a) * creal(b) + cimag(a) * cimag(b);
-}
+/************************************* parallel layout ********************************************/
+#if defined(__AVX__) || defined(__aarch64__)
+#define LANES 8 // pixels iterated in lockstep by the vector units, see colorize_block()
+#else
+#define LANES 1 // plain SSE2 has no blends, lockstep lanes would only cost time
+#endif
+#define BAND_ROWS 4 // rows per scheduled work item
+#define CHUNK_BANDS 16 // bands per thread buffered before a write
+/**************************************************************************************************/
 
 /**
  * Function: get_t
@@ -79,121 +52,166 @@ double c_dot(double _Complex a, double _Complex b) {
  * https://en.wikibooks.org/wiki/Fractals/Iterations_in_the_complex_plane/stripeAC
  *
  * Inputs:
- *  z: complex number
+ *  zr: real part of z
+ *  zi: imaginary part of z
  *
  * Returns:
  *  Double number
  */
-double getT(double _Complex z){
-    return 0.5+0.5*sin(stripeDensity*carg(z));
+#pragma omp declare simd
+double get_t(double zr, double zi) {
+    return 0.5+0.5*sin(stripeDensity*atan2(zi, zr));
 }
 
 /**
- * Function: colorize
- * ------------------
- * The bread and butter of this program; determines if point is within set by escape-time
- * algorithm and performs the colorization of the corresponding pixel.
+ * Function: colorize_block
+ * ------------------------
+ * The bread and butter of this program; determines if points are within set by escape-time
+ * algorithm and performs the colorization of the corresponding pixels. Up to LANES neighboring
+ * pixels of a row are iterated together, each vector step updating every pixel that has not
+ * escaped yet, so the compiler can map the lanes onto SIMD registers. All state is local, so
+ * any number of threads can color rows at once.
  *
  * Inputs:
- *  c: the current coordinate point
+ *  pX: first pixel of the block within the row
+ *  pY: row of the block
+ *  count: pixels in the block, at most LANES
  *  *row: the array of 1 row's pixel data
- *  iX: current pixel within the row
  *  iMax: maximum number of iterations
  *
  * Returns:
- *  0 if completed.
+ *  Number of iterations done over the block.
  */
-int colorize(double _Complex c, unsigned char *row, int iX, int iMax) {
-    /** global **/
-    unsigned char b; // color
-    int i; // iteration
+long long colorize_block(int pX, int pY, int count, unsigned char *row, int iMax) {
+    /** per pixel state, one lane each **/
+    double cx[LANES], zr[LANES], zi[LANES], dr[LANES], di[LANES]; // c, Z and dC = dZ/dc
+    double A[LANES], prevA[LANES]; // A(n), A(n-1)
+    /* kept as doubles like the rest of the lane state, so the vector compares and blends work on
+       one lane width */
+    double iter[LANES]; // iteration the pixel escaped at, iMax if it did not
+    double active[LANES]; // 1 while still iterating
+    int inside[LANES]; // in the main cardioid or the period-2 bulb
+    double cy = CyMax - pY * pixelHeight;
+    double ER2 = escapeRadius * escapeRadius;
     /** normal map **/
-    double _Complex Z = 0.0; // initial value for iteration Z0
-    double _Complex dC = 0.0; // derivative with respect to c
-    double reflection = FP_ZERO; // inside
     double h2 = 1.5; // height factor of the incoming light
     double angle = 45.0 / 360.0; // incoming direction of light in turns (change 1st #)
-    double _Complex v = cexp(2.0 * angle * M_PI * I); // unit 2D vector in this direction
-    double _Complex u; // normal
-    /** arg vars **/
-    double A = 0.0; // A(n)
-    double prevA = 0.0; // A(n-1)
-    double R;
-    double d; // smooth iteration count
-    double de; // boundary descriptor
-
+    double vr = cos(2.0 * angle * M_PI); // unit 2D vector in this direction
+    double vi = sin(2.0 * angle * M_PI);
+    long long iterations = 0;
+    int lane, i;
 
-    /** do the compute **/
-    for (i = 0; i < iMax; i++) {
-        dC = 2.0 * dC * Z + 1.0;
-        Z = Z * Z + c;
-        if (i>i_skip) A += getT(Z);
-        R = cabs(Z);
+    for (lane = 0; lane < LANES; lane++) {
+        cx[lane] = CxMin + (pX + lane) * pixelWidth;
+        zr[lane] = zi[lane] = dr[lane] = di[lane] = 0.0;
+        A[lane] = prevA[lane] = 0.0;
+        iter[lane] = iMax;
         /* shape checking algorithm
            skips iterating points within the main cardioid and secondary bulb, otherwise these
            would all hit the max iterations
-           removes about 91% of the set from iteration
-           REMOVE THIS IF NOT RENDERING THE ENTIRE SET - more computation per iteration if the main
-           cardioid and secondary bulb are not shown onscreen */
-        double q = ((creal(c) - 0.25) * (creal(c) - 0.25)) + (cimag(c) * cimag(c));
-        double cardioid = 0.25 * cimag(c) * cimag(c);
-        double bulb = 0.0625;
-        if ((creal(c) * creal(c) + 2 * creal(c) + 1 + cimag(c) * cimag(c)) < bulb || (q * (q +
-        (creal(c) - 0.25)) < cardioid)) {
-            break;
-        }
-        /** get normal map **/
-        if (R > escapeRadius) { // exterior of M set
-            u = Z / dC;
-            u = u / cabs(u);
-            reflection = c_dot(u, v) + h2;
-            reflection = reflection / (1.0 + h2); // rescale so that t does not get bigger than 1
-            if (reflection < 0.0) reflection = 0.0;
-            break;
-        }
-        prevA = A; // save value for interpolation
-    }
-    /** get striping **/
-    if (i == iMax)
-        A = -1.0; // interior
-    else { // exterior
-        de = 2 * R * log(R) / cabs(dC);
-        int thin = 3; // thinness of the border
-        if (de < (pixelWidth / thin)) A = FP_ZERO; //  boundary
-        else {
-            // computing interpolated average
-            A /= (i - i_skip) ; // A(n)
-            prevA /= (i - i_skip - 1) ; // A(n-1)
-            // smooth iteration count
-            d = i + 1 + log(lnER/log(R))/M_LN2;
-            d = d - (int)d; // only fractional part = interpolation coefficient
-            // linear interpolation
-            A = d*A + (1.0-d)*prevA;
-        }
+           removes about 91% of the set from iteration */
+        double q = ((cx[lane] - 0.25) * (cx[lane] - 0.25)) + (cy * cy);
+        inside[lane] = (cx[lane] * cx[lane] + 2 * cx[lane] + 1 + cy * cy) < 0.0625
+                       || (q * (q + (cx[lane] - 0.25)) < 0.25 * cy * cy);
+        if (inside[lane]) iter[lane] = 0;
+        active[lane] = (lane < count && !inside[lane]) ? 1.0 : 0.0;
     }
 
-    /** assign pixel color values **/
-    int subPixel = 3 * iX;
-    if (reflection == FP_ZERO) { // interior of Mandelbrot set = black
-        /* ppm files have pixels situated as groups of 3 ASCII chars in a row; the columns of the
-           image file will be 3x as numerous as the rows
-           attempting to store the image rows as a vector in memory and write to the file 1 row
-           at a time */
-        row[subPixel] = 0;
-        row[subPixel+1] = 0;
-        row[subPixel+2] = 0;
+    /** do the compute **/
+    for (i = 0; i < iMax; i++) {
+        double running = 0.0;
+#pragma omp simd reduction(+:running)
+        for (lane = 0; lane < LANES; lane++) {
+            double ndr = 2.0 * (dr[lane] * zr[lane] - di[lane] * zi[lane]) + 1.0;
+            double ndi = 2.0 * (dr[lane] * zi[lane] + di[lane] * zr[lane]);
+            double nzr = zr[lane] * zr[lane] - zi[lane] * zi[lane] + cx[lane];
+            double nzi = 2.0 * zr[lane] * zi[lane] + cy;
+            double t = get_t(nzr, nzi);
+            double nA = (i > i_skip) ? A[lane] + t : A[lane];
+            // blends rather than branches, so the lanes stay in step
+            int iterating = active[lane] != 0.0;
+            int escaped = nzr * nzr + nzi * nzi > ER2;
+            dr[lane] = iterating ? ndr : dr[lane];
+            di[lane] = iterating ? ndi : di[lane];
+            zr[lane] = iterating ? nzr : zr[lane];
+            zi[lane] = iterating ? nzi : zi[lane];
+            A[lane] = iterating ? nA : A[lane];
+            prevA[lane] = (iterating && !escaped) ? nA : prevA[lane]; // for interpolation
+            iter[lane] = (iterating && escaped) ? i : iter[lane];
+            active[lane] = (iterating && !escaped) ? 1.0 : 0.0;
+            running += active[lane];
+        }
+        if (running == 0.0) break;
     }
 
-    // exterior of Mandelbrot set -> normal
-    else { // multiply the underlying stripe gradient by the reflectivity map
-        if (A == FP_ZERO) b = 255; // boundary
-        else b = (unsigned char) ((254-(100*A)) * reflection); // set color bounds for striping
-
+    for (lane = 0; lane < count; lane++) {
+        unsigned char b = 0; // color; interior of Mandelbrot set = black
+        i = (int)iter[lane];
+        iterations += i;
+        if (!inside[lane] && i < iMax) { // exterior of Mandelbrot set -> normal
+            /** get normal map **/
+            double R = sqrt(zr[lane] * zr[lane] + zi[lane] * zi[lane]);
+            double dC = sqrt(dr[lane] * dr[lane] + di[lane] * di[lane]);
+            // u = Z / dC, normalized
+            double ur = (zr[lane] * dr[lane] + zi[lane] * di[lane]);
+            double ui = (zi[lane] * dr[lane] - zr[lane] * di[lane]);
+            double un = sqrt(ur * ur + ui * ui);
+            double reflection = ((ur * vr + ui * vi) / un + h2) / (1.0 + h2); // so that t <= 1
+            if (reflection < 0.0) reflection = 0.0;
+            /** get striping **/
+            double a;
+            double de = 2 * R * log(R) / dC; // boundary descriptor
+            int thin = 3; // thinness of the border
+            if (de < (pixelWidth / thin)) a = FP_ZERO; //  boundary
+            else {
+                // computing interpolated average
+                double An = A[lane] / (i - i_skip); // A(n)
+                double An1 = prevA[lane] / (i - i_skip - 1); // A(n-1)
+                // smooth iteration count
+                double d = i + 1 + log(lnER/log(R))/M_LN2;
+                d = d - (int)d; // only fractional part = interpolation coefficient
+                // linear interpolation
+                a = d*An + (1.0-d)*An1;
+            }
+            // multiply the underlying stripe gradient by the reflectivity map
+            if (reflection == FP_ZERO) b = 0;
+            else if (a == FP_ZERO) b = 255; // boundary
+            else b = (unsigned char) ((254-(100*a)) * reflection); // set color bounds for striping
+        }
+        /* ppm files have pixels situated as groups of 3 chars in a row; the columns of the image
+           file will be 3x as numerous as the rows */
+        int subPixel = 3 * (pX + lane);
         row[subPixel] = b;
         row[subPixel+1] = b;
         row[subPixel+2] = b;
     }
-    return 0;
+    return iterations;
+}
+
+/**
+ * Function: render_band
+ * ---------------------
+ * Colors rows of the image into a buffer of whole rows.
+ *
+ * Inputs:
+ *  firstRow: first row of the band
+ *  rows: rows in the band
+ *  *band: pixel data of the band's rows
+ *
+ * Returns:
+ *  Number of iterations done.
+ */
+long long render_band(int firstRow, int rows, unsigned char *band) {
+    long long iterations = 0;
+    size_t rowBytes = (size_t)pXmax * 3;
+    for (int pY = firstRow; pY < firstRow + rows; pY++) {
+        unsigned char *row = band + (size_t)(pY - firstRow) * rowBytes;
+        for (int pX = 0; pX < pXmax; pX += LANES) {
+            int count = (pXmax - pX < LANES) ? pXmax - pX : LANES;
+            iterations += colorize_block(pX, pY, count, row, iterationMax);
+        }
+    }
+    return iterations;
 }
 
 /**
@@ -262,36 +280,86 @@ void close() {
 }
 
 
+/**
+ * Function: parse_args
+ * --------------------
+ * Overrides the default image and view from the command line:
+ * [width height [iterationMax [CxMin CxMax CyMin CyMax [filename]]]]
+ *
+ * Inputs:
+ *  argc: argument count
+ *  argv: arguments
+ *
+ * Returns:
+ *  NULL
+ */
+void parse_args(int argc, char *argv[]) {
+    if (argc > 2) {
+        pXmax = atoi(argv[1]);
+        pYmax = atoi(argv[2]);
+    }
+    if (argc > 3) iterationMax = atoi(argv[3]);
+    if (argc > 7) {
+        CxMin = atof(argv[4]);
+        CxMax = atof(argv[5]);
+        CyMin = atof(argv[6]);
+        CyMax = atof(argv[7]);
+    }
+    if (argc > 8) filename = argv[8];
+}
+
+
 /********************************************** main **********************************************/
-int main() {
+int main(int argc, char *argv[]) {
     struct timeval begin, end;
     gettimeofday(&begin, 0);
 
-    double _Complex c;
+    long long iterations = 0; // total over the image, for benchmarking
 
-    unsigned char row[pXmax * 3];
+    parse_args(argc, argv);
 
     setup();
 
-    printf("Rendering row by row:\n");
+    /* rows are colored in chunks of bands, the bands of a chunk shared out dynamically; while one
+       thread writes a finished chunk in a single fwrite the others start on the next chunk in the
+       other buffer, so the file is written in order without stalling the renderers */
+    int threads = omp_get_max_threads();
+    int chunkRows = BAND_ROWS * CHUNK_BANDS * threads;
+    size_t rowBytes = (size_t)pXmax * 3;
+    unsigned char *buffers[2];
+    buffers[0] = malloc(rowBytes * chunkRows);
+    buffers[1] = malloc(rowBytes * chunkRows);
+    if (buffers[0] == NULL || buffers[1] == NULL) {
+        printf("Could not allocate %d rows\n", 2 * chunkRows);
+        return 1;
+    }
+
+    printf("Rendering %d rows at a time on %d threads:\n", chunkRows, threads);
 
+#pragma omp parallel
+    for (int firstRow = 0; firstRow < pYmax; firstRow += chunkRows) {
+        unsigned char *chunk = buffers[(firstRow / chunkRows) % 2];
+        int rows = (pYmax - firstRow < chunkRows) ? pYmax - firstRow : chunkRows;
+        int bands = (rows + BAND_ROWS - 1) / BAND_ROWS;
 
-    for (pY = 0; pY < pYmax; pY++)
-    {
-//#pragma omp parallel for schedule(dynamic)
-        for (pX = 0; pX < pXmax; pX++)
-        {
-            // compute pixel coordinate
-            c = get_c(pX, pY);
-            // compute  pixel color (24 bit = 3 bytes)
-            colorize(c, row, pX, iterationMax);
+        /* the barrier at the end of this loop also means the write of the chunk before the last
+           one is done, so its buffer can be reused for the next chunk */
+#pragma omp for schedule(dynamic) reduction(+:iterations)
+        for (int band = 0; band < bands; band++) {
+            int bandRow = band * BAND_ROWS;
+            int bandRows = (rows - bandRow < BAND_ROWS) ? rows - bandRow : BAND_ROWS;
+            iterations += render_band(firstRow + bandRow, bandRows, chunk + bandRow * rowBytes);
         }
-        // write the cached row of pixels
-        fwrite(row, 1, (size_t)sizeof(row), fp);
-        //fwrite("\n", 1, 1, fp); // unnecessary
+
+        // write the cached rows of pixels
+#pragma omp single nowait
+        fwrite(chunk, rowBytes, (size_t)rows, fp);
     }
 
+    free(buffers[0]);
+    free(buffers[1]);
     close();
+    printf("Iterations: %lld\n", iterations);
 
     gettimeofday(&end, 0);
     long seconds = end.tv_sec - begin.tv_sec;